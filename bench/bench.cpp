@@ -0,0 +1,478 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * `serene-bench` is the benchmark suite of the frontend and the JIT. It
+ * generates a corpus of synthetic `.srn` files with different shapes (deep
+ * nesting, wide lists, symbol heavy and number heavy) and measures:
+ *
+ * - The throughput of the `Reader` (MB/s and nodes/s), the number of heap
+ *   allocations and the arena bytes per node.
+ * - The end to end time of `SourceMgr::readNamespace` for each file, with
+ *   and without a warm AST cache.
+ * - The time it takes to add a generated LLVM IR module to the JIT.
+ * - The peak RSS of the process.
+ *
+ * Every measurement is the best of `-iterations` runs, and the result gets
+ * written as JSON (to the stdout or the file given by `-o`), so the CI can
+ * keep track of the regressions.
+ */
+
+#include "jit/jit.h"
+#include "options.h"
+#include "reader.h"
+#include "source_mgr.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Host.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <new>
+#include <random>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+namespace cl = llvm::cl;
+
+namespace serene::bench {
+static cl::opt<std::string> output("o", cl::desc("Write the results to <file>"),
+                                   cl::value_desc("file"), cl::init("-"));
+
+static cl::opt<unsigned> sizeMB("size",
+                                cl::desc("The size of each corpus file in MB"),
+                                cl::init(8));
+
+static cl::opt<unsigned> iterations("iterations",
+                                    cl::desc("The number of runs of each "
+                                             "benchmark"),
+                                    cl::init(5));
+
+static cl::opt<unsigned>
+    jitFunctions("jit-functions",
+                 cl::desc("The number of functions in the JIT benchmark"),
+                 cl::init(1000));
+
+static cl::opt<std::string>
+    corpusDir("corpus-dir",
+              cl::desc("Write the corpus into <dir> instead of a temporary "
+                       "directory"),
+              cl::value_desc("dir"));
+
+/// The number of heap allocations so far. It is updated by the replacement
+/// of the global `operator new` below.
+static std::atomic<size_t> allocations = 0;
+
+using Clock = std::chrono::steady_clock;
+
+/// Run \p fn `iterations` times and return the shortest run in seconds.
+static double best(const std::function<void()> &fn) {
+  double result = std::numeric_limits<double>::max();
+
+  for (unsigned i = 0; i < iterations; i++) {
+    auto start = Clock::now();
+    fn();
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    result = std::min(result, elapsed.count());
+  }
+
+  return result;
+};
+
+/// A corpus generator appends forms to the given string till it reaches the
+/// given size.
+using Generator = std::function<void(std::string &, size_t, std::mt19937 &)>;
+
+struct Corpus {
+  const char *name;
+  Generator generate;
+};
+
+static std::string makeSymbol(std::mt19937 &rng) {
+  static const char chars[] = "abcdefghijklmnopqrstuvwxyz-*?!";
+  std::string sym;
+
+  auto len = 3 + rng() % 12;
+  for (size_t i = 0; i < len; i++) {
+    sym += chars[rng() % (sizeof(chars) - 1)];
+  }
+
+  // Some of them are qualified
+  if (rng() % 4 == 0) {
+    sym = "some.ns/" + sym;
+  }
+  return sym;
+};
+
+static const Corpus corpora[] = {
+    {"deep",
+     [](std::string &buf, size_t size, std::mt19937 &rng) {
+       while (buf.size() < size) {
+         auto depth = 500 + rng() % 1500;
+         buf.append(depth, '(');
+         buf += makeSymbol(rng);
+         buf.append(depth, ')');
+         buf += '\n';
+       }
+     }},
+    {"wide",
+     [](std::string &buf, size_t size, std::mt19937 &rng) {
+       while (buf.size() < size) {
+         buf += "(vector";
+         for (auto i = 0; i < 10000; i++) {
+           buf += i % 2 == 0 ? " x" : " 1";
+         }
+         buf += ")\n";
+       }
+     }},
+    {"symbols",
+     [](std::string &buf, size_t size, std::mt19937 &rng) {
+       while (buf.size() < size) {
+         buf += "(defn " + makeSymbol(rng) + " (" + makeSymbol(rng) + " " +
+                makeSymbol(rng) + ")\n  (" + makeSymbol(rng);
+         for (auto i = 0; i < 8; i++) {
+           buf += " " + makeSymbol(rng);
+         }
+         buf += "))\n\n";
+       }
+     }},
+    {"numbers",
+     [](std::string &buf, size_t size, std::mt19937 &rng) {
+       while (buf.size() < size) {
+         buf += "(data";
+         for (auto i = 0; i < 32; i++) {
+           auto n = std::to_string(rng() % 1000000);
+           switch (rng() % 3) {
+           case 0:
+             buf += " " + n;
+             break;
+           case 1:
+             buf += " -" + n;
+             break;
+           default:
+             buf += " " + n + "." + std::to_string(rng() % 1000);
+           }
+         }
+         buf += ")\n";
+       }
+     }},
+};
+
+/// Return the peak resident set size of the process in KB.
+static long getPeakRSS() {
+  struct rusage usage {};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+};
+
+static void benchReader(llvm::json::OStream &j, llvm::StringRef name,
+                        llvm::StringRef buf) {
+  size_t nodes      = 0;
+  size_t arenaBytes = 0;
+  size_t allocs     = 0;
+
+  auto seconds = best([&] {
+    ast::Arena arena;
+    auto before = allocations.load();
+
+    Reader r(arena, buf, "bench");
+    auto ast = r.read();
+    if (!ast) {
+      llvm::report_fatal_error(ast.takeError());
+    }
+
+    allocs     = allocations.load() - before;
+    nodes      = arena.getNumberOfNodes();
+    arenaBytes = arena.getBytesAllocated();
+  });
+
+  j.object([&] {
+    j.attribute("corpus", name);
+    j.attribute("bytes", static_cast<int64_t>(buf.size()));
+    j.attribute("nodes", static_cast<int64_t>(nodes));
+    j.attribute("seconds", seconds);
+    j.attribute("mb_per_s", static_cast<double>(buf.size()) / 1e6 / seconds);
+    j.attribute("nodes_per_s", static_cast<double>(nodes) / seconds);
+    j.attribute("allocs_per_node",
+                static_cast<double>(allocs) / static_cast<double>(nodes));
+    j.attribute("arena_bytes_per_node",
+                static_cast<double>(arenaBytes) / static_cast<double>(nodes));
+  });
+};
+
+static void benchSourceMgr(llvm::json::OStream &j, llvm::StringRef name,
+                           llvm::StringRef dir) {
+  llvm::SmallString<128> astCacheDir(dir);
+  llvm::sys::path::append(astCacheDir, "ast-cache");
+
+  auto read = [&](bool cached) {
+    SourceMgr smgr;
+    std::vector<std::string> loadPaths{dir.str()};
+    smgr.setLoadPaths(loadPaths);
+
+    if (cached) {
+      smgr.setASTCacheDir(astCacheDir);
+    }
+
+    auto ns = smgr.readNamespace(name.str(), LocationRange::UnknownLocation());
+    if (!ns) {
+      llvm::report_fatal_error(ns.takeError());
+    }
+  };
+
+  auto seconds = best([&] { read(false); });
+
+  // Warm up the cache first
+  read(true);
+  auto cachedSeconds = best([&] { read(true); });
+
+  j.object([&] {
+    j.attribute("corpus", name);
+    j.attribute("seconds", seconds);
+    j.attribute("cached_seconds", cachedSeconds);
+  });
+};
+
+/// Generate a module of \p n functions in the packed calling convention of
+/// the JIT that call each other.
+static std::string makeModule(unsigned n) {
+  std::string ir;
+  llvm::raw_string_ostream os(ir);
+
+  for (unsigned i = 0; i < n; i++) {
+    os << llvm::formatv("define i64 @f{0}(i64 %x) {{\n"
+                        "  %y = mul i64 %x, {1}\n"
+                        "  %z = add i64 %y, {0}\n",
+                        i, i + 3);
+    if (i > 0) {
+      os << llvm::formatv("  %r = call i64 @f{0}(i64 %z)\n"
+                          "  ret i64 %r\n}\n",
+                          i - 1);
+    } else {
+      os << "  ret i64 %z\n}\n";
+    }
+  }
+
+  os << llvm::formatv("define void @\"bench/main\"(ptr %args) {{\n"
+                      "  %a = load ptr, ptr %args\n"
+                      "  %v = load i64, ptr %a\n"
+                      "  %r = call i64 @f{0}(i64 %v)\n"
+                      "  store i64 %r, ptr %a\n"
+                      "  ret void\n}\n",
+                      n - 1);
+  return ir;
+};
+
+static llvm::Error benchJIT(llvm::json::OStream &j, llvm::StringRef dir) {
+  llvm::SmallString<128> file(dir);
+  llvm::sys::path::append(file, "bench.ll");
+
+  {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(file, ec);
+    if (ec) {
+      return llvm::errorCodeToError(ec);
+    }
+    os << makeModule(jitFunctions);
+  }
+
+  llvm::Triple triple(llvm::sys::getProcessTriple());
+  auto opts = std::make_unique<Options>(
+      Options{.targetTriple = triple, .hostTriple = triple});
+  opts->JITenableGDBNotificationListener  = false;
+  opts->JITenablePerfNotificationListener = false;
+  opts->JITenableObjectCache              = false;
+
+  auto maybeJIT = jit::makeJIT(std::move(opts));
+  if (!maybeJIT) {
+    return maybeJIT.takeError();
+  }
+  auto &engine = *maybeJIT;
+
+  llvm::Error err = llvm::Error::success();
+
+  // It includes parsing the IR and compiling the module, since we need to
+  // look up a symbol to make the JIT compile the module.
+  auto seconds = best([&] {
+    if (err) {
+      return;
+    }
+
+    int64_t n    = 1;
+    void *args[] = {&n};
+
+    if (auto e = engine->loadModule("bench", file)) {
+      err = std::move(e);
+      return;
+    }
+
+    if (auto e = engine->invokePacked("bench/main", args)) {
+      err = std::move(e);
+      return;
+    }
+
+    if (auto e = engine->removeOldJITDylibs("bench")) {
+      err = std::move(e);
+    }
+  });
+
+  if (err) {
+    return err;
+  }
+
+  j.attributeObject("jit", [&] {
+    j.attribute("functions", static_cast<int64_t>(jitFunctions));
+    j.attribute("seconds", seconds);
+  });
+
+  return llvm::Error::success();
+};
+
+static llvm::Error run() {
+  llvm::SmallString<128> dir(corpusDir);
+
+  if (dir.empty()) {
+    if (auto ec = llvm::sys::fs::createUniqueDirectory("serene-bench", dir)) {
+      return llvm::errorCodeToError(ec);
+    }
+  } else if (auto ec = llvm::sys::fs::create_directories(dir)) {
+    return llvm::errorCodeToError(ec);
+  }
+
+  std::vector<std::string> buffers;
+  std::mt19937 rng(42);
+
+  for (const auto &corpus : corpora) {
+    std::string buf;
+    corpus.generate(buf, static_cast<size_t>(sizeMB) * 1024 * 1024, rng);
+
+    llvm::SmallString<128> file(dir);
+    llvm::sys::path::append(file, llvm::Twine(corpus.name) + "." +
+                                      SourceMgr::DEFAULT_SUFFIX);
+
+    std::error_code ec;
+    llvm::raw_fd_ostream os(file, ec);
+    if (ec) {
+      return llvm::errorCodeToError(ec);
+    }
+    os << buf;
+    buffers.push_back(std::move(buf));
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream out(output, ec);
+  if (ec) {
+    return llvm::errorCodeToError(ec);
+  }
+
+  llvm::json::OStream j(out, 2);
+  llvm::Error err = llvm::Error::success();
+
+  j.object([&] {
+    j.attribute("iterations", static_cast<int64_t>(iterations));
+
+    j.attributeArray("reader", [&] {
+      for (size_t i = 0; i < buffers.size(); i++) {
+        benchReader(j, corpora[i].name, buffers[i]);
+      }
+    });
+
+    j.attributeArray("source_mgr", [&] {
+      for (const auto &corpus : corpora) {
+        benchSourceMgr(j, corpus.name, dir);
+      }
+    });
+
+    err = benchJIT(j, dir);
+
+    j.attribute("peak_rss_kb", static_cast<int64_t>(getPeakRSS()));
+  });
+
+  out << "\n";
+
+  // Don't leave the generated corpus around unless the user asked for it
+  if (corpusDir.empty()) {
+    if (auto ec = llvm::sys::fs::remove_directories(dir)) {
+      return llvm::joinErrors(std::move(err), llvm::errorCodeToError(ec));
+    }
+  }
+
+  return err;
+};
+} // namespace serene::bench
+
+void *operator new(size_t size) {
+  serene::bench::allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (void *ptr = std::malloc(size != 0 ? size : 1)) {
+    return ptr;
+  }
+  llvm::report_bad_alloc_error("serene-bench: out of memory");
+}
+
+// LLVM allocates the slabs of the `BumpPtrAllocator`s (e.g. the arenas) via
+// the aligned `operator new`, so we have to count those as well
+void *operator new(size_t size, std::align_val_t alignment) {
+  serene::bench::allocations.fetch_add(1, std::memory_order_relaxed);
+
+  auto align = static_cast<size_t>(alignment);
+  // `aligned_alloc` wants the size to be a multiple of the alignment
+  auto rounded = (std::max<size_t>(size, 1) + align - 1) & ~(align - 1);
+
+  if (void *ptr = std::aligned_alloc(align, rounded)) {
+    return ptr;
+  }
+  llvm::report_bad_alloc_error("serene-bench: out of memory");
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "Serene's benchmark suite\n");
+
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  if (auto err = serene::bench::run()) {
+    llvm::errs() << "serene-bench: " << llvm::toString(std::move(err)) << "\n";
+    return 1;
+  }
+
+  return 0;
+}
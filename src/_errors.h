@@ -19,8 +19,6 @@
 #ifndef SERENE__ERRORS_H
 #define SERENE__ERRORS_H
 
-#include <string>
-
 // TODO: Autogenerate this file
 
 namespace serene::errors {
@@ -31,17 +29,22 @@ enum class Type {
   TwoFloatPoints,
   InvalidCharacterForSymbol,
   EOFWhileScaningAList,
+  TooDeepNesting,
+  NumberOutOfRange,
   // This error has to be the final error at all time. DO NOT CHANGE IT!
   FINALERROR,
 };
 
-static std::string errorMessages[static_cast<int>(Type::FINALERROR) + 1] = {
+static const char *const
+    errorMessages[static_cast<int>(Type::FINALERROR) + 1] = {
     "Faild to load the namespace",                      // NSLoadError
     "Faild to add the namespace to the source manager", // NSAddToSMError
     "Invalid number format",                            // InvalidDigitForNumber
     "Invalid float number format",                      // TwoFloatPoints,
     "Invalid symbol format", // InvalidCharacterForSymbol
     "Reached the end of the file while scanning for a list", // EOFWhileScaningAList
+    "Lists are nested too deep", // TooDeepNesting
+    "The number is out of the range of its type", // NumberOutOfRange
 };
 } // namespace serene::errors
 #endif
@@ -18,38 +18,98 @@
 
 #include "ast/ast.h"
 
-#include <llvm/Support/FormatVariadic.h>
+#include <llvm/ADT/APFloat.h>
+
+#include <climits>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace serene::ast {
 
+// ============================================================================
+// Arena
+// ============================================================================
+Arena::~Arena() {
+  // The memory itself belongs to the allocator and it will be released
+  // all at once. We just need to end the life of the nodes.
+  for (auto i = nodes.rbegin(); i != nodes.rend(); ++i) {
+    (*i)->~Expression();
+  }
+};
+
+void Arena::reset() {
+  for (auto i = nodes.rbegin(); i != nodes.rend(); ++i) {
+    (*i)->~Expression();
+  }
+
+  nodes.clear();
+  buffers.clear();
+  allocator.Reset();
+  numberOfNodes = 0;
+};
+
+// ============================================================================
+// Expression
+// ============================================================================
+std::string Expression::toString(const PrintOptions &opts) const {
+  std::string s;
+  llvm::raw_string_ostream os(s);
+  print(os, opts);
+  return os.str();
+};
+
+llvm::raw_ostream &operator<<(llvm::raw_ostream &os, const Expression &e) {
+  e.print(os, {});
+  return os;
+};
+
+void print(const Ast &ast, llvm::raw_ostream &os, const PrintOptions &opts) {
+  for (const auto *node : ast) {
+    node->print(os, opts);
+    os << "\n";
+  }
+};
+
+void dump(const Ast &ast, const PrintOptions &opts) {
+  print(ast, llvm::outs(), opts);
+};
+
 // ============================================================================
 // Symbol
 // ============================================================================
 Symbol::Symbol(const LocationRange &loc, llvm::StringRef name,
                llvm::StringRef currentNS)
     : Expression(loc) {
-  // IMPORTANT NOTE: the `name` and `currentNS` should be valid string and
-  //                 already validated.
-  auto partDelimiter = name.find('/');
-  if (partDelimiter == std::string::npos) {
-    nsName     = currentNS.str();
-    this->name = name.str();
-
-  } else {
-    this->name = name.substr(partDelimiter + 1, name.size()).str();
-    nsName     = name.substr(0, partDelimiter).str();
-  }
+  std::tie(nsName, this->name) = split(name, currentNS);
+  id                           = internSymbol(nsName, this->name);
 };
 
 Symbol::Symbol(Symbol &s) : Expression(s.location) {
   this->name   = s.name;
   this->nsName = s.nsName;
+  this->id     = s.id;
+};
+
+std::pair<llvm::StringRef, llvm::StringRef>
+Symbol::split(llvm::StringRef name, llvm::StringRef currentNS) {
+  // IMPORTANT NOTE: the `name` and `currentNS` should be valid string and
+  //                 already validated.
+  auto partDelimiter = name.find('/');
+  if (partDelimiter == llvm::StringRef::npos) {
+    return {currentNS, name};
+  }
+
+  return {name.substr(0, partDelimiter),
+          name.substr(partDelimiter + 1, name.size())};
 };
 
 TypeID Symbol::getType() const { return TypeID::SYMBOL; };
 
-std::string Symbol::toString() const {
-  return llvm::formatv("<Symbol {0}/{1}>", nsName, name);
+void Symbol::print(llvm::raw_ostream &os, const PrintOptions &opts) const {
+  UNUSED(opts);
+  os << "<Symbol " << nsName << "/" << name << ">";
 }
 
 bool Symbol::classof(const Expression *e) {
@@ -59,16 +119,126 @@ bool Symbol::classof(const Expression *e) {
 // ============================================================================
 // Number
 // ============================================================================
-Number::Number(const LocationRange &loc, const llvm::StringRef &n, bool neg,
-               bool fl)
-    : Expression(loc), value(n), isNeg(neg), isFloat(fl){};
+Number::Number(const LocationRange &loc, llvm::StringRef n, bool neg,
+               int64_t i)
+    : Expression(loc), value(n), isNeg(neg), isFloat(false), kind(Kind::Int),
+      intValue(i){};
+
+Number::Number(const LocationRange &loc, llvm::StringRef n, bool neg,
+               double f)
+    : Expression(loc), value(n), isNeg(neg), isFloat(true),
+      kind(Kind::Float), floatValue(f){};
+
+Number::Number(const LocationRange &loc, llvm::StringRef n, bool neg,
+               BigIntWords big)
+    : Expression(loc), value(n), isNeg(neg), isFloat(false),
+      kind(Kind::BigInt), bigValue(big){};
+
+Number::Number(Number &n)
+    : Expression(n.location), value(n.value), isNeg(n.isNeg),
+      isFloat(n.isFloat), kind(n.kind), bigValue(n.bigValue) {
+  // `bigValue` is the biggest member of the union, copying it copies the
+  // others too
+  static_assert(sizeof(BigIntWords) >= sizeof(int64_t) &&
+                sizeof(BigIntWords) >= sizeof(double));
+};
+
+std::optional<double> Number::fastPathFloat(uint64_t digits,
+                                            unsigned fractionDigits) {
+  // All the powers of ten up to 10^22 are exact in a double
+  static const double powersOfTen[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+  };
+  constexpr uint64_t maxExactInt = 1ULL << 53;
+
+  if (digits > maxExactInt || fractionDigits >= std::size(powersOfTen)) {
+    return std::nullopt;
+  }
+
+  return static_cast<double>(digits) / powersOfTen[fractionDigits];
+};
+
+Number *Number::make(Arena &arena, const LocationRange &loc,
+                     llvm::StringRef n, bool neg, bool isFloat) {
+  if (isFloat) {
+    uint64_t digits         = 0;
+    unsigned fractionDigits = 0;
+    bool fits               = n.size() <= 19; // Less than 2^64
+    auto dot                = n.find('.');
+
+    if (fits) {
+      for (char c : n) {
+        if (c != '.') {
+          digits = digits * 10 + (c - '0');
+        }
+      }
+      fractionDigits = n.size() - dot - 1;
+    }
+
+    std::optional<double> f;
+    if (fits) {
+      f = fastPathFloat(digits, fractionDigits);
+    }
+
+    if (!f) {
+      // The slow but correctly rounded path
+      llvm::APFloat apf(llvm::APFloat::IEEEdouble());
+      auto status =
+          apf.convertFromString(n, llvm::APFloat::rmNearestTiesToEven);
+
+      if (!status || (*status & llvm::APFloat::opOverflow) != 0) {
+        llvm::consumeError(status.takeError());
+        return nullptr;
+      }
+      f = apf.convertToDouble();
+    }
+
+    return arena.make<Number>(loc, n, neg, neg ? -*f : *f);
+  }
 
-Number::Number(Number &n) : Expression(n.location) { this->value = n.value; };
+  uint64_t magnitude = 0;
+  // `getAsInteger` returns true on overflow
+  if (!n.getAsInteger(10, magnitude) &&
+      magnitude <= static_cast<uint64_t>(INT64_MAX) + (neg ? 1 : 0)) {
+    auto i = neg ? static_cast<int64_t>(0 - magnitude)
+                 : static_cast<int64_t>(magnitude);
+    return arena.make<Number>(loc, n, neg, i);
+  }
+
+  // One extra bit for the sign
+  llvm::APInt big(llvm::APInt::getBitsNeeded(n, 10) + 1, n, 10);
+  if (neg) {
+    big.negate();
+  }
+
+  auto words = arena.copyArray(
+      llvm::ArrayRef<uint64_t>(big.getRawData(), big.getNumWords()));
+
+  return arena.make<Number>(
+      loc, n, neg,
+      BigIntWords{words.data(), static_cast<uint32_t>(words.size()),
+                  big.getBitWidth()});
+};
+
+llvm::APInt Number::getBigInt() const {
+  assert(kind != Kind::Float && "Not an integer");
+
+  if (kind == Kind::Int) {
+    return llvm::APInt(64, static_cast<uint64_t>(intValue),
+                       /*isSigned=*/true);
+  }
+
+  return llvm::APInt(bigValue.numBits,
+                     llvm::ArrayRef<uint64_t>(bigValue.words,
+                                              bigValue.numWords));
+};
 
 TypeID Number::getType() const { return TypeID::NUMBER; };
 
-std::string Number::toString() const {
-  return llvm::formatv("<Number {0}{1}>", isNeg ? "-" : "", value);
+void Number::print(llvm::raw_ostream &os, const PrintOptions &opts) const {
+  UNUSED(opts);
+  os << "<Number " << (isNeg ? "-" : "") << value << ">";
 }
 
 bool Number::classof(const Expression *e) {
@@ -92,36 +262,81 @@ List::List(List &&l) noexcept : Expression(l.location) {
 
 TypeID List::getType() const { return TypeID::LIST; };
 
-std::string List::toString() const {
-  std::string s{this->elements.empty() ? "-" : ""};
-
-  for (const auto &n : this->elements) {
-    s = llvm::formatv("{0}, {1}", s, n->toString());
+void List::print(llvm::raw_ostream &os, const PrintOptions &opts) const {
+  // The reader accepts lists that are nested deep enough to overflow the
+  // native stack, so instead of recursing into the nested lists we keep the
+  // lists that we are in the middle of printing on a stack of our own. Each
+  // frame holds a list and the number of its elements that we printed so
+  // far. The rest of the nodes are leaves and print themselves.
+  std::vector<std::pair<const List *, size_t>> lists;
+  const Expression *node = this;
+
+  for (;;) {
+    const auto *l = llvm::dyn_cast<List>(node);
+
+    if (l == nullptr) {
+      auto leafOpts  = opts;
+      leafOpts.depth = opts.depth + lists.size();
+      node->print(os, leafOpts);
+    } else {
+      os << "<List ";
+      auto depth = opts.depth + lists.size();
+
+      if (l->elements.empty()) {
+        os << "->";
+      } else if (opts.maxDepth != 0 && depth >= opts.maxDepth) {
+        os << "...>";
+      } else {
+        lists.emplace_back(l, 0);
+      }
+    }
+
+    // Find the next element to print and close the lists that we are done
+    // with on the way
+    for (;;) {
+      if (lists.empty()) {
+        return;
+      }
+
+      auto &[list, printed] = lists.back();
+      if (printed == list->elements.size()) {
+        os << ">";
+        lists.pop_back();
+        continue;
+      }
+
+      if (opts.maxWidth != 0 && printed == opts.maxWidth) {
+        os << ", ...>";
+        lists.pop_back();
+        continue;
+      }
+
+      os << ", ";
+      node = list->elements[printed++];
+      break;
+    }
   }
-
-  return llvm::formatv("<List {0}>", s);
 }
 
 bool List::classof(const Expression *e) {
   return e->getType() == TypeID::LIST;
 };
 
-void List::append(Node &n) { elements.push_back(std::move(n)); }
+void List::append(Node n) { elements.push_back(n); }
 // ============================================================================
 // String
 // ============================================================================
 String::String(const LocationRange &loc, llvm::StringRef v)
-    : Expression(loc), data(v.str()){};
+    : Expression(loc), data(v){};
 
 String::String(String &s) : Expression(s.location), data(s.data){};
 
 TypeID String::getType() const { return TypeID::STRING; };
 
-std::string String::toString() const {
+void String::print(llvm::raw_ostream &os, const PrintOptions &opts) const {
+  UNUSED(opts);
   const short truncateSize = 10;
-  return llvm::formatv(
-      "<String '{0}'>",
-      data.substr(0, data.size() >= truncateSize ? truncateSize : data.size()));
+  os << "<String '" << data.take_front(truncateSize) << "'>";
 }
 
 bool String::classof(const Expression *e) {
@@ -131,14 +346,15 @@ bool String::classof(const Expression *e) {
 // Keyword
 // ============================================================================
 Keyword::Keyword(const LocationRange &loc, llvm::StringRef name)
-    : Expression(loc), name(name.str()){};
+    : Expression(loc), name(name){};
 
 Keyword::Keyword(Keyword &s) : Expression(s.location) { this->name = s.name; };
 
 TypeID Keyword::getType() const { return TypeID::KEYWORD; };
 
-std::string Keyword::toString() const {
-  return llvm::formatv("<Keyword {0}>", name);
+void Keyword::print(llvm::raw_ostream &os, const PrintOptions &opts) const {
+  UNUSED(opts);
+  os << "<Keyword " << name << ">";
 }
 
 bool Keyword::classof(const Expression *e) {
@@ -148,23 +364,23 @@ bool Keyword::classof(const Expression *e) {
 // ============================================================================
 // Error
 // ============================================================================
-Error::Error(const LocationRange &loc, std::unique_ptr<Keyword> tag,
-             llvm::StringRef msg)
-    : Expression(loc), msg(msg.str()), tag(std::move(tag)){};
+Error::Error(const LocationRange &loc, Keyword *tag, llvm::StringRef msg)
+    : Expression(loc), msg(msg.str()), tag(tag){};
 
 Error::Error(Error &e) : Expression(e.location) {
   this->msg = e.msg;
-  this->tag = std::move(e.tag);
+  this->tag = e.tag;
 };
 
-TypeID Error::getType() const { return TypeID::KEYWORD; };
+TypeID Error::getType() const { return TypeID::Error; };
 
-std::string Error::toString() const {
-  return llvm::formatv("<Error {0}>", msg);
+void Error::print(llvm::raw_ostream &os, const PrintOptions &opts) const {
+  UNUSED(opts);
+  os << "<Error " << msg << ">";
 }
 
 bool Error::classof(const Expression *e) {
-  return e->getType() == TypeID::KEYWORD;
+  return e->getType() == TypeID::Error;
 };
 
 // ============================================================================
@@ -185,10 +401,36 @@ Namespace::SemanticEnv &Namespace::createEnv(SemanticEnv *parent) {
   return *environments.back();
 };
 
+Namespace::SemanticEnv &Namespace::getRootEnv() {
+  assert(!environments.empty() && "Root env is not created!");
+
+  return *environments.front();
+};
+
+Ast &Namespace::getTree() { return this->tree; }
+
+llvm::Error Namespace::ExpandTree(Ast &ast) {
+  this->tree.insert(this->tree.end(), ast.begin(), ast.end());
+  ast.clear();
+  return llvm::Error::success();
+};
+
+llvm::Error Namespace::SpliceTree(size_t first, size_t last, Ast &ast) {
+  assert(first <= last && last <= tree.size() && "Invalid range of forms");
+
+  auto pos = this->tree.erase(this->tree.begin() + first,
+                              this->tree.begin() + last);
+  this->tree.insert(pos, ast.begin(), ast.end());
+  ast.clear();
+  return llvm::Error::success();
+};
+
 TypeID Namespace::getType() const { return TypeID::NS; };
 
-std::string Namespace::toString() const {
-  return llvm::formatv("<NS {0}>", name);
+void Namespace::print(llvm::raw_ostream &os,
+                      const PrintOptions &opts) const {
+  UNUSED(opts);
+  os << "<NS " << name << ">";
 }
 
 bool Namespace::classof(const Expression *e) {
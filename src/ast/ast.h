@@ -22,16 +22,30 @@
 #include "environment.h"
 #include "location.h"
 #include "serene/config.h"
+#include "symbol_table.h"
 
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/Allocator.h>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
 #include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace serene::ast {
 
 struct Expression;
 
-using Node      = std::unique_ptr<Expression>;
+/// Nodes are owned by the `Arena` that they're allocated from. So a `Node`
+/// is just a non-owning pointer and it's valid as long as its arena is alive.
+using Node      = Expression *;
 using MaybeNode = llvm::Expected<Node>;
 
 using Ast      = std::vector<Node>;
@@ -39,12 +53,31 @@ using MaybeAst = llvm::Expected<Ast>;
 
 constexpr static auto EmptyNode = nullptr;
 
+/// The limits of printing a tree, `0` means no limit. The printer writes
+/// straight to the given stream, so printing a tree is linear in its size.
+struct PrintOptions {
+  /// The number of nested lists to print. Deeper lists get printed as
+  /// `<List ...>`.
+  unsigned maxDepth = 0;
+  /// The number of elements of a list to print. The rest get elided as
+  /// `...`.
+  unsigned maxWidth = 0;
+  /// The depth of the node that is being printed.
+  unsigned depth = 0;
+};
+
 // ============================================================================
 // Expression
 // The abstract class that all the AST nodes derived from. It provides the
 // common interface for the expressions to implement.
 // ============================================================================
 struct Expression {
+  /// Whether the arena has to call the destructor of the node or not. Nodes
+  /// that only hold trivially destructible members (e.g. `llvm::StringRef`s
+  /// pointing to the source buffer) can set this to false to let the arena
+  /// simply drop them with the rest of its memory.
+  static constexpr bool needsDestruction = true;
+
   /// The location range provide information regarding to where in the input
   /// string the current expression is used.
   LocationRange location;
@@ -57,8 +90,13 @@ struct Expression {
   /// symbol.
   virtual TypeID getType() const = 0;
 
-  /// The AST representa htion of an expression
-  virtual std::string toString() const = 0;
+  /// Print the AST representation of the expression to \p os within the
+  /// limits of \p opts.
+  virtual void print(llvm::raw_ostream &os,
+                     const PrintOptions &opts) const = 0;
+
+  /// The AST representation of the expression
+  std::string toString(const PrintOptions &opts = {}) const;
 
   /// Analyzes the semantics of current node and return a new node in case
   /// that we need to semantically rewrite the current node and replace it with
@@ -76,20 +114,118 @@ struct Expression {
   // virtual void generateIR(serene::Namespace &ns, mlir::ModuleOp &m) = 0;
 };
 
+// ============================================================================
+// Arena
+// A bump allocator that owns all the nodes of one or more ASTs. Nodes are
+// laid out contiguously in the order that they are created (which is the
+// parse order for the reader) and the whole lot will be freed in one go
+// when the arena goes away. Since the arena is the owner of the nodes, it
+// has to outlive any `Node` that points to its memory.
+// ============================================================================
+class Arena {
+  llvm::BumpPtrAllocator allocator;
+
+  /// The nodes that we have to call the destructor of before releasing the
+  /// memory. We destroy them in the reverse order of creation in a flat
+  /// loop instead of a recursive chain of destructor calls.
+  std::vector<Expression *> nodes;
+
+  /// The buffers that the nodes refer to instead of a copy in the arena
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> buffers;
+
+  size_t numberOfNodes = 0;
+
+public:
+  Arena()                         = default;
+  Arena(const Arena &)            = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena();
+
+  /// Destroy all the nodes of the arena and release its memory except for
+  /// the first slab, so the arena can be reused for a new set of nodes.
+  void reset();
+
+  /// Allocate a new node of type `T` in the arena and forward the given
+  /// \p args to the constructor of `T`.
+  template <typename T, typename... Args>
+  T *make(Args &&...args) {
+    auto *node = new (allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+    numberOfNodes++;
+
+    if constexpr (T::needsDestruction) {
+      nodes.push_back(node);
+    }
+
+    return node;
+  };
+
+  /// Copy the given \p str into the arena and return the copy. The copy is
+  /// null terminated (the null char is not part of the returned string), so
+  /// it is safe to read it the same way as a `llvm::MemoryBuffer`.
+  llvm::StringRef copyString(llvm::StringRef str) {
+    auto *data = allocator.Allocate<char>(str.size() + 1);
+    std::copy(str.begin(), str.end(), data);
+    data[str.size()] = '\0';
+    return {data, str.size()};
+  };
+
+  /// Copy the given array \p arr of trivially copyable elements into the
+  /// arena and return the copy.
+  template <typename T>
+  llvm::ArrayRef<T> copyArray(llvm::ArrayRef<T> arr) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Only trivially copyable arrays can be copied as is");
+    auto *data = allocator.Allocate<T>(arr.size());
+    std::copy(arr.begin(), arr.end(), data);
+    return {data, arr.size()};
+  };
+
+  /// Keep the given \p buf alive as long as the arena, so the nodes can refer
+  /// to its content instead of a copy of it.
+  void adopt(std::unique_ptr<llvm::MemoryBuffer> buf) {
+    buffers.push_back(std::move(buf));
+  };
+
+  /// Return the number of nodes that has been allocated in this arena.
+  size_t getNumberOfNodes() const { return numberOfNodes; };
+
+  /// Return the total number of bytes that the arena allocated so far.
+  size_t getBytesAllocated() const { return allocator.getBytesAllocated(); };
+};
+
 // ============================================================================
 // Symbol
 // It represent a lisp symbol (don't mix it up with ELF symbols).
 // ============================================================================
 struct Symbol : public Expression {
-  std::string name;
-  std::string nsName;
+  static constexpr bool needsDestruction = false;
+
+  /// Both `name` and `nsName` are slices of the source buffer (or the name
+  /// of the current namespace) that the symbol is read from. So they are
+  /// valid as long as the source buffer is alive.
+  llvm::StringRef name;
+  llvm::StringRef nsName;
+
+  /// The interned ID of the fully qualified name of the symbol. Two symbols
+  /// refer to the same `ns/name` if and only if they have the same ID.
+  SymbolID id = InvalidSymbolID;
 
   Symbol(const LocationRange &loc, llvm::StringRef name,
          llvm::StringRef currentNS);
+  /// Create a symbol out of an already split and interned name.
+  Symbol(const LocationRange &loc, llvm::StringRef name,
+         llvm::StringRef nsName, SymbolID id)
+      : Expression(loc), name(name), nsName(nsName), id(id){};
   Symbol(Symbol &s);
 
+  /// Split the given \p name of a symbol as it is written in the source
+  /// into its namespace and its name. A name without a namespace belongs to
+  /// \p currentNS.
+  static std::pair<llvm::StringRef, llvm::StringRef>
+  split(llvm::StringRef name, llvm::StringRef currentNS);
+
   TypeID getType() const override;
-  std::string toString() const override;
+  void print(llvm::raw_ostream &os, const PrintOptions &opts) const override;
 
   ~Symbol() = default;
 
@@ -100,27 +236,84 @@ struct Symbol : public Expression {
 // Number
 // ============================================================================
 struct Number : public Expression {
-  // TODO: [ast] Split the number type into their own types
-  std::string value;
-  // /TODO
+  static constexpr bool needsDestruction = false;
+
+  /// The representation of the value of the number
+  enum class Kind : uint8_t {
+    /// Fits in a 64-bit signed integer, look at `getInt`
+    Int,
+    /// An integer that doesn't fit in 64 bits, look at `getBigInt`
+    BigInt,
+    /// A double precision float, look at `getFloat`
+    Float,
+  };
+
+  /// The two's complement words of a big integer (least significant word
+  /// first) in the arena.
+  struct BigIntWords {
+    const uint64_t *words;
+    uint32_t numWords;
+    uint32_t numBits;
+  };
+
+  /// A slice of the source buffer containing the digits of the number
+  /// without the sign. Use `isNeg` for the sign.
+  llvm::StringRef value;
 
   bool isNeg;
   bool isFloat;
+  Kind kind;
 
-  Number(const LocationRange &loc, const llvm::StringRef &n, bool neg, bool fl);
+  Number(const LocationRange &loc, llvm::StringRef n, bool neg, int64_t i);
+  Number(const LocationRange &loc, llvm::StringRef n, bool neg, double f);
+  Number(const LocationRange &loc, llvm::StringRef n, bool neg,
+         BigIntWords big);
   Number(Number &n);
 
+  /// Create a number out of the given digits \p n (without the sign) in the
+  /// \p arena. It returns `nullptr` if the value is out of the range of its
+  /// type, which for now only happens to the floats beyond the range of a
+  /// double. Integers that don't fit in 64 bits become big integers.
+  static Number *make(Arena &arena, const LocationRange &loc,
+                      llvm::StringRef n, bool neg, bool isFloat);
+
+  /// The fast path of converting a float with the given decimal \p digits
+  /// (all of the digits without the `.`) and \p fractionDigits digits after
+  /// the `.` to a double. As long as \p digits fits in the mantissa of a
+  /// double and the power of ten is exact, a single division is correctly
+  /// rounded (Clinger's fast path). Otherwise it returns `std::nullopt`.
+  static std::optional<double> fastPathFloat(uint64_t digits,
+                                             unsigned fractionDigits);
+
+  /// Return the value of an integer that fits in 64 bits.
+  int64_t getInt() const {
+    assert(kind == Kind::Int && "Not a 64-bit integer");
+    return intValue;
+  };
+
+  double getFloat() const {
+    assert(kind == Kind::Float && "Not a float");
+    return floatValue;
+  };
+
+  /// Return the value of any integer, no matter how big it is.
+  llvm::APInt getBigInt() const;
+
   TypeID getType() const override;
-  std::string toString() const override;
+  void print(llvm::raw_ostream &os, const PrintOptions &opts) const override;
 
   ~Number() = default;
 
   static bool classof(const Expression *e);
+
+private:
+  union {
+    int64_t intValue;
+    double floatValue;
+    BigIntWords bigValue;
+  };
 };
 
-// ============================================================================
-// List
-// ============================================================================
 struct List : public Expression {
   Ast elements;
 
@@ -130,10 +323,10 @@ struct List : public Expression {
   List(List &&l) noexcept;
 
   TypeID getType() const override;
-  std::string toString() const override;
+  void print(llvm::raw_ostream &os, const PrintOptions &opts) const override;
 
   ~List() = default;
-  void append(Node &n);
+  void append(Node n);
 
   static bool classof(const Expression *e);
 };
@@ -142,13 +335,16 @@ struct List : public Expression {
 // String
 // ============================================================================
 struct String : public Expression {
-  std::string data;
+  static constexpr bool needsDestruction = false;
+
+  /// A slice of the source buffer
+  llvm::StringRef data;
 
   String(const LocationRange &loc, llvm::StringRef v);
   String(String &s);
 
   TypeID getType() const override;
-  std::string toString() const override;
+  void print(llvm::raw_ostream &os, const PrintOptions &opts) const override;
 
   ~String() = default;
 
@@ -159,13 +355,16 @@ struct String : public Expression {
 // Keyword
 // ============================================================================
 struct Keyword : public Expression {
-  std::string name;
+  static constexpr bool needsDestruction = false;
+
+  /// A slice of the source buffer
+  llvm::StringRef name;
 
   Keyword(const LocationRange &loc, llvm::StringRef name);
   Keyword(Keyword &s);
 
   TypeID getType() const override;
-  std::string toString() const override;
+  void print(llvm::raw_ostream &os, const PrintOptions &opts) const override;
 
   ~Keyword() = default;
 
@@ -182,14 +381,13 @@ struct Keyword : public Expression {
 // ============================================================================
 struct Error : public Expression {
   std::string msg;
-  std::unique_ptr<Keyword> tag;
+  Keyword *tag;
 
-  Error(const LocationRange &loc, std::unique_ptr<Keyword> tag,
-        llvm::StringRef msg);
+  Error(const LocationRange &loc, Keyword *tag, llvm::StringRef msg);
   Error(Error &e);
 
   TypeID getType() const override;
-  std::string toString() const override;
+  void print(llvm::raw_ostream &os, const PrintOptions &opts) const override;
 
   ~Error() = default;
 
@@ -207,6 +405,9 @@ struct Namespace : public Expression {
   std::string name;
   std::optional<std::string> filename;
 
+  /// The owner of all the nodes in the `tree` of the namespace.
+  Arena arena;
+
   Ast tree;
 
   SemanticEnvironments environments;
@@ -238,52 +439,69 @@ struct Namespace : public Expression {
   /// This function runs the semantic analyzer on the \p ast as well.
   llvm::Error ExpandTree(Ast &ast);
 
+  /// Replace the top level forms in the range of [\p first, \p last) of
+  /// the tree with the forms of the given \p ast and return any possible
+  /// error. The rest of the forms in the tree remain untouched (the same
+  /// nodes), and the replaced nodes stay in the arena till the namespace
+  /// goes away.
+  ///
+  /// This function runs the semantic analyzer on the \p ast as well.
+  llvm::Error SpliceTree(size_t first, size_t last, Ast &ast);
+
   Ast &getTree();
 
+  /// Return a reference to the arena that owns the nodes of this namespace.
+  /// Any node that is going to end up in the tree has to be allocated from
+  /// this arena.
+  Arena &getArena() { return arena; };
+
   TypeID getType() const override;
-  std::string toString() const override;
+  void print(llvm::raw_ostream &os, const PrintOptions &opts) const override;
 
   ~Namespace() = default;
 
   static bool classof(const Expression *e);
 };
 
-using MaybeNS = llvm::Expected<std::unique_ptr<Namespace>>;
+using MaybeNS    = llvm::Expected<std::unique_ptr<Namespace>>;
+using Namespaces = std::vector<std::unique_ptr<Namespace>>;
 
-/// Create a new `node` of type `T` and forwards any given parameter
-/// to the constructor of type `T`. This is the **official way** to create
-/// a new `Expression`. Here is an example:
+/// Create a new `node` of type `T` in the given \p arena and forwards any
+/// given parameter to the constructor of type `T`. This is the **official
+/// way** to create a new `Expression`. Here is an example:
 /// \code
-/// auto list = make<List>();
+/// auto list = make<List>(arena, loc);
 /// \endcode
 ///
+/// \param[arena] The arena that owns the new node.
 /// \param[args] Any argument with any type passed to this function will be
 ///              passed to the constructor of type T.
-/// \return A unique pointer to an Expression
+/// \return A pointer to an Expression
 template <typename T, typename... Args>
-Node make(Args &&...args) {
-  return std::make_unique<T>(std::forward<Args>(args)...);
+Node make(Arena &arena, Args &&...args) {
+  return arena.make<T>(std::forward<Args>(args)...);
 };
-/// Create a new `node` of type `T` and forwards any given parameter
-/// to the constructor of type `T`. This is the **official way** to create
-/// a new `Expression`. Here is an example:
+/// Create a new `node` of type `T` in the given \p arena and forwards any
+/// given parameter to the constructor of type `T`. This is the **official
+/// way** to create a new `Expression`. Here is an example:
 /// \code
-/// auto list = makeAndCast<List>();
+/// auto list = makeAndCast<List>(arena, loc);
 /// \endcode
 ///
+/// \param[arena] The arena that owns the new node.
 /// \param[args] Any argument with any type passed to this function will be
 ///              passed to the constructor of type T.
-/// \return A unique pointer to a value of type T.
+/// \return A pointer to a value of type T.
 template <typename T, typename... Args>
-std::unique_ptr<T> makeAndCast(Args &&...args) {
-  return std::make_unique<T>(std::forward<Args>(args)...);
+T *makeAndCast(Arena &arena, Args &&...args) {
+  return arena.make<T>(std::forward<Args>(args)...);
 };
 
 /// The helper function to create a new `Node` and returnsit. It should be useds
 /// where every we want to return a `MaybeNode` successfully.
 template <typename T, typename... Args>
-MaybeNode makeSuccessfulNode(Args &&...args) {
-  return make<T>(std::forward<Args>(args)...);
+MaybeNode makeSuccessfulNode(Arena &arena, Args &&...args) {
+  return make<T>(arena, std::forward<Args>(args)...);
 };
 
 /// The hlper function to creates an Error (`llvm::Error`) by passing all
@@ -300,8 +518,14 @@ MaybeNode makeErrorNode(Args &&...args) {
   return makeErrorful<E, Node>(std::forward<Args>(args)...);
 };
 
-/// Converts the given AST to string and prints it out
-void dump(Ast &);
+llvm::raw_ostream &operator<<(llvm::raw_ostream &os, const Expression &e);
+
+/// Print the given \p ast to \p os, a top level form per line.
+void print(const Ast &ast, llvm::raw_ostream &os,
+           const PrintOptions &opts = {});
+
+/// Print the given AST to the standard output
+void dump(const Ast &ast, const PrintOptions &opts = {});
 
 } // namespace serene::ast
 
@@ -0,0 +1,473 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ast/flat.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/FormatVariadic.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace serene::ast {
+
+namespace {
+/// The header of the binary format of the tree. The arrays of the tree
+/// follow it in the same order as the members of the `FlatTree`.
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t numNodes;
+  uint32_t numRoots;
+  uint64_t numChars;
+};
+
+/// "SRNF" in the byte order of the machine that wrote the tree
+constexpr uint32_t MAGIC = ('S' << 24) | ('R' << 16) | ('N' << 8) | 'F';
+} // namespace
+
+template <typename T>
+static void writeArray(llvm::raw_ostream &os, llvm::ArrayRef<T> v) {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "Only trivially copyable arrays can be written as is");
+  os.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+};
+
+/// Point \p v to the \p n elements at the beginning of \p data and drop them
+/// from \p data. It returns false if \p data is too short or if it's not
+/// aligned for `T`.
+template <typename T>
+static bool readArray(llvm::StringRef &data, llvm::ArrayRef<T> &v,
+                      uint64_t n) {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "Only trivially copyable arrays can be read as is");
+  uint64_t bytes = n * sizeof(T);
+
+  if (data.size() < bytes ||
+      reinterpret_cast<uintptr_t>(data.data()) % alignof(T) != 0) {
+    return false;
+  }
+
+  v    = llvm::ArrayRef<T>(reinterpret_cast<const T *>(data.data()), n);
+  data = data.drop_front(bytes);
+  return true;
+};
+
+/// Whether \p text looks like a number that the reader accepts, a digit
+/// followed by digits and exactly one '.' if it's a float.
+static bool isValidNumber(llvm::StringRef text, bool isFloat) {
+  if (text.empty() || std::isdigit(text.front()) == 0) {
+    return false;
+  }
+
+  bool digits = llvm::all_of(text, [](char c) {
+    return std::isdigit(c) != 0 || c == '.';
+  });
+
+  return digits && text.count('.') == (isFloat ? 1 : 0);
+};
+
+FlatTree::Index FlatTree::addNode(TypeID type, const LocationRange &loc) {
+  auto i = static_cast<Index>(storage.types.size());
+
+  storage.types.push_back(type);
+  storage.locations.push_back(loc);
+  storage.first.push_back(0);
+  storage.count.push_back(0);
+  storage.flags.push_back(0);
+  symbolIDs.push_back(InvalidSymbolID);
+
+  return i;
+};
+
+void FlatTree::setText(Index i, llvm::StringRef text) {
+  storage.first[i] = static_cast<uint32_t>(storage.strings.size());
+  storage.count[i] = static_cast<uint32_t>(text.size());
+  storage.strings.insert(storage.strings.end(), text.begin(), text.end());
+};
+
+void FlatTree::useStorage() {
+  types     = storage.types;
+  locations = storage.locations;
+  first     = storage.first;
+  count     = storage.count;
+  flags     = storage.flags;
+  strings   = storage.strings;
+};
+
+FlatTree FlatTree::build(const Ast &ast) {
+  FlatTree tree;
+  tree.numRoots = static_cast<uint32_t>(ast.size());
+
+  // The nodes in the same order as the tree, it works as the queue of the
+  // breadth first walk as well. Since the children of a list get pushed
+  // together, they end up next to each other.
+  std::vector<const Expression *> nodes(ast.begin(), ast.end());
+
+  // The offset of the text of each distinct symbol
+  llvm::StringMap<uint32_t> symbolText;
+  auto &st = tree.storage;
+
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const auto *node = nodes[i];
+    auto idx         = tree.addNode(node->getType(), node->location);
+
+    switch (node->getType()) {
+    case TypeID::SYMBOL: {
+      const auto *sym = llvm::cast<Symbol>(node);
+      auto text = llvm::formatv("{0}/{1}", sym->nsName, sym->name).str();
+
+      auto [offset, inserted] = symbolText.try_emplace(text, 0);
+      if (inserted) {
+        tree.setText(idx, text);
+        offset->second = st.first[idx];
+      } else {
+        st.first[idx] = offset->second;
+        st.count[idx] = static_cast<uint32_t>(text.size());
+      }
+
+      st.flags[idx]       = static_cast<uint32_t>(sym->nsName.size());
+      tree.symbolIDs[idx] = sym->id;
+      break;
+    }
+
+    case TypeID::NUMBER: {
+      const auto *num = llvm::cast<Number>(node);
+      tree.setText(idx, num->value);
+      st.flags[idx]   = (num->isNeg ? NegativeNumber : 0U) |
+                      (num->isFloat ? FloatNumber : 0U);
+      break;
+    }
+
+    case TypeID::STRING:
+      tree.setText(idx, llvm::cast<String>(node)->data);
+      break;
+
+    case TypeID::KEYWORD:
+      tree.setText(idx, llvm::cast<Keyword>(node)->name);
+      break;
+
+    case TypeID::Error:
+      tree.setText(idx, llvm::cast<Error>(node)->msg);
+      break;
+
+    case TypeID::LIST: {
+      const auto &elements = llvm::cast<List>(node)->elements;
+      st.first[idx]        = static_cast<uint32_t>(nodes.size());
+      st.count[idx]        = static_cast<uint32_t>(elements.size());
+      nodes.insert(nodes.end(), elements.begin(), elements.end());
+      break;
+    }
+
+    default:
+      llvm_unreachable("Unsupported node type in the flat tree");
+    }
+  }
+
+  tree.useStorage();
+  return tree;
+};
+
+unsigned FlatTree::getDepth() const {
+  // The number of the lists around each node. The lists come before their
+  // children, so a single pass in order is enough.
+  std::vector<unsigned> depths(size(), 0);
+  unsigned depth = 0;
+
+  for (Index i = 0; i < size(); i++) {
+    if (types[i] != TypeID::LIST) {
+      continue;
+    }
+
+    auto d = depths[i] + 1;
+    depth  = std::max(depth, d);
+
+    for (auto child : getChildren(i)) {
+      depths[child] = d;
+    }
+  }
+
+  return depth;
+};
+
+llvm::Expected<Ast> FlatTree::toAst(Arena &arena, bool copyText) const {
+  // A single copy of the text of all the nodes (if any), the nodes slice it.
+  llvm::StringRef pool(strings.data(), strings.size());
+  if (copyText) {
+    pool = arena.copyString(pool);
+  }
+
+  std::vector<Node> nodes(size(), EmptyNode);
+
+  // The children of a list always come after the list itself, so by going
+  // backward all of them are already created by the time we reach the list.
+  for (auto i = static_cast<Index>(size()); i-- > 0;) {
+    auto loc  = getLocation(i);
+    auto text = types[i] == TypeID::LIST ? llvm::StringRef()
+                                         : pool.substr(first[i], count[i]);
+
+    switch (types[i]) {
+    case TypeID::SYMBOL: {
+      auto ns   = text.take_front(flags[i]);
+      auto name = text.drop_front(flags[i] + 1);
+      nodes[i]  = arena.make<Symbol>(loc, name, ns, symbolIDs[i]);
+      break;
+    }
+
+    case TypeID::NUMBER:
+      // `read` only checks the digits, a float might be still out of range
+      nodes[i] = Number::make(arena, loc, text, isNegative(i), isFloat(i));
+      if (nodes[i] == nullptr) {
+        return llvm::make_error<llvm::StringError>(
+            "Invalid serialized AST: number out of range",
+            llvm::inconvertibleErrorCode());
+      }
+      break;
+
+    case TypeID::STRING:
+      nodes[i] = arena.make<String>(loc, text);
+      break;
+
+    case TypeID::KEYWORD:
+      nodes[i] = arena.make<Keyword>(loc, text);
+      break;
+
+    case TypeID::Error:
+      nodes[i] = arena.make<Error>(loc, nullptr, text);
+      break;
+
+    case TypeID::LIST: {
+      auto *list = arena.make<List>(loc);
+      list->elements.assign(nodes.begin() + first[i],
+                            nodes.begin() + first[i] + count[i]);
+      nodes[i] = list;
+      break;
+    }
+
+    default:
+      llvm_unreachable("Unsupported node type in the flat tree");
+    }
+  }
+
+  nodes.resize(numRoots);
+  return nodes;
+};
+
+void FlatTree::write(llvm::raw_ostream &os) const {
+  Header header{MAGIC, FORMAT_VERSION, static_cast<uint32_t>(size()), numRoots,
+                strings.size()};
+
+  os.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  writeArray(os, types);
+  writeArray(os, locations);
+  writeArray(os, first);
+  writeArray(os, count);
+  writeArray(os, flags);
+  writeArray(os, strings);
+};
+
+llvm::Expected<FlatTree> FlatTree::read(llvm::StringRef data,
+                                        uint32_t bufferId) {
+  auto invalid = [](llvm::StringRef reason) {
+    return llvm::make_error<llvm::StringError>(
+        "Invalid serialized AST: " + reason, llvm::inconvertibleErrorCode());
+  };
+
+  Header header{};
+  if (data.size() < sizeof(header)) {
+    return invalid("truncated header");
+  }
+
+  std::memcpy(&header, data.data(), sizeof(header));
+  data = data.drop_front(sizeof(header));
+
+  if (header.magic != MAGIC) {
+    return invalid("bad magic number");
+  }
+
+  if (header.version != FORMAT_VERSION) {
+    return invalid("unsupported version");
+  }
+
+  if (header.numRoots > header.numNodes) {
+    return invalid("more roots than nodes");
+  }
+
+  FlatTree tree;
+  tree.numRoots = header.numRoots;
+  tree.bufferId = bufferId;
+
+  uint64_t n = header.numNodes;
+  if (!readArray(data, tree.types, n) || !readArray(data, tree.locations, n) ||
+      !readArray(data, tree.first, n) || !readArray(data, tree.count, n) ||
+      !readArray(data, tree.flags, n) ||
+      !readArray(data, tree.strings, header.numChars)) {
+    return invalid("truncated or misaligned arrays");
+  }
+
+  if (!data.empty()) {
+    return invalid("trailing data");
+  }
+
+  tree.symbolIDs.resize(n, InvalidSymbolID);
+
+  // The symbols with the same name share their text
+  llvm::DenseMap<std::pair<uint32_t, uint32_t>, SymbolID> interned;
+
+  // Make sure that every range is in bounds and the children of every list
+  // come after the list itself, since `toAst` relies on it.
+  for (Index i = 0; i < n; i++) {
+    uint64_t end = static_cast<uint64_t>(tree.first[i]) + tree.count[i];
+
+    switch (tree.types[i]) {
+    case TypeID::LIST:
+      if (tree.count[i] != 0 && (tree.first[i] <= i || end > n)) {
+        return invalid("list elements out of range");
+      }
+      break;
+
+    case TypeID::SYMBOL:
+      if (end > header.numChars || tree.flags[i] >= tree.count[i]) {
+        return invalid("symbol out of range");
+      }
+      {
+        auto [id, inserted] = interned.try_emplace(
+            std::make_pair(tree.first[i], tree.count[i]), InvalidSymbolID);
+        if (inserted) {
+          id->second =
+              internSymbol(tree.getSymbolNS(i), tree.getSymbolName(i));
+        }
+        tree.symbolIDs[i] = id->second;
+      }
+      break;
+
+    case TypeID::NUMBER:
+      if (end > header.numChars || !isValidNumber(tree.getText(i),
+                                                  tree.isFloat(i))) {
+        return invalid("bad number");
+      }
+      break;
+
+    case TypeID::STRING:
+    case TypeID::KEYWORD:
+    case TypeID::Error:
+      if (end > header.numChars) {
+        return invalid("text out of range");
+      }
+      break;
+
+    default:
+      return invalid("unsupported node type");
+    }
+  }
+
+  return tree;
+};
+
+void FlatTree::print(Index i, llvm::raw_ostream &os,
+                     const PrintOptions &opts) const {
+  // The reader accepts lists that are nested deep enough to overflow the
+  // native stack, so we keep the lists that we are in the middle of printing
+  // on a stack of our own instead of recursing into them. Each frame holds a
+  // list and the number of its elements that we printed so far.
+  std::vector<std::pair<Index, Index>> lists;
+
+  for (;;) {
+    switch (types[i]) {
+    case TypeID::SYMBOL:
+      os << "<Symbol " << getSymbolNS(i) << "/" << getSymbolName(i) << ">";
+      break;
+
+    case TypeID::NUMBER:
+      os << "<Number " << (isNegative(i) ? "-" : "") << getText(i) << ">";
+      break;
+
+    case TypeID::STRING: {
+      const short truncateSize = 10;
+      os << "<String '" << getText(i).take_front(truncateSize) << "'>";
+      break;
+    }
+
+    case TypeID::KEYWORD:
+      os << "<Keyword " << getText(i) << ">";
+      break;
+
+    case TypeID::Error:
+      os << "<Error " << getText(i) << ">";
+      break;
+
+    case TypeID::LIST: {
+      os << "<List ";
+      auto depth = opts.depth + lists.size();
+
+      if (count[i] == 0) {
+        os << "->";
+      } else if (opts.maxDepth != 0 && depth >= opts.maxDepth) {
+        os << "...>";
+      } else {
+        lists.emplace_back(i, 0);
+      }
+      break;
+    }
+
+    default:
+      llvm_unreachable("Unsupported node type in the flat tree");
+    }
+
+    // Find the next element to print and close the lists that we are done
+    // with on the way
+    for (;;) {
+      if (lists.empty()) {
+        return;
+      }
+
+      auto &[list, printed] = lists.back();
+      if (printed == count[list]) {
+        os << ">";
+        lists.pop_back();
+        continue;
+      }
+
+      if (opts.maxWidth != 0 && printed == opts.maxWidth) {
+        os << ", ...>";
+        lists.pop_back();
+        continue;
+      }
+
+      os << ", ";
+      i = first[list] + printed++;
+      break;
+    }
+  }
+};
+
+std::string FlatTree::toString(Index i, const PrintOptions &opts) const {
+  std::string s;
+  llvm::raw_string_ostream os(s);
+  print(i, os, opts);
+  return os.str();
+};
+
+} // namespace serene::ast
@@ -0,0 +1,230 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * `FlatTree` is a data oriented representation of an AST. Instead of a graph
+ * of `Expression` objects with virtual functions, it keeps the nodes in a
+ * struct of arrays indexed by 32-bit handles (`FlatTree::Index`):
+ *
+ * - The `TypeID` of each node is stored inline, so dispatching on the type of
+ *   a node is a plain `switch` over an array element and not a virtual call.
+ * - The nodes are laid out in breadth first order. The top level forms come
+ *   first and the children of each list are a contiguous range of indices,
+ *   so walking through the elements of a list is a linear scan.
+ * - The text of the symbols, numbers, strings and keywords is copied into a
+ *   single pool owned by the tree and the nodes refer to it via offsets. So
+ *   the tree is self contained and all of its arrays are trivially copyable,
+ *   which means that it can be serialized via `memcpy`.
+ *
+ * The interned IDs of the symbols are the only data that is only meaningful
+ * in the current process, so they are kept on the side and they get interned
+ * again when a serialized tree is loaded (look at `write` and `read`). The
+ * symbols with the same name share their text, so each distinct symbol gets
+ * interned only once.
+ *
+ * A tree that gets read from a buffer doesn't copy its arrays, they point
+ * directly into the buffer. So loading a memory mapped file only costs a
+ * validation pass over the nodes.
+ *
+ * The reader still produces the pointer based AST, use `FlatTree::build` to
+ * flatten it for the passes that walk over the whole tree.
+ */
+
+#ifndef SERENE_AST_FLAT_H
+#define SERENE_AST_FLAT_H
+
+#include "ast/ast.h"
+#include "location.h"
+#include "serene/config.h"
+#include "symbol_table.h"
+
+#include <llvm/ADT/Sequence.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <llvm/ADT/ArrayRef.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace serene::ast {
+
+class FlatTree {
+public:
+  using Index = uint32_t;
+  using Range = llvm::iota_range<Index>;
+
+  constexpr static Index InvalidIndex = ~0U;
+
+  /// The version of the binary format of the tree. It has to be bumped
+  /// whenever the layout or the meaning of any of the arrays changes.
+  constexpr static uint32_t FORMAT_VERSION = 2;
+
+  /// The flags of the number nodes
+  enum NumberFlags : uint32_t {
+    NegativeNumber = 1U << 0,
+    FloatNumber    = 1U << 1,
+  };
+
+  FlatTree()                            = default;
+  FlatTree(FlatTree &&)                 = default;
+  FlatTree &operator=(FlatTree &&)      = default;
+  // The arrays might point to the storage of the tree
+  FlatTree(const FlatTree &)            = delete;
+  FlatTree &operator=(const FlatTree &) = delete;
+
+  /// Create a flat tree out of the given \p ast. The tree doesn't refer to
+  /// the nodes of \p ast or the source buffer afterwards.
+  static FlatTree build(const Ast &ast);
+
+  /// Create the node graph of the tree in the given \p arena and return the
+  /// top level forms. The text of the nodes gets copied to the arena too,
+  /// unless \p copyText is false. That's only safe if the text outlives the
+  /// arena, e.g. when the arena owns the buffer that the tree is read from.
+  /// It fails if a number of the tree is out of range.
+  llvm::Expected<Ast> toAst(Arena &arena, bool copyText = true) const;
+
+  /// Write the binary representation of the tree to \p os. It's a small
+  /// header followed by the raw content of the arrays in the native byte
+  /// order, so loading it back doesn't need to copy the arrays.
+  void write(llvm::raw_ostream &os) const;
+
+  /// Load a tree from the given \p data written by `write` and point all of
+  /// its locations to the buffer with the ID \p bufferId. It returns an error
+  /// if \p data is not a valid tree of the current format version, e.g.
+  /// a truncated file or a file written on a machine with different
+  /// endianness.
+  ///
+  /// The tree refers to \p data instead of copying it, so \p data has to
+  /// outlive the tree.
+  static llvm::Expected<FlatTree> read(llvm::StringRef data,
+                                       uint32_t bufferId);
+
+  /// Return the number of nodes in the tree.
+  size_t size() const { return types.size(); };
+  bool empty() const { return types.empty(); };
+
+  /// Return the indices of the top level forms.
+  Range getRoots() const { return llvm::seq<Index>(0, numRoots); };
+
+  TypeID getType(Index i) const { return types[i]; };
+
+  LocationRange getLocation(Index i) const {
+    auto loc = locations[i];
+    if (bufferId) {
+      loc.start.bufferId = *bufferId;
+      loc.end.bufferId   = *bufferId;
+    }
+    return loc;
+  };
+
+  /// Return the number of nested lists in the deepest form of the tree.
+  unsigned getDepth() const;
+
+  /// Return the indices of the elements of the list \p i.
+  Range getChildren(Index i) const {
+    assert(types[i] == TypeID::LIST && "Only lists have children");
+    return llvm::seq<Index>(first[i], first[i] + count[i]);
+  };
+
+  /// Return the text of the node \p i, e.g. the digits of a number or the
+  /// fully qualified name of a symbol (`ns/name`).
+  llvm::StringRef getText(Index i) const {
+    assert(types[i] != TypeID::LIST && "Lists don't have any text");
+    return llvm::StringRef(strings.data() + first[i], count[i]);
+  };
+
+  /// Return the name of the given symbol \p i without its namespace.
+  llvm::StringRef getSymbolName(Index i) const {
+    return getText(i).drop_front(flags[i] + 1);
+  };
+
+  /// Return the namespace of the given symbol \p i.
+  llvm::StringRef getSymbolNS(Index i) const {
+    return getText(i).take_front(flags[i]);
+  };
+
+  SymbolID getSymbolID(Index i) const { return symbolIDs[i]; };
+
+  bool isNegative(Index i) const { return (flags[i] & NegativeNumber) != 0; };
+  bool isFloat(Index i) const { return (flags[i] & FloatNumber) != 0; };
+
+  /// Print the node \p i into \p os in the same format as `print` of the
+  /// corresponding `Expression`, honouring the limits in \p opts.
+  void print(Index i, llvm::raw_ostream &os,
+             const PrintOptions &opts = {}) const;
+
+  /// Return the string representation of the node \p i. It is the same as
+  /// the `toString` of the corresponding `Expression`.
+  std::string toString(Index i, const PrintOptions &opts = {}) const;
+
+private:
+  /// The arrays of the trees that we build. The trees that we read use the
+  /// buffer that they are read from instead.
+  struct Storage {
+    std::vector<TypeID> types;
+    std::vector<LocationRange> locations;
+    std::vector<uint32_t> first;
+    std::vector<uint32_t> count;
+    std::vector<uint32_t> flags;
+    std::vector<char> strings;
+  };
+
+  Storage storage;
+
+  // All the per node arrays have the same size
+  llvm::ArrayRef<TypeID> types;
+  llvm::ArrayRef<LocationRange> locations;
+
+  /// The type specific data of each node. For lists, `first` and `count`
+  /// describe the range of the children, for the rest the range of the text
+  /// in `strings`.
+  llvm::ArrayRef<uint32_t> first;
+  llvm::ArrayRef<uint32_t> count;
+
+  /// For symbols the length of the namespace part of the text and for
+  /// numbers a combination of `NumberFlags`.
+  llvm::ArrayRef<uint32_t> flags;
+
+  /// The text of all the nodes
+  llvm::ArrayRef<char> strings;
+
+  /// The interned IDs of the symbols (`InvalidSymbolID` for the rest). They
+  /// are only valid in this process, so the tree always owns them.
+  std::vector<SymbolID> symbolIDs;
+
+  /// The buffer that the nodes of a tree that we read belong to. The stored
+  /// locations refer to the buffers of the process that wrote the tree.
+  std::optional<uint32_t> bufferId;
+
+  /// The number of the top level forms, they're the first nodes
+  uint32_t numRoots = 0;
+
+  Index addNode(TypeID type, const LocationRange &loc);
+  void setText(Index i, llvm::StringRef text);
+
+  /// Point the arrays to `storage`, once we're done building the tree.
+  void useStorage();
+};
+
+} // namespace serene::ast
+#endif
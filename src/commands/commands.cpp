@@ -18,13 +18,135 @@
 
 #include "commands/commands.h"
 
-#include <stdio.h>
+#include "instrumentation.h"
+#include "jit/aot.h"
+#include "jit/jit.h"
+#include "location.h"
+#include "options.h"
+#include "runtime/gc.h"
+#include "source_mgr.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/TargetParser/Host.h>
+#include <llvm/TargetParser/Triple.h>
+
+#include <memory>
+#include <vector>
 
 namespace serene::commands {
+/// Print the usage of `serene cc` to \p os
+static void printCCUsage(llvm::raw_ostream &os) {
+  os << "Usage: serene cc [-c] [-O<0-3>] [-fprofile-use=<profile>] "
+     << "-o <output> <file>...\n\n"
+     << "Compile the LLVM IR (textual or bitcode) of the given namespaces\n"
+     << "ahead of time. The name of each file without the extension is the\n"
+     << "name of its namespace. The output is a static archive, or with `-c`\n"
+     << "a directory containing an object file per namespace. Link it with\n"
+     << "`-lserene-runtime -lgc -Wl,--gc-sections`. `-fprofile-use` takes\n"
+     << "the profile of a `serene server --profile-generate` run.\n";
+};
+
 int cc(int argc, char **argv) {
-  printf(">> %d, %s\n", argc, argv[0]);
+  auto kind  = jit::AOTOutput::Archive;
+  auto phase = CompilationPhase::O2;
+  llvm::StringRef output;
+  llvm::StringRef profile;
+  std::vector<jit::NamespaceModule> modules;
+
+  // `argv[0]` is the name of the subcommand
+  for (int i = 1; i < argc; i++) {
+    llvm::StringRef arg(argv[i]);
+
+    if (arg == "-c") {
+      kind = jit::AOTOutput::Objects;
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg == "-O0") {
+      phase = CompilationPhase::NoOptimization;
+    } else if (arg == "-O1") {
+      phase = CompilationPhase::O1;
+    } else if (arg == "-O2") {
+      phase = CompilationPhase::O2;
+    } else if (arg == "-O3") {
+      phase = CompilationPhase::O3;
+    } else if (arg.consume_front("-fprofile-use=")) {
+      profile = arg;
+    } else if (arg == "-h" || arg == "--help") {
+      printCCUsage(llvm::outs());
+      return 0;
+    } else if (arg.startswith("-")) {
+      llvm::errs() << "Unknown option '" << arg << "'\n";
+      printCCUsage(llvm::errs());
+      return 1;
+    } else {
+      modules.push_back({llvm::sys::path::stem(arg).str(),
+                         jit::irFileGenerator(arg)});
+    }
+  }
+
+  if (output.empty() || modules.empty()) {
+    printCCUsage(llvm::errs());
+    return 1;
+  }
+
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  llvm::Triple triple(llvm::sys::getProcessTriple());
+  Options opts{.targetTriple = triple, .hostTriple = triple};
+  opts.compilationPhase = phase;
+  opts.profileUse       = profile.str();
+
+  if (auto err = jit::compileAOT(opts, modules, kind, output)) {
+    llvm::errs() << llvm::toString(std::move(err)) << "\n";
+    return 1;
+  }
+
   return 0;
 }
 
-int run() { return 0; }
+int run(const Options &opts, RunOptions ropts) {
+  // The source manager and the JIT report to it via `setInstrumentation`
+  Instrumentation instr;
+
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  // The JITed code allocates the runtime objects from the GC heap
+  runtime::initGC();
+
+  SourceMgr smgr;
+  auto maybeJIT = jit::makeJIT(std::make_unique<Options>(opts));
+  if (!maybeJIT) {
+    llvm::errs() << llvm::toString(maybeJIT.takeError()) << "\n";
+    return 1;
+  }
+  auto engine = std::move(*maybeJIT);
+
+  if (opts.instrument) {
+    runtime::setGCInstrumentation(&instr);
+    smgr.setInstrumentation(&instr);
+    engine->setInstrumentation(&instr);
+  }
+
+  smgr.setLoadPaths(ropts.loadPaths);
+
+  auto nss =
+      smgr.readNamespaces(ropts.namespaces, LocationRange::UnknownLocation());
+  int status = 0;
+  if (!nss) {
+    llvm::errs() << llvm::toString(nss.takeError()) << "\n";
+    status = 1;
+  }
+
+  if (opts.instrument) {
+    runtime::setGCInstrumentation(nullptr);
+    runtime::reportGCStats(instr);
+    instr.print(llvm::errs(), opts.instrumentationFormat);
+  }
+  return status;
+}
 } // namespace serene::commands
@@ -19,9 +19,37 @@
 #ifndef SERENE_COMMANDS_H
 #define SERENE_COMMANDS_H
 
+#include <string>
+#include <vector>
+
+namespace serene {
+struct Options;
+} // namespace serene
+
 namespace serene::commands {
+/// The settings of `serene server` that are not part of `Options`.
+struct ServerOptions {
+  /// The path of the Unix socket to listen on
+  std::string socketPath;
+  std::vector<std::string> loadPaths;
+  /// The directory to cache the trees of the namespaces in, if any
+  std::string astCacheDir;
+};
+
+/// The settings of `serene run` that are not part of `Options`.
+struct RunOptions {
+  /// The namespaces to load
+  std::vector<std::string> namespaces;
+  std::vector<std::string> loadPaths;
+};
+
 int cc(int argc, char **argv);
-int run();
+int run(const Options &opts, RunOptions ropts);
+
+/// Keep a warm compiler running and serve the requests of the clients over
+/// the Unix socket of \p sopts until one of them asks for a shutdown (look
+/// at `commands/server.cpp` for the protocol).
+int server(const Options &opts, ServerOptions sopts);
 } // namespace serene::commands
 
 #endif
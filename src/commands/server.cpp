@@ -0,0 +1,544 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * `serene server` keeps a warm compiler around and serves requests over a
+ * Unix socket, so the build tools don't have to pay for the process startup,
+ * the setup of the JIT and a full compilation on every invocation. The JIT,
+ * the parsed namespaces, the source cache and the object cache live as long
+ * as the server does.
+ *
+ * The protocol is newline delimited JSON. Each line that a client sends is a
+ * request and gets exactly one line back as the response. A request is an
+ * object with a `command` and an optional `id` that gets copied to the
+ * response. The responses have `"ok": true` plus the result of the command,
+ * or `"ok": false` and an `error` message. The commands are:
+ *
+ * - `{"command": "read", "namespaces": ["a.b", ...]}`: Read the namespaces.
+ *   The ones that are already loaded only get updated if their source file
+ *   has changed and only the edited forms get re-read.
+ * - `{"command": "compile", "modules": [{"ns": "a.b", "file": "x.ll"}]}`:
+ *   Compile the LLVM IR files as the new generation of their namespaces, in
+ *   parallel.
+ * - `{"command": "run", "symbol": "a.b/fn"}`: Call the given function.
+ * - `{"command": "stats"}`: Return the instrumentation report.
+ * - `{"command": "profile"}`: Write the profile of the JITed code so far, in
+ *   the instrumented mode. It gets written on shutdown as well.
+ * - `{"command": "shutdown"}`: Stop the server.
+ *
+ * Every client gets its own thread. Each compile replaces the previous
+ * generation of the namespaces, so the server doesn't grow with the number
+ * of builds that it serves.
+ */
+
+#include "commands/commands.h"
+
+#include "ast/ast.h"
+#include "instrumentation.h"
+#include "jit/jit.h"
+#include "location.h"
+#include "options.h"
+#include "runtime/gc.h"
+#include "source_mgr.h"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace serene::commands {
+namespace {
+
+llvm::Error errnoError(llvm::StringRef msg) {
+  return llvm::make_error<llvm::StringError>(
+      msg, std::error_code(errno, std::generic_category()));
+};
+
+class Server {
+  const Options &opts;
+  ServerOptions sopts;
+
+  Instrumentation instr;
+  SourceMgr smgr;
+  jit::JITPtr engine;
+
+  /// Guards `namespaces`. Reading the namespaces is serialized, so two
+  /// clients can't update the same namespace at the same time.
+  std::mutex nsLock;
+  llvm::StringMap<std::unique_ptr<ast::Namespace>> namespaces;
+
+  int listenFd = -1;
+  std::atomic<bool> stopping = false;
+
+  /// The JITed code runs while holding this lock shared. Removing the old
+  /// generations of the namespaces needs it exclusively, so we never pull
+  /// the code out from under a running function.
+  std::shared_mutex codeLock;
+
+  /// Guards `clients`. The client threads are detached and `clientsDone`
+  /// gets notified whenever one of them is done.
+  std::mutex clientsLock;
+  std::condition_variable clientsDone;
+  std::vector<int> clients;
+
+  void serveClient(int fd);
+
+  /// Forget about the client on \p fd and close it.
+  void removeClient(int fd);
+
+  /// Handle the request in the given \p line and return the response. Set
+  /// \p shutdown if the client asked the server to stop.
+  llvm::json::Object handle(llvm::StringRef line, bool &shutdown);
+
+  llvm::Expected<llvm::json::Value> dispatch(llvm::StringRef command,
+                                             const llvm::json::Object &req,
+                                             bool &shutdown);
+
+  llvm::Expected<llvm::json::Value> read(const llvm::json::Object &req);
+  llvm::Expected<llvm::json::Value> compile(const llvm::json::Object &req);
+  llvm::Expected<llvm::json::Value> run(const llvm::json::Object &req);
+  llvm::Expected<llvm::json::Value> stats();
+
+  /// Stop accepting new clients and disconnect the current ones.
+  void stop();
+
+public:
+  Server(const Options &opts, ServerOptions sopts)
+      : opts(opts), sopts(std::move(sopts)){};
+
+  llvm::Error start();
+  void serve();
+  ~Server();
+};
+
+llvm::Error Server::start() {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  runtime::initGC();
+  runtime::setGCInstrumentation(&instr);
+
+  smgr.setInstrumentation(&instr);
+  smgr.setLoadPaths(sopts.loadPaths);
+  // The source files get edited while we are running. If they were mapped
+  // into memory, the old buffers would change under our feet (or even go
+  // away on a truncate) and we couldn't tell what has changed.
+  smgr.getSourceCache().setVolatile(true);
+  if (!sopts.astCacheDir.empty()) {
+    smgr.setASTCacheDir(sopts.astCacheDir);
+  }
+
+  auto maybeJIT = jit::makeJIT(std::make_unique<Options>(opts));
+  if (!maybeJIT) {
+    return maybeJIT.takeError();
+  }
+  engine = std::move(*maybeJIT);
+  engine->setInstrumentation(&instr);
+
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+
+  if (sopts.socketPath.size() >= sizeof(addr.sun_path)) {
+    return llvm::make_error<llvm::StringError>(
+        llvm::formatv("The socket path '{0}' is too long", sopts.socketPath),
+        llvm::inconvertibleErrorCode());
+  }
+  std::strncpy(addr.sun_path, sopts.socketPath.c_str(),
+               sizeof(addr.sun_path) - 1);
+
+  listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listenFd < 0) {
+    return errnoError("Can't create the socket");
+  }
+
+  // A left over from a previous server that didn't exit cleanly
+  ::unlink(sopts.socketPath.c_str());
+
+  if (::bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) <
+      0) {
+    return errnoError(
+        llvm::formatv("Can't bind to '{0}'", sopts.socketPath).str());
+  }
+
+  if (::listen(listenFd, SOMAXCONN) < 0) {
+    return errnoError("Can't listen on the socket");
+  }
+
+  return llvm::Error::success();
+};
+
+void Server::serve() {
+  while (!stopping) {
+    int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // `stop` shuts the socket down to wake us up
+      break;
+    }
+
+    std::lock_guard<std::mutex> guard(clientsLock);
+    if (stopping) {
+      ::close(fd);
+      break;
+    }
+
+    clients.push_back(fd);
+    std::thread([this, fd]() {
+      serveClient(fd);
+      removeClient(fd);
+    }).detach();
+  }
+
+  stop();
+
+  {
+    std::unique_lock<std::mutex> guard(clientsLock);
+    clientsDone.wait(guard, [this]() { return clients.empty(); });
+  }
+
+  if (auto err = engine->writeProfile()) {
+    llvm::errs() << llvm::toString(std::move(err)) << "\n";
+  }
+};
+
+void Server::stop() {
+  if (stopping.exchange(true)) {
+    return;
+  }
+
+  ::shutdown(listenFd, SHUT_RDWR);
+
+  std::lock_guard<std::mutex> guard(clientsLock);
+  for (auto fd : clients) {
+    ::shutdown(fd, SHUT_RDWR);
+  }
+};
+
+void Server::serveClient(int fd) {
+  // The JITed code that we run on behalf of the client allocates from the
+  // GC heap
+  runtime::GCThread gcThread;
+
+  std::string pending;
+  char buf[4096];
+
+  while (true) {
+    auto n = ::read(fd, buf, sizeof(buf));
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n <= 0) {
+      break;
+    }
+
+    pending.append(buf, n);
+
+    size_t start = 0;
+    size_t end   = 0;
+    while ((end = pending.find('\n', start)) != std::string::npos) {
+      llvm::StringRef line(pending.data() + start, end - start);
+      start = end + 1;
+
+      if (line.trim().empty()) {
+        continue;
+      }
+
+      bool shutdown = false;
+      auto response = llvm::formatv("{0}\n", llvm::json::Value(handle(
+                                                  line.trim(), shutdown)))
+                          .str();
+
+      for (size_t sent = 0; sent < response.size();) {
+        auto w = ::send(fd, response.data() + sent, response.size() - sent,
+                        MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) {
+          continue;
+        }
+        if (w <= 0) {
+          break;
+        }
+        sent += w;
+      }
+
+      // Only after the client got the response
+      if (shutdown) {
+        stop();
+      }
+    }
+
+    pending.erase(0, start);
+  }
+};
+
+void Server::removeClient(int fd) {
+  std::lock_guard<std::mutex> guard(clientsLock);
+  clients.erase(std::remove(clients.begin(), clients.end(), fd), clients.end());
+  ::close(fd);
+  clientsDone.notify_all();
+};
+
+llvm::json::Object Server::handle(llvm::StringRef line, bool &shutdown) {
+  llvm::json::Object response;
+
+  auto fail = [&](llvm::Error err) {
+    response["ok"]    = false;
+    response["error"] = llvm::toString(std::move(err));
+    return std::move(response);
+  };
+
+  auto maybeReq = llvm::json::parse(line);
+  if (!maybeReq) {
+    return fail(maybeReq.takeError());
+  }
+
+  const auto *req = maybeReq->getAsObject();
+  if (req == nullptr) {
+    return fail(llvm::make_error<llvm::StringError>(
+        "A request has to be an object", llvm::inconvertibleErrorCode()));
+  }
+
+  if (const auto *id = req->get("id")) {
+    response["id"] = *id;
+  }
+
+  auto command = req->getString("command").value_or("");
+  auto result  = dispatch(command, *req, shutdown);
+
+  if (!result) {
+    return fail(result.takeError());
+  }
+
+  response["ok"]     = true;
+  response["result"] = std::move(*result);
+  return response;
+};
+
+llvm::Expected<llvm::json::Value>
+Server::dispatch(llvm::StringRef command, const llvm::json::Object &req,
+                 bool &shutdown) {
+  if (command == "read") {
+    return read(req);
+  }
+
+  if (command == "compile") {
+    return compile(req);
+  }
+
+  if (command == "run") {
+    return run(req);
+  }
+
+  if (command == "stats") {
+    return stats();
+  }
+
+  if (command == "profile") {
+    if (auto err = engine->writeProfile()) {
+      return std::move(err);
+    }
+    return llvm::json::Value(nullptr);
+  }
+
+  if (command == "shutdown") {
+    shutdown = true;
+    return llvm::json::Value(nullptr);
+  }
+
+  return llvm::make_error<llvm::StringError>(
+      llvm::formatv("Unknown command '{0}'", command),
+      llvm::inconvertibleErrorCode());
+};
+
+llvm::Expected<llvm::json::Value>
+Server::read(const llvm::json::Object &req) {
+  const auto *names = req.getArray("namespaces");
+  if (names == nullptr) {
+    return llvm::make_error<llvm::StringError>(
+        "'namespaces' has to be a list of namespace names",
+        llvm::inconvertibleErrorCode());
+  }
+
+  llvm::json::Array result;
+  std::lock_guard<std::mutex> guard(nsLock);
+
+  for (const auto &v : *names) {
+    auto name = v.getAsString();
+    if (!name) {
+      return llvm::make_error<llvm::StringError>(
+          "A namespace name has to be a string",
+          llvm::inconvertibleErrorCode());
+    }
+
+    bool changed = true;
+    auto &ns     = namespaces[*name];
+
+    if (!ns) {
+      auto maybeNS =
+          smgr.readNamespace(name->str(), LocationRange::UnknownLocation());
+      if (!maybeNS) {
+        namespaces.erase(*name);
+        return maybeNS.takeError();
+      }
+      ns = std::move(*maybeNS);
+    } else {
+      // The source cache hands out the same buffer as long as the file
+      // doesn't change on the disk. The buffers are copies, so the old one
+      // still has the content that the namespace was read from
+      auto buf = smgr.getSourceCache().getFile(*ns->filename);
+      if (!buf) {
+        return llvm::make_error<llvm::StringError>(
+            llvm::formatv("Can't read '{0}'", *ns->filename),
+            llvm::inconvertibleErrorCode());
+      }
+
+      const auto &old = smgr.getBufferInfo(ns->name).buffer;
+      changed         = buf->getBuffer() != old->getBuffer();
+
+      if (changed) {
+        if (auto err = smgr.updateNamespace(*ns, std::move(buf))) {
+          return err;
+        }
+      }
+    }
+
+    result.push_back(llvm::json::Object{
+        {"name", ns->name},
+        {"forms", static_cast<int64_t>(ns->tree.size())},
+        {"changed", changed},
+    });
+  }
+
+  return llvm::json::Value(std::move(result));
+};
+
+llvm::Expected<llvm::json::Value>
+Server::compile(const llvm::json::Object &req) {
+  const auto *modules = req.getArray("modules");
+  if (modules == nullptr) {
+    return llvm::make_error<llvm::StringError>(
+        "'modules' has to be a list of objects with 'ns' and 'file'",
+        llvm::inconvertibleErrorCode());
+  }
+
+  std::vector<jit::NamespaceModule> nss;
+  for (const auto &v : *modules) {
+    const auto *m = v.getAsObject();
+    auto ns       = m == nullptr ? std::nullopt : m->getString("ns");
+    auto file     = m == nullptr ? std::nullopt : m->getString("file");
+
+    if (!ns || !file) {
+      return llvm::make_error<llvm::StringError>(
+          "Each module needs an 'ns' and a 'file'",
+          llvm::inconvertibleErrorCode());
+    }
+
+    nss.push_back({ns->str(), jit::irFileGenerator(*file)});
+  }
+
+  if (auto err = engine->addModules(nss)) {
+    return err;
+  }
+
+  // The new generations replace the old ones
+  std::unique_lock<std::shared_mutex> guard(codeLock);
+  llvm::Error err = llvm::Error::success();
+
+  for (const auto &ns : nss) {
+    err = llvm::joinErrors(std::move(err),
+                           engine->removeOldJITDylibs(ns.nsName, 1));
+  }
+
+  if (err) {
+    return std::move(err);
+  }
+
+  return llvm::json::Value(static_cast<int64_t>(nss.size()));
+};
+
+llvm::Expected<llvm::json::Value> Server::run(const llvm::json::Object &req) {
+  auto symbol = req.getString("symbol");
+  if (!symbol) {
+    return llvm::make_error<llvm::StringError>(
+        "'symbol' has to be a fully qualified symbol name",
+        llvm::inconvertibleErrorCode());
+  }
+
+  std::shared_lock<std::shared_mutex> guard(codeLock);
+  if (auto err = engine->invokePacked(*symbol)) {
+    return err;
+  }
+
+  return llvm::json::Value(nullptr);
+};
+
+llvm::Expected<llvm::json::Value> Server::stats() {
+  std::string report;
+  llvm::raw_string_ostream os(report);
+  instr.print(os, InstrumentationFormat::JSON);
+
+  return llvm::json::parse(os.str());
+};
+
+Server::~Server() {
+  runtime::setGCInstrumentation(nullptr);
+
+  if (listenFd >= 0) {
+    ::close(listenFd);
+    ::unlink(sopts.socketPath.c_str());
+  }
+};
+} // namespace
+
+int server(const Options &opts, ServerOptions sopts) {
+  Server s(opts, std::move(sopts));
+
+  if (auto err = s.start()) {
+    llvm::errs() << llvm::toString(std::move(err)) << "\n";
+    return 1;
+  }
+
+  s.serve();
+  return 0;
+}
+} // namespace serene::commands
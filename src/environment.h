@@ -19,59 +19,199 @@
 #ifndef ENVIRONMENT_H
 #define ENVIRONMENT_H
 
+#include "symbol_table.h"
 #include "utils.h"
 
-#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
 #include <mlir/Support/LogicalResult.h>
 
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
 namespace serene {
 
 /// This class represents a classic lisp environment (or scope) that holds the
 /// bindings from type `K` to type `V`. For example an environment of symbols
 /// to expressions would be `Environment<Symbol, Node>`
+///
+/// Bindings are keyed by the interned `SymbolID` of the name, so lookups
+/// are integer compares rather than string hashing.
+///
+/// The values of each environment live in a contiguous array in the order
+/// of definition. A name can be resolved once to a `Binding` (the depth of
+/// the environment that defines it and its slot in there) via `resolve`,
+/// and from then on `get` accesses the value without any hashing, by
+/// indexing the chain of the ancestors of the current environment.
+///
+/// The environments of a lexical nesting share the same chain. A child
+/// appends itself to the chain of its parent if the parent is the last
+/// environment in there, and pops itself when it goes away. Only a child
+/// whose sibling is still alive has to copy the chain up to its parent.
+/// Since the chains point to the environments, they can't be copied or
+/// moved.
 template <typename V>
 class Environment {
+public:
+  /// The resolved address of a binding. `depth` is the depth of the
+  /// environment that owns the binding (`0` is the root environment) and
+  /// `slot` is the index of the binding in there. A binding remains valid as
+  /// long as the environment that owns it is alive, even if the name gets
+  /// redefined.
+  struct Binding {
+    uint32_t depth;
+    uint32_t slot;
+  };
 
+private:
   Environment<V> *parent;
 
-  using StorageType = llvm::StringMap<V>;
-  // The actual bindings storage
-  StorageType pairs;
+  /// The number of the ancestors of this environment
+  uint32_t depth;
+
+  /// The ancestors of this environment by their depth followed by this
+  /// environment itself. Entries after `depth` belong to the descendants.
+  std::shared_ptr<std::vector<Environment<V> *>> chain;
+
+  /// The slot of each name defined in this environment
+  llvm::DenseMap<SymbolID, uint32_t> slots;
+
+  // The actual bindings storage, `names[i]` is bound to `values[i]`
+  std::vector<SymbolID> names;
+  std::vector<V> values;
+
+  /// Return the ancestor of this environment (or itself) that owns the given
+  /// binding \p b.
+  Environment<V> *getOwner(Binding b) const {
+    assert(b.depth <= depth && "The binding is out of scope");
+    return (*chain)[b.depth];
+  };
 
 public:
-  Environment() : parent(nullptr) {}
-  explicit Environment(Environment *parent) : parent(parent){};
+  Environment() : Environment(nullptr){};
+  explicit Environment(Environment *parent)
+      : parent(parent), depth(parent == nullptr ? 0 : parent->depth + 1) {
+    if (parent == nullptr) {
+      chain = std::make_shared<std::vector<Environment<V> *>>();
+    } else if (parent->chain->size() == depth) {
+      chain = parent->chain;
+    } else {
+      // A sibling of ours is still using the rest of the parent's chain
+      chain = std::make_shared<std::vector<Environment<V> *>>(
+          parent->chain->begin(), parent->chain->begin() + depth);
+    }
+
+    chain->push_back(this);
+  };
 
-  /// Look up the given `key` in the environment and return it.
-  std::optional<V> lookup(llvm::StringRef key) {
-    if (auto value = pairs.lookup(key)) {
-      return value;
+  ~Environment() {
+    if (chain->size() == depth + 1 && chain->back() == this) {
+      chain->pop_back();
     }
+  };
 
-    if (parent) {
-      return parent->lookup(key);
+  Environment(const Environment &)            = delete;
+  Environment &operator=(const Environment &) = delete;
+  Environment(Environment &&)                 = delete;
+  Environment &operator=(Environment &&)      = delete;
+
+  /// Return the depth of this environment, the root environment is at `0`.
+  uint32_t getDepth() const { return depth; };
+
+  Environment<V> *getParent() const { return parent; };
+
+  /// Find the closest environment to this one that defines the given `key`
+  /// and return the address of its binding.
+  std::optional<Binding> resolve(SymbolID key) const {
+    for (const auto *env = this; env != nullptr; env = env->parent) {
+      auto i = env->slots.find(key);
+      if (i != env->slots.end()) {
+        return Binding{env->getDepth(), i->second};
+      }
     }
 
     return std::nullopt;
   };
 
+  /// Return the value of the given binding \p b that is resolved in this
+  /// environment or any of its children.
+  V &get(Binding b) { return getOwner(b)->values[b.slot]; };
+
+  const V &get(Binding b) const { return getOwner(b)->values[b.slot]; };
+
+  /// Look up the given `key` in the environment and return a pointer to its
+  /// value or `nullptr` if it isn't bound. The pointer gets invalidated as
+  /// soon as a new name is defined in the environment that owns the value,
+  /// use `resolve` to get a stable handle.
+  V *lookup(SymbolID key) {
+    auto b = resolve(key);
+    return b ? &get(*b) : nullptr;
+  };
+
+  /// Look up the symbol \p sym of the namespace \p ns in the environment
+  /// and return it. The bindings are keyed by the fully qualified names.
+  V *lookup(llvm::StringRef ns, llvm::StringRef sym) {
+    // A name that has never been interned can't be bound anywhere
+    auto id = SymbolTable::global().lookup(ns, sym);
+    if (!id) {
+      return nullptr;
+    }
+
+    return lookup(*id);
+  };
+
+  /// Bind the given `key` to the given `value` in this environment and return
+  /// the address of the binding. This operation will shadow an aleady exist
+  /// `key` in the parent environment. Redefining a `key` in the same
+  /// environment reuses its slot.
+  Binding define(SymbolID key, V value) {
+    auto [i, inserted] =
+        slots.try_emplace(key, static_cast<uint32_t>(values.size()));
+
+    if (inserted) {
+      names.push_back(key);
+      values.push_back(std::move(value));
+    } else {
+      values[i->second] = std::move(value);
+    }
+
+    return Binding{getDepth(), i->second};
+  };
+
   /// Insert the given `key` with the given `value` into the storage. This
   /// operation will shadow an aleady exist `key` in the parent environment
-  mlir::LogicalResult insert_symbol(llvm::StringRef key, V value) {
-    auto result = pairs.insert_or_assign(key, value);
-    UNUSED(result);
+  mlir::LogicalResult insert_symbol(SymbolID key, V value) {
+    UNUSED(define(key, std::move(value)));
     return mlir::success();
   };
 
-  inline typename StorageType::iterator begin() { return pairs.begin(); }
+  /// Insert the symbol \p sym of the namespace \p ns with the given `value`
+  /// into the storage. This operation will shadow an aleady exist binding of
+  /// the same symbol in the parent environment
+  mlir::LogicalResult insert_symbol(llvm::StringRef ns, llvm::StringRef sym,
+                                    V value) {
+    return insert_symbol(internSymbol(ns, sym), std::move(value));
+  };
+
+  /// Return the number of bindings defined in this environment.
+  size_t size() const { return values.size(); };
+
+  /// Return the names defined in this environment in the order of their
+  /// slots.
+  llvm::ArrayRef<SymbolID> getNames() const { return names; };
+
+  inline typename std::vector<V>::iterator begin() { return values.begin(); }
 
-  inline typename StorageType::iterator end() { return pairs.end(); }
+  inline typename std::vector<V>::iterator end() { return values.end(); }
 
-  inline typename StorageType::const_iterator begin() const {
-    return pairs.begin();
+  inline typename std::vector<V>::const_iterator begin() const {
+    return values.begin();
   }
-  inline typename StorageType::const_iterator end() const {
-    return pairs.end();
+  inline typename std::vector<V>::const_iterator end() const {
+    return values.end();
   }
 };
 
@@ -22,10 +22,16 @@
 #include "_errors.h"
 #include "location.h"
 
-#include <system_error>
-
 #include <llvm/Support/Error.h>
 #include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <functional>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 namespace serene::errors {
 
@@ -38,7 +44,18 @@ public:
   const LocationRange location;
   std::string msg;
 
-  void log(llvm::raw_ostream &os) const override { os << msg; }
+  /// When set, it writes the message of the error into the given stream
+  /// instead of `msg`. It lets us to postpone formatting the message until
+  /// someone actually asks for it.
+  std::function<void(llvm::raw_ostream &)> render;
+
+  void log(llvm::raw_ostream &os) const override {
+    if (render) {
+      render(os);
+      return;
+    }
+    os << msg;
+  }
 
   std::error_code convertToErrorCode() const override {
     // TODO: Fix this by creating a mapping from ErrorType to standard
@@ -52,6 +69,10 @@ public:
   Error(Type errtype, const LocationRange &loc, llvm::StringRef msg)
       : type(errtype), location(loc), msg(msg.str()){};
 
+  Error(Type errtype, const LocationRange &loc,
+        std::function<void(llvm::raw_ostream &)> render)
+      : type(errtype), location(loc), render(std::move(render)){};
+
   const LocationRange &where() { return location; };
 };
 
@@ -59,5 +80,33 @@ llvm::Error make(Type t, const LocationRange &loc, llvm::StringRef msg);
 
 llvm::Error make(Type t, const LocationRange &loc);
 
+namespace detail {
+/// Anything that looks like a string gets copied into an owning string, so
+/// the error does not depend on the lifetime of the caller's data. The rest
+/// of the arguments are copied as they are.
+template <typename T>
+using Captured =
+    std::conditional_t<std::is_convertible_v<T, llvm::StringRef>, std::string,
+                       std::decay_t<T>>;
+} // namespace detail
+
+/// Create an error with a message that is formatted by `llvm::formatv`
+/// using \p fmt and the given arguments. The formatting happens only when
+/// the message is rendered, so errors that get consumed without being
+/// printed don't pay for it. \p fmt has to be a string literal.
+template <typename T, typename... Ts>
+llvm::Error make(Type t, const LocationRange &loc, const char *fmt, T &&arg,
+                 Ts &&...args) {
+  std::tuple<detail::Captured<T>, detail::Captured<Ts>...> captured(
+      detail::Captured<T>(std::forward<T>(arg)),
+      detail::Captured<Ts>(std::forward<Ts>(args))...);
+
+  return llvm::make_error<Error>(
+      t, loc, [fmt, captured = std::move(captured)](llvm::raw_ostream &os) {
+        std::apply([&](const auto &...xs) { os << llvm::formatv(fmt, xs...); },
+                   captured);
+      });
+};
+
 }; // namespace serene::errors
 #endif
@@ -0,0 +1,196 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "instrumentation.h"
+
+#include <llvm/Support/Format.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+namespace serene {
+
+/// The names of the counters in the reports, in the order of `Counter`
+static const char *const counterNames[] = {
+    "bytes_read",          // BytesRead
+    "nodes_allocated",     // NodesAllocated
+    "namespaces_read",     // NamespacesRead
+    "modules_jited",       // ModulesJITed
+    "object_cache_hits",   // ObjectCacheHits
+    "object_cache_misses", // ObjectCacheMisses
+    "ast_cache_hits",      // ASTCacheHits
+    "ast_cache_misses",    // ASTCacheMisses
+    "gc_collections",      // GCCollections
+    "gc_pause_ns",         // GCPauseNanos
+    "gc_heap_bytes",       // GCHeapBytes
+    "gc_bytes_allocated",  // GCBytesAllocated
+};
+
+static_assert(std::size(counterNames) ==
+                  static_cast<size_t>(Counter::FINALCOUNTER),
+              "Every counter needs a name");
+
+Instrumentation::Scope &
+Instrumentation::Scope::operator=(Scope &&other) noexcept {
+  stop();
+  owner       = other.owner;
+  timer       = other.timer;
+  start       = other.start;
+  other.timer = nullptr;
+  return *this;
+};
+
+Instrumentation::Scope Instrumentation::Scope::nest(llvm::StringRef name) {
+  if (timer == nullptr) {
+    return Scope();
+  }
+  return Scope(*owner, owner->getOrCreateTimer(*timer, name));
+};
+
+void Instrumentation::Scope::stop() {
+  if (timer == nullptr) {
+    return;
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now() - start);
+
+  timer->nanos.fetch_add(elapsed.count(), std::memory_order_relaxed);
+  timer->count.fetch_add(1, std::memory_order_relaxed);
+  timer = nullptr;
+};
+
+Instrumentation::Timer &
+Instrumentation::getOrCreateTimer(Timer &parent, llvm::StringRef name) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  for (auto &child : parent.children) {
+    if (child->name == name) {
+      return *child;
+    }
+  }
+
+  parent.children.push_back(std::make_unique<Timer>(name));
+  return *parent.children.back();
+};
+
+static double toSeconds(uint64_t nanos) {
+  return static_cast<double>(nanos) / 1e9;
+};
+
+/// Return the ratio of the object cache hits to all the lookups
+static double getHitRate(uint64_t hits, uint64_t misses) {
+  return hits + misses == 0 ? 0.0
+                            : static_cast<double>(hits) /
+                                  static_cast<double>(hits + misses);
+};
+
+void Instrumentation::printTree(llvm::raw_ostream &os) const {
+  os << "===" << std::string(70, '-') << "===\n"
+     << "                       Serene Instrumentation Report\n"
+     << "===" << std::string(70, '-') << "===\n\n"
+     << "   Wall Time       Count  Name\n";
+
+  // We walk through the tree with an explicit stack of (timer, depth)
+  std::vector<std::pair<const Timer *, unsigned>> stack;
+  for (auto i = root.children.rbegin(); i != root.children.rend(); i++) {
+    stack.emplace_back(i->get(), 0);
+  }
+
+  while (!stack.empty()) {
+    auto [timer, depth] = stack.back();
+    stack.pop_back();
+
+    os << llvm::format("  %9.4fs  %10llu  ", toSeconds(timer->nanos.load()),
+                       static_cast<unsigned long long>(timer->count.load()))
+       << std::string(2 * depth, ' ') << timer->name << "\n";
+
+    for (auto i = timer->children.rbegin(); i != timer->children.rend(); i++) {
+      stack.emplace_back(i->get(), depth + 1);
+    }
+  }
+
+  os << "\n   Counters\n";
+  for (size_t i = 0; i < counters.size(); i++) {
+    os << llvm::formatv("  {0,-24} {1}\n", counterNames[i], counters[i].load());
+  }
+
+  os << llvm::formatv("  {0,-24} {1:P}\n", "object_cache_hit_rate",
+                      getHitRate(get(Counter::ObjectCacheHits),
+                                 get(Counter::ObjectCacheMisses)));
+};
+
+void Instrumentation::printJSON(llvm::raw_ostream &os) const {
+  llvm::json::OStream j(os, 2);
+
+  std::function<void(const Timer &)> printTimer = [&](const Timer &timer) {
+    j.object([&] {
+      j.attribute("name", timer.name);
+      j.attribute("seconds", toSeconds(timer.nanos.load()));
+      j.attribute("count", static_cast<int64_t>(timer.count.load()));
+
+      if (!timer.children.empty()) {
+        j.attributeArray("children", [&] {
+          for (const auto &child : timer.children) {
+            printTimer(*child);
+          }
+        });
+      }
+    });
+  };
+
+  j.object([&] {
+    j.attributeArray("timers", [&] {
+      for (const auto &child : root.children) {
+        printTimer(*child);
+      }
+    });
+
+    j.attributeObject("counters", [&] {
+      for (size_t i = 0; i < counters.size(); i++) {
+        j.attribute(counterNames[i],
+                    static_cast<int64_t>(counters[i].load()));
+      }
+    });
+
+    j.attribute("object_cache_hit_rate",
+                getHitRate(get(Counter::ObjectCacheHits),
+                           get(Counter::ObjectCacheMisses)));
+  });
+
+  os << "\n";
+};
+
+void Instrumentation::print(llvm::raw_ostream &os,
+                            InstrumentationFormat format) const {
+  std::lock_guard<std::mutex> guard(lock);
+
+  switch (format) {
+  case InstrumentationFormat::Tree:
+    printTree(os);
+    break;
+  case InstrumentationFormat::JSON:
+    printJSON(os);
+    break;
+  }
+};
+
+} // namespace serene
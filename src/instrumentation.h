@@ -0,0 +1,150 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * `Instrumentation` collects the wall time of the different phases of the
+ * compiler (e.g. parsing, code generation) as a tree of timers plus a fixed
+ * set of counters (e.g. bytes read, nodes allocated, the object cache hits
+ * and misses and the GC statistics), and prints them as a tree report or
+ * JSON.
+ *
+ * Timers get started via `time` and stop when the returned `Scope` goes out
+ * of scope. A scope can be nested via `nest` to break the time of a phase
+ * down to smaller units, e.g. the time of parsing each namespace. Timers with
+ * the same name under the same parent get merged.
+ *
+ * The subsystems like `SourceMgr` and `JIT` take a pointer to an
+ * `Instrumentation` object and don't collect anything without one. It is
+ * safe to use the same object from different threads.
+ */
+
+#ifndef SERENE_INSTRUMENTATION_H
+#define SERENE_INSTRUMENTATION_H
+
+#include "options.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace serene {
+
+enum class Counter {
+  BytesRead = 0,
+  NodesAllocated,
+  NamespacesRead,
+  ModulesJITed,
+  ObjectCacheHits,
+  ObjectCacheMisses,
+  ASTCacheHits,
+  ASTCacheMisses,
+  GCCollections,
+  GCPauseNanos,
+  GCHeapBytes,
+  GCBytesAllocated,
+  // This counter has to be the final counter at all time. DO NOT CHANGE IT!
+  FINALCOUNTER,
+};
+
+class Instrumentation {
+  using Clock = std::chrono::steady_clock;
+
+  struct Timer {
+    std::string name;
+    std::atomic<uint64_t> nanos = 0;
+    std::atomic<uint64_t> count = 0;
+    std::vector<std::unique_ptr<Timer>> children;
+
+    explicit Timer(llvm::StringRef name) : name(name.str()){};
+  };
+
+  /// Guards the structure of the timer tree. The timers themselves are
+  /// updated atomically.
+  mutable std::mutex lock;
+  Timer root{"root"};
+
+  std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::FINALCOUNTER)>
+      counters{};
+
+  /// Return the child of \p parent with the given \p name and create it if
+  /// it doesn't exist.
+  Timer &getOrCreateTimer(Timer &parent, llvm::StringRef name);
+
+  void printTree(llvm::raw_ostream &os) const;
+  void printJSON(llvm::raw_ostream &os) const;
+
+public:
+  /// A running timer that stops when it goes out of scope. A default
+  /// constructed scope doesn't measure anything.
+  class Scope {
+    Instrumentation *owner = nullptr;
+    Timer *timer           = nullptr;
+    Clock::time_point start;
+
+  public:
+    Scope() = default;
+    Scope(Instrumentation &owner, Timer &timer)
+        : owner(&owner), timer(&timer), start(Clock::now()){};
+
+    Scope(const Scope &)            = delete;
+    Scope &operator=(const Scope &) = delete;
+    Scope(Scope &&other) noexcept { *this = std::move(other); };
+    Scope &operator=(Scope &&other) noexcept;
+
+    /// Start a new timer with the given \p name under this one.
+    Scope nest(llvm::StringRef name);
+
+    /// Stop the timer and add the elapsed time to it.
+    void stop();
+
+    ~Scope() { stop(); };
+  };
+
+  Instrumentation()                                   = default;
+  Instrumentation(const Instrumentation &)            = delete;
+  Instrumentation &operator=(const Instrumentation &) = delete;
+
+  /// Start a timer for the phase with given \p name.
+  Scope time(llvm::StringRef name) {
+    return Scope(*this, getOrCreateTimer(root, name));
+  };
+
+  /// Add \p n to the counter \p c.
+  void add(Counter c, uint64_t n = 1) {
+    counters[static_cast<size_t>(c)].fetch_add(n, std::memory_order_relaxed);
+  };
+
+  uint64_t get(Counter c) const {
+    return counters[static_cast<size_t>(c)].load(std::memory_order_relaxed);
+  };
+
+  /// Print the timers and the counters to \p os in the given \p format.
+  void print(llvm::raw_ostream &os, InstrumentationFormat format) const;
+};
+
+} // namespace serene
+#endif
@@ -0,0 +1,233 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jit/aot.h"
+
+#include "jit/profile.h"
+#include "options.h"
+#include "utils.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Object/Archive.h>
+#include <llvm/Object/ArchiveWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace serene::jit {
+
+/// Lower the given namespace \p ns in a new context and compile it with a
+/// fresh target machine from \p jtmb, since target machines can't be shared
+/// between threads.
+static llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+compileNamespace(const NamespaceModule &ns,
+                 llvm::orc::JITTargetMachineBuilder jtmb, int level,
+                 ObjectCache *cache, const Profile *profile) {
+  auto tm = jtmb.createTargetMachine();
+  if (!tm) {
+    return tm.takeError();
+  }
+
+  llvm::LLVMContext ctx;
+  auto m = ns.generate(ctx);
+  if (!m) {
+    return m.takeError();
+  }
+
+  // The object cache keeps the objects in memory by the module identifier
+  (*m)->setModuleIdentifier(ns.nsName);
+  (*m)->setTargetTriple((*tm)->getTargetTriple().str());
+  (*m)->setDataLayout((*tm)->createDataLayout());
+
+  if (profile != nullptr) {
+    profile->apply(**m);
+  }
+
+  // Look up the cache before optimizing, so an unchanged namespace skips
+  // the pipeline altogether. The cache keys the object by the module as it
+  // is now and reuses that key when we hand it the optimized object.
+  if (cache != nullptr) {
+    if (auto cached = cache->getObject(m->get())) {
+      return cached;
+    }
+  }
+
+  // Unlike the JIT, there is no tier up later on. So this is our only
+  // chance to optimize the code.
+  optimizeModule(**m, level, tm->get());
+
+  llvm::orc::SimpleCompiler compiler(**tm);
+  auto obj = compiler(**m);
+
+  if (cache != nullptr) {
+    if (obj) {
+      cache->notifyObjectCompiled(m->get(), (*obj)->getMemBufferRef());
+    } else {
+      cache->forget(m->get());
+    }
+  }
+
+  return obj;
+};
+
+static llvm::Error writeObjects(llvm::ArrayRef<NamespaceModule> modules,
+                                llvm::ArrayRef<llvm::MemoryBuffer *> objects,
+                                llvm::StringRef dir) {
+  if (auto ec = llvm::sys::fs::create_directories(dir)) {
+    return llvm::make_error<llvm::StringError>(
+        llvm::formatv("Can't create the directory '{0}'", dir), ec);
+  }
+
+  for (size_t i = 0; i < modules.size(); i++) {
+    llvm::SmallString<MAX_PATH_SLOTS> path(dir);
+    llvm::sys::path::append(path, modules[i].nsName + ".o");
+
+    std::error_code ec;
+    llvm::ToolOutputFile out(path, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+      return llvm::make_error<llvm::StringError>(
+          llvm::formatv("Can't open '{0}'", path), ec);
+    }
+
+    out.os() << objects[i]->getBuffer();
+    out.keep();
+  }
+
+  return llvm::Error::success();
+};
+
+static llvm::Error writeArchive(const Options &opts,
+                                llvm::ArrayRef<NamespaceModule> modules,
+                                llvm::ArrayRef<llvm::MemoryBuffer *> objects,
+                                llvm::StringRef path) {
+  // The members refer to these names, so they have to outlive the members
+  std::vector<std::string> names;
+  std::vector<llvm::NewArchiveMember> members;
+  names.reserve(modules.size());
+  members.reserve(modules.size());
+
+  for (size_t i = 0; i < modules.size(); i++) {
+    names.push_back(modules[i].nsName + ".o");
+    members.emplace_back(
+        llvm::MemoryBufferRef(objects[i]->getBuffer(), names.back()));
+  }
+
+  auto kind = opts.targetTriple.isOSDarwin() ? llvm::object::Archive::K_DARWIN
+                                             : llvm::object::Archive::K_GNU;
+
+  return llvm::writeArchive(path, members,
+                            llvm::SymtabWritingMode::NormalSymtab, kind,
+                            /*Deterministic=*/true, /*Thin=*/false);
+};
+
+llvm::Error compileAOT(const Options &opts,
+                       llvm::ArrayRef<NamespaceModule> modules, AOTOutput kind,
+                       llvm::StringRef output) {
+  // Members of the archive and the object files are named after the
+  // namespaces
+  llvm::StringSet<> names;
+  for (const auto &ns : modules) {
+    if (!names.insert(ns.nsName).second) {
+      return llvm::make_error<llvm::StringError>(
+          llvm::formatv("Namespace '{0}' is added more than once", ns.nsName),
+          llvm::inconvertibleErrorCode());
+    }
+  }
+
+  auto level = getOptimizationLevel(opts);
+
+  llvm::orc::JITTargetMachineBuilder jtmb(opts.targetTriple);
+  configureTargetMachine(jtmb, level, /*aot=*/true);
+
+  std::unique_ptr<ObjectCache> cache;
+  if (opts.JITenableObjectCache) {
+    // The AOT objects are not interchangeable with the JIT ones, so they
+    // need different keys
+    cache = std::make_unique<ObjectCache>(
+        opts.JITObjectCacheDir, opts.targetTriple.str() + "-aot", level,
+        opts.JITObjectCacheMaxSize);
+  }
+
+  std::unique_ptr<Profile> profile;
+  if (!opts.profileUse.empty()) {
+    auto maybeProfile = Profile::read(opts.profileUse);
+    if (!maybeProfile) {
+      return maybeProfile.takeError();
+    }
+    profile = std::make_unique<Profile>(std::move(*maybeProfile));
+  }
+
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects(modules.size());
+
+  std::mutex errLock;
+  llvm::Error errors = llvm::Error::success();
+
+  {
+    llvm::ThreadPool pool(llvm::hardware_concurrency(opts.JITLoweringThreads));
+
+    for (size_t i = 0; i < modules.size(); i++) {
+      pool.async([&, i]() {
+        auto obj = compileNamespace(modules[i], jtmb, level, cache.get(),
+                                    profile.get());
+
+        if (obj) {
+          objects[i] = std::move(*obj);
+          return;
+        }
+
+        std::lock_guard<std::mutex> guard(errLock);
+        errors = llvm::joinErrors(std::move(errors), obj.takeError());
+      });
+    }
+
+    pool.wait();
+  }
+
+  if (errors) {
+    return errors;
+  }
+
+  std::vector<llvm::MemoryBuffer *> buffers;
+  buffers.reserve(objects.size());
+  for (auto &obj : objects) {
+    buffers.push_back(obj.get());
+  }
+
+  if (kind == AOTOutput::Archive) {
+    return writeArchive(opts, modules, buffers, output);
+  }
+
+  return writeObjects(modules, buffers, output);
+};
+
+} // namespace serene::jit
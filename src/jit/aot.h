@@ -0,0 +1,65 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * The ahead of time compiler behind `serene cc`. It compiles the modules of
+ * a set of namespaces into relocatable objects, one per namespace, or a
+ * single static archive that can be linked against `serene-runtime`.
+ *
+ * It uses the same target machine setup as the JIT (look at
+ * `configureTargetMachine`) and the same object cache, so a namespace that
+ * has not changed since the last build doesn't go through the codegen
+ * again. Since the AOT objects get a section per function and global, they
+ * have their own entries in the cache.
+ */
+
+#ifndef JIT_AOT_H
+#define JIT_AOT_H
+
+#include "jit/jit.h"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+
+namespace serene {
+struct Options;
+} // namespace serene
+
+namespace serene::jit {
+
+/// The kinds of output that the AOT compiler can produce.
+enum class AOTOutput {
+  /// A relocatable object per namespace in the output directory
+  Objects,
+  /// A single static archive containing the objects of all the namespaces
+  Archive,
+};
+
+/// Compile the modules of the given namespaces for the target triple of
+/// \p opts and write them to \p output as described by \p kind. The
+/// namespaces get lowered and compiled in parallel, each one in its own
+/// context. If `profileUse` of \p opts is set, the profile guides the
+/// optimizations.
+llvm::Error compileAOT(const Options &opts,
+                       llvm::ArrayRef<NamespaceModule> modules, AOTOutput kind,
+                       llvm::StringRef output);
+
+} // namespace serene::jit
+#endif
@@ -18,29 +18,58 @@
 
 #include "jit/jit.h"
 
+#include "jit/perf_map.h"
+#include "jit/profile.h"
+#include "jit/tiering.h"
 #include "options.h" // for Options
+#include "utils.h"
 
 #include <__type_traits/remove_reference.h> // for remov...
 #include <__utility/move.h>                 // for move
 #include <system_error>                     // for error_code
 
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/ADT/StringMapEntry.h>                 // for StringMapEntry
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/ADT/iterator.h>                       // for iterator_facade_base
 #include <llvm/ExecutionEngine/JITEventListener.h>   // for JITEventListener
 #include <llvm/ExecutionEngine/Orc/CompileUtils.h>   // for TMOwn...
 #include <llvm/ExecutionEngine/Orc/Core.h>           // for JITDy...
+#include <llvm/ExecutionEngine/Orc/DebugObjectManagerPlugin.h>
 #include <llvm/ExecutionEngine/Orc/DebugUtils.h>     // for opera...
+#include <llvm/ExecutionEngine/Orc/EPCDebugObjectRegistrar.h>
 #include <llvm/ExecutionEngine/Orc/ExecutionUtils.h> // for Dynam...
 #include <llvm/ExecutionEngine/Orc/IRCompileLayer.h> // for IRCom...
 #include <llvm/ExecutionEngine/Orc/LLJIT.h>          // IWYU pragma: keep
+#include <llvm/ExecutionEngine/Orc/Mangling.h>
 #include <llvm/ExecutionEngine/Orc/Layer.h>          // for Objec...
+#include <llvm/ExecutionEngine/Orc/MapperJITLinkMemoryManager.h>
+#include <llvm/ExecutionEngine/Orc/MemoryMapper.h>
+#include <llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h>
 #include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/Orc/TargetProcess/JITLoaderGDB.h>
 #include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h> // for Threa...
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/IR/DataLayout.h>          // for DataL...
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/LLVMContext.h>         // for LLVMC...
 #include <llvm/IR/Module.h>              // for Module
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CachePruning.h>
+#include <llvm/IRReader/IRReader.h>
 #include <llvm/Support/FileSystem.h>     // for OpenFlags
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/ToolOutputFile.h> // for ToolOutputFile
 #include <llvm/TargetParser/Triple.h>    // for Triple
 
@@ -52,25 +81,159 @@ namespace serene::jit {
 // ----------------------------------------------------------------------------
 // ObjectCache Implementation
 // ----------------------------------------------------------------------------
+ObjectCache::ObjectCache(llvm::StringRef cacheDir, llvm::StringRef triple,
+                         int optLevel, uint64_t maxSize)
+    : cacheDir(cacheDir.str()), triple(triple.str()), optLevel(optLevel),
+      maxSize(maxSize) {
+  if (cacheDir.empty()) {
+    return;
+  }
+
+  if (auto ec = llvm::sys::fs::create_directories(cacheDir)) {
+    JIT_LOG("Can't create the object cache directory '" << cacheDir
+                                                        << "': "
+                                                        << ec.message());
+    this->cacheDir.clear();
+  }
+};
+
+std::string ObjectCache::getKey(const llvm::Module &m) const {
+  llvm::SmallVector<char, 0> bitcode;
+  llvm::raw_svector_ostream os(bitcode);
+  llvm::WriteBitcodeToFile(m, os);
+
+  llvm::SHA1 hasher;
+  hasher.update(llvm::StringRef(bitcode.data(), bitcode.size()));
+  hasher.update(triple);
+  hasher.update(llvm::StringRef(reinterpret_cast<const char *>(&optLevel),
+                                sizeof(optLevel)));
+
+  return llvm::toHex(hasher.result(), /*LowerCase=*/true);
+};
+
+std::string ObjectCache::getCachePath(llvm::StringRef key) const {
+  // `pruneCache` only considers the files with this prefix
+  llvm::SmallString<MAX_PATH_SLOTS> path(cacheDir);
+  llvm::sys::path::append(path, "llvmcache-" + key);
+  return std::string(path);
+};
+
+void ObjectCache::prune() {
+  llvm::CachePruningPolicy policy;
+  policy.MaxSizeBytes = maxSize;
+
+  // It's a noop if the cache got pruned recently
+  UNUSED(llvm::pruneCache(cacheDir, policy));
+};
+
 void ObjectCache::notifyObjectCompiled(const llvm::Module *m,
                                        llvm::MemoryBufferRef objBuffer) {
-  cachedObjects[m->getModuleIdentifier()] =
-      llvm::MemoryBuffer::getMemBufferCopy(objBuffer.getBuffer(),
-                                           objBuffer.getBufferIdentifier());
+  std::lock_guard<std::mutex> guard(lock);
+
+  std::string key;
+  auto i = pendingKeys.find(m);
+
+  if (i != pendingKeys.end()) {
+    key = std::move(i->second);
+    pendingKeys.erase(i);
+  } else {
+    key = getKey(*m);
+  }
+
+  cachedObjects[key] = llvm::MemoryBuffer::getMemBufferCopy(
+      objBuffer.getBuffer(), objBuffer.getBufferIdentifier());
+
+  if (cacheDir.empty()) {
+    return;
+  }
+
+  llvm::SmallString<MAX_PATH_SLOTS> model(cacheDir);
+  llvm::sys::path::append(model, "tmp-%%%%%%%%.o");
+
+  auto temp = llvm::sys::fs::TempFile::create(model);
+  if (!temp) {
+    auto msg = llvm::toString(temp.takeError());
+    JIT_LOG("Can't create a temporary file in the object cache: " << msg);
+    return;
+  }
+
+  std::error_code ec;
+  {
+    llvm::raw_fd_ostream os(temp->FD, /*shouldClose=*/false);
+    os << objBuffer.getBuffer();
+    os.flush();
+
+    // The stream is fatal about the errors that nobody looked at
+    ec = os.error();
+    os.clear_error();
+  }
+
+  if (ec) {
+    JIT_LOG("Can't write to the object cache: " << ec.message());
+    llvm::consumeError(temp->discard());
+    return;
+  }
+
+  // Renaming is atomic, so other processes either see the whole object or
+  // nothing at all.
+  if (auto err = temp->keep(getCachePath(key))) {
+    auto msg = llvm::toString(std::move(err));
+    JIT_LOG("Can't store the object of " + m->getModuleIdentifier() +
+            " in the cache: " + msg);
+    return;
+  }
+
+  prune();
 }
 
+void ObjectCache::forget(const llvm::Module *m) {
+  std::lock_guard<std::mutex> guard(lock);
+  pendingKeys.erase(m);
+};
+
 std::unique_ptr<llvm::MemoryBuffer>
 ObjectCache::getObject(const llvm::Module *m) {
-  auto i = cachedObjects.find(m->getModuleIdentifier());
+  // Even the objects in memory are looked up by the content of the module,
+  // since a module might come back with the same identifier but new IR
+  auto key = getKey(*m);
 
-  if (i == cachedObjects.end()) {
-    JIT_LOG("No object for " + m->getModuleIdentifier() +
-            " in cache. Compiling.");
-    return nullptr;
+  std::lock_guard<std::mutex> guard(lock);
+
+  auto i = cachedObjects.find(key);
+
+  if (i != cachedObjects.end()) {
+    JIT_LOG("Object for " + m->getModuleIdentifier() + " loaded from cache.");
+    if (instr != nullptr) {
+      instr->add(Counter::ObjectCacheHits);
+    }
+    return llvm::MemoryBuffer::getMemBuffer(i->second->getMemBufferRef());
+  }
+
+  if (!cacheDir.empty()) {
+    auto maybeObj = llvm::MemoryBuffer::getFile(
+        getCachePath(key), /*IsText=*/false, /*RequiresNullTerminator=*/false);
+
+    if (maybeObj) {
+      JIT_LOG("Object for " + m->getModuleIdentifier() +
+              " loaded from the disk cache.");
+      if (instr != nullptr) {
+        instr->add(Counter::ObjectCacheHits);
+      }
+
+      auto &obj = cachedObjects[key];
+      obj       = std::move(*maybeObj);
+      return llvm::MemoryBuffer::getMemBuffer(obj->getMemBufferRef());
+    }
   }
 
-  JIT_LOG("Object for " + m->getModuleIdentifier() + " loaded from cache.");
-  return llvm::MemoryBuffer::getMemBuffer(i->second->getMemBufferRef());
+  pendingKeys[m] = std::move(key);
+
+  JIT_LOG("No object for " + m->getModuleIdentifier() +
+          " in cache. Compiling.");
+  if (instr != nullptr) {
+    instr->add(Counter::ObjectCacheMisses);
+  }
+  return nullptr;
 }
 
 void ObjectCache::dumpToObjectFile(llvm::StringRef outputFilename) {
@@ -88,6 +251,7 @@ void ObjectCache::dumpToObjectFile(llvm::StringRef outputFilename) {
   }
   // Dump the object generated for a single module to the output file.
   // TODO: Replace this with a runtime check
+  std::lock_guard<std::mutex> guard(lock);
   assert(cachedObjects.size() == 1 && "Expected only one object entry.");
 
   auto &cachedObject = cachedObjects.begin()->second;
@@ -98,34 +262,413 @@ void ObjectCache::dumpToObjectFile(llvm::StringRef outputFilename) {
 // ----------------------------------------------------------------------------
 // JIT Implementation
 // ----------------------------------------------------------------------------
+/// An IR compiler that looks up the object \p cache for each module and
+/// only hands the modules that miss the cache to the actual compiler, which
+/// doesn't know about the cache. So the compile time and the number of the
+/// JITed modules that it reports to the instrumentation of the JIT only
+/// cover the modules that actually get compiled.
+class InstrumentedIRCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+  std::unique_ptr<IRCompiler> compiler;
+  const JIT &jit;
+  ObjectCache *cache;
+
+public:
+  InstrumentedIRCompiler(std::unique_ptr<IRCompiler> compiler, const JIT &jit,
+                         ObjectCache *cache)
+      : IRCompiler(compiler->getManglingOptions()),
+        compiler(std::move(compiler)), jit(jit), cache(cache){};
+
+  llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+  operator()(llvm::Module &m) override {
+    if (cache != nullptr) {
+      if (auto cached = cache->getObject(&m)) {
+        return cached;
+      }
+    }
+
+    Instrumentation::Scope phase;
+    Instrumentation::Scope timer;
+
+    if (auto *instr = jit.getInstrumentation()) {
+      phase = instr->time("Codegen");
+      timer = phase.nest(m.getModuleIdentifier());
+      instr->add(Counter::ModulesJITed);
+    }
+
+    auto obj = (*compiler)(m);
+
+    if (cache != nullptr) {
+      if (obj) {
+        cache->notifyObjectCompiled(&m, (*obj)->getMemBufferRef());
+      } else {
+        // The cache never hears about this module again
+        cache->forget(&m);
+      }
+    }
+
+    return obj;
+  };
+};
+
+void JIT::setInstrumentation(Instrumentation *i) {
+  instr = i;
+  if (cache) {
+    cache->setInstrumentation(i);
+  }
+};
+
+JIT::NamespaceDylibs *JIT::getNamespaceDylibs(SymbolID nsName) {
+  auto id = nsIDs.find(nsName);
+  return id == nsIDs.end() ? nullptr : &nsDylibs[id->second];
+};
+
+const JIT::NamespaceDylibs *JIT::getNamespaceDylibs(SymbolID nsName) const {
+  auto id = nsIDs.find(nsName);
+  return id == nsIDs.end() ? nullptr : &nsDylibs[id->second];
+};
+
+JIT::NamespaceDylibs &JIT::getOrCreateNamespaceDylibs(SymbolID nsName) {
+  auto [id, inserted] = nsIDs.try_emplace(nsName, 0);
+
+  if (inserted) {
+    id->second = ns_counter++;
+    assert(id->second == nsDylibs.size() && "Namespace IDs are out of sync");
+    nsDylibs.emplace_back();
+  }
+
+  return nsDylibs[id->second];
+};
+
 orc::JITDylib *JIT::getLatestJITDylib(const llvm::StringRef &nsName) {
-  if (jitDylibs.count(nsName) == 0) {
+  auto id = SymbolTable::global().lookup(nsName);
+  if (!id) {
     return nullptr;
   }
 
-  auto vec = jitDylibs[nsName];
-  // TODO: Make sure that the returning Dylib still exists in the JIT
-  //       by calling jit->engine->getJITDylibByName(dylib_name);
-  return vec.empty() ? nullptr : vec.back();
+  std::shared_lock<std::shared_mutex> readLock(dylibLock);
+  const auto *dylibs = getNamespaceDylibs(*id);
+
+  if (dylibs == nullptr || dylibs->generations.empty()) {
+    return nullptr;
+  }
+
+  return dylibs->generations.back();
 };
 
 void JIT::pushJITDylib(const llvm::StringRef &nsName, llvm::orc::JITDylib *l) {
-  if (jitDylibs.count(nsName) == 0) {
-    llvm::SmallVector<llvm::orc::JITDylib *, 1> vec{l};
-    jitDylibs[nsName] = vec;
-    return;
-  }
-  auto vec = jitDylibs[nsName];
-  vec.push_back(l);
-  jitDylibs[nsName] = vec;
+  auto id = internSymbol(nsName);
+
+  std::unique_lock<std::shared_mutex> writeLock(dylibLock);
+  auto &dylibs = getOrCreateNamespaceDylibs(id);
+
+  dylibs.generations.push_back(l);
+  // Any cached address belongs to the older generations now
+  dylibs.addresses.clear();
 }
 
 size_t JIT::getNumberOfJITDylibs(const llvm::StringRef &nsName) {
-  if (jitDylibs.count(nsName) == 0) {
+  auto id = SymbolTable::global().lookup(nsName);
+  if (!id) {
     return 0;
   }
 
-  return jitDylibs[nsName].size();
+  std::shared_lock<std::shared_mutex> readLock(dylibLock);
+  const auto *dylibs = getNamespaceDylibs(*id);
+
+  return dylibs == nullptr ? 0 : dylibs->generations.size();
+};
+
+llvm::Error JIT::removeOldJITDylibs(const llvm::StringRef &nsName,
+                                    size_t keep) {
+  auto id = SymbolTable::global().lookup(nsName);
+  if (!id) {
+    return llvm::Error::success();
+  }
+
+  llvm::SmallVector<llvm::orc::JITDylib *, 4> oldGenerations;
+  {
+    std::unique_lock<std::shared_mutex> writeLock(dylibLock);
+    auto *dylibs = getNamespaceDylibs(*id);
+
+    if (dylibs == nullptr || dylibs->generations.size() <= keep) {
+      return llvm::Error::success();
+    }
+
+    auto &gens = dylibs->generations;
+    auto end   = gens.end() - keep;
+
+    oldGenerations.append(gens.begin(), end);
+    gens.erase(gens.begin(), end);
+  }
+
+  auto &es        = engine->getExecutionSession();
+  llvm::Error err = llvm::Error::success();
+
+  for (auto *jd : oldGenerations) {
+    JIT_LOG("Removing JITDylib: " << jd->getName());
+
+    // The optimized versions of the functions link against the generation
+    // that they were created for
+    if (tiering) {
+      err = llvm::joinErrors(std::move(err), tiering->removeDylibsOf(*jd));
+    }
+
+    // In the lazy mode, the bodies of the functions live in a separate
+    // JITDylib next to the one that we created and that's where the tier-0
+    // code is
+    if (auto *impl = es.getJITDylibByName(jd->getName() + ".impl")) {
+      if (tiering) {
+        err =
+            llvm::joinErrors(std::move(err), tiering->removeDylibsOf(*impl));
+      }
+      err = llvm::joinErrors(std::move(err), es.removeJITDylib(*impl));
+    }
+
+    err = llvm::joinErrors(std::move(err), es.removeJITDylib(*jd));
+  }
+
+  return err;
+};
+
+llvm::Expected<llvm::orc::JITDylib *>
+JIT::createJITDylib(const llvm::StringRef &nsName) {
+  size_t generation = 0;
+  {
+    std::unique_lock<std::shared_mutex> writeLock(dylibLock);
+    generation = ++getOrCreateNamespaceDylibs(internSymbol(nsName)).created;
+  }
+
+  auto &es  = engine->getExecutionSession();
+  auto name = llvm::formatv("{0}#{1}", nsName, generation).str();
+
+  auto jd = es.createJITDylib(name);
+  if (!jd) {
+    return jd.takeError();
+  }
+
+  // Give the namespace access to the symbols of the host process
+  if (auto *processJD = es.getJITDylibByName(MAIN_PROCESS_JD_NAME)) {
+    jd->addToLinkOrder(*processJD);
+  }
+
+  return &*jd;
+};
+
+MaybeJitAddress JIT::lookup(const llvm::StringRef &nsName,
+                            const llvm::StringRef &sym) const {
+  auto &table = SymbolTable::global();
+
+  // A namespace that has never been interned can't be loaded
+  auto nsID = table.lookup(nsName);
+  if (!nsID) {
+    return llvm::make_error<llvm::StringError>(
+        llvm::formatv("Namespace '{0}' is not loaded in the JIT", nsName),
+        llvm::inconvertibleErrorCode());
+  }
+
+  if (auto symID = table.lookup(nsName, sym)) {
+    return lookup(*nsID, *symID);
+  }
+
+  // It might still be defined in the IR of the namespace
+  std::string fqName;
+  makeFQSymbolName(nsName, sym, fqName);
+  return lookup(*nsID, InvalidSymbolID, fqName);
+};
+
+MaybeJitAddress JIT::lookup(SymbolID nsID, SymbolID symID) const {
+  {
+    std::shared_lock<std::shared_mutex> readLock(dylibLock);
+    const auto *dylibs = getNamespaceDylibs(nsID);
+
+    if (dylibs != nullptr) {
+      auto addr = dylibs->addresses.find(symID);
+      if (addr != dylibs->addresses.end()) {
+        return addr->second;
+      }
+    }
+  }
+
+  return lookup(nsID, symID, SymbolTable::global().getName(symID));
+};
+
+MaybeJitAddress JIT::lookup(SymbolID nsID, SymbolID symID,
+                            llvm::StringRef fqName) const {
+  orc::JITDylib *jd = nullptr;
+  {
+    std::shared_lock<std::shared_mutex> readLock(dylibLock);
+    const auto *dylibs = getNamespaceDylibs(nsID);
+
+    if (dylibs != nullptr && !dylibs->generations.empty()) {
+      jd = dylibs->generations.back();
+    }
+  }
+
+  if (jd == nullptr) {
+    return llvm::make_error<llvm::StringError>(
+        llvm::formatv("Namespace '{0}' is not loaded in the JIT",
+                      SymbolTable::global().getName(nsID)),
+        llvm::inconvertibleErrorCode());
+  }
+
+  JIT_LOG("Looking up: " << fqName);
+
+  auto maybeAddr = engine->lookup(*jd, fqName);
+  if (!maybeAddr) {
+    return maybeAddr.takeError();
+  }
+
+  auto *addr = maybeAddr->toPtr<JitWrappedAddress>();
+
+  // Now that we know it's a real symbol, it's worth an ID
+  if (symID == InvalidSymbolID) {
+    symID = internSymbol(fqName);
+  }
+
+  std::unique_lock<std::shared_mutex> writeLock(dylibLock);
+
+  // A newer generation might have been pushed in the mean time, in that case
+  // the address is already stale and we should not cache it
+  auto *dylibs = getNamespaceDylibs(nsID);
+  if (dylibs != nullptr && !dylibs->generations.empty() &&
+      dylibs->generations.back() == jd) {
+    dylibs->addresses[symID] = addr;
+  }
+
+  return addr;
+};
+
+llvm::Error JIT::invokePacked(const llvm::StringRef &symbolName,
+                              llvm::MutableArrayRef<void *> args) const {
+  auto [nsName, sym] = symbolName.split('/');
+
+  if (sym.empty()) {
+    return llvm::make_error<llvm::StringError>(
+        llvm::formatv("'{0}' is not a fully qualified symbol", symbolName),
+        llvm::inconvertibleErrorCode());
+  }
+
+  auto fn = lookup(nsName, sym);
+  if (!fn) {
+    return fn.takeError();
+  }
+
+  (*fn)(args.data());
+  return llvm::Error::success();
+};
+
+ModuleGenerator irFileGenerator(llvm::StringRef file) {
+  return [file = file.str()](llvm::LLVMContext &ctx)
+             -> llvm::Expected<std::unique_ptr<llvm::Module>> {
+    llvm::SMDiagnostic diag;
+    auto m = llvm::parseIRFile(file, diag, ctx);
+
+    if (!m) {
+      std::string msg;
+      llvm::raw_string_ostream os(msg);
+      diag.print(nullptr, os);
+
+      return llvm::make_error<llvm::StringError>(
+          os.str(), llvm::inconvertibleErrorCode());
+    }
+
+    return m;
+  };
+};
+
+llvm::Error JIT::lowerNamespace(const NamespaceModule &ns, bool materialize) {
+  // A context per namespace, so namespaces can be lowered and compiled
+  // concurrently
+  llvm::orc::ThreadSafeContext tsctx(std::make_unique<llvm::LLVMContext>());
+
+  Instrumentation::Scope phase;
+  Instrumentation::Scope timer;
+  if (instr != nullptr) {
+    phase = instr->time("IR");
+    timer = phase.nest(ns.nsName);
+  }
+
+  auto m = ns.generate(*tsctx.getContext());
+  phase.stop();
+  timer.stop();
+
+  if (!m) {
+    return m.takeError();
+  }
+
+  if ((*m)->getDataLayout().isDefault()) {
+    (*m)->setDataLayout(engine->getDataLayout());
+  }
+
+  // Looking up any of the symbols of the module is enough to materialize
+  // all of it
+  std::string entry;
+  if (materialize) {
+    for (const auto &fn : **m) {
+      if (!fn.isDeclaration() && !fn.hasLocalLinkage()) {
+        entry = fn.getName().str();
+        break;
+      }
+    }
+  }
+
+  auto jd = createJITDylib(ns.nsName);
+  if (!jd) {
+    return jd.takeError();
+  }
+
+  if (auto err = engine->addIRModule(
+          **jd, llvm::orc::ThreadSafeModule(std::move(*m), tsctx))) {
+    return err;
+  }
+
+  pushJITDylib(ns.nsName, *jd);
+
+  if (!entry.empty()) {
+    if (auto addr = engine->lookup(**jd, entry); !addr) {
+      return addr.takeError();
+    }
+  }
+
+  return llvm::Error::success();
+};
+
+llvm::Error JIT::loadModule(const llvm::StringRef &nsName,
+                            const llvm::StringRef &file) {
+  return lowerNamespace({nsName.str(), irFileGenerator(file)}, false);
+};
+
+llvm::Error JIT::addModules(llvm::ArrayRef<NamespaceModule> modules) {
+  // The generations of a namespace would end up in an arbitrary order
+  llvm::StringSet<> names;
+  for (const auto &ns : modules) {
+    if (!names.insert(ns.nsName).second) {
+      return llvm::make_error<llvm::StringError>(
+          llvm::formatv("Namespace '{0}' is added more than once", ns.nsName),
+          llvm::inconvertibleErrorCode());
+    }
+  }
+
+  // The lazy JIT compiles the functions on their first call anyway
+  auto materialize = !options->JITLazy;
+
+  llvm::ThreadPool pool(
+      llvm::hardware_concurrency(options->JITLoweringThreads));
+
+  std::mutex errLock;
+  llvm::Error errors = llvm::Error::success();
+
+  for (const auto &ns : modules) {
+    pool.async([&, this]() {
+      auto err = lowerNamespace(ns, materialize);
+
+      std::lock_guard<std::mutex> guard(errLock);
+      errors = llvm::joinErrors(std::move(errors), std::move(err));
+    });
+  }
+
+  pool.wait();
+  return errors;
 };
 
 JIT::JIT(llvm::orc::JITTargetMachineBuilder &&jtmb,
@@ -133,7 +676,12 @@ JIT::JIT(llvm::orc::JITTargetMachineBuilder &&jtmb,
     :
 
       options(std::move(opts)),
-      cache(options->JITenableObjectCache ? new ObjectCache() : nullptr),
+      cache(options->JITenableObjectCache
+                ? new ObjectCache(options->JITObjectCacheDir,
+                                  options->hostTriple.str(),
+                                  getBaseOptimizationLevel(),
+                                  options->JITObjectCacheMaxSize)
+                : nullptr),
       gdbListener(options->JITenableGDBNotificationListener
                       ? llvm::JITEventListener::createGDBRegistrationListener()
                       : nullptr),
@@ -142,23 +690,117 @@ JIT::JIT(llvm::orc::JITTargetMachineBuilder &&jtmb,
                        : nullptr),
       jtmb(jtmb){};
 
+JIT::~JIT() = default;
+
+llvm::Error JIT::writeProfile() const {
+  if (!profiler) {
+    return llvm::Error::success();
+  }
+
+  return profiler->collect().write(options->JITProfileGenerate);
+};
+
 void JIT::dumpToObjectFile(const llvm::StringRef &filename) {
   cache->dumpToObjectFile(filename);
 };
 
 int JIT::getOptimizatioLevel() const {
-  if (options->compilationPhase <= CompilationPhase::NoOptimization) {
-    return 0;
+  return getOptimizationLevel(*options);
+}
+
+bool JIT::shouldSpeculate() const {
+  // Without the lazy mode everything gets compiled at once anyway and
+  // without compile threads there is nobody to compile ahead of time.
+  return options->JITLazy && options->JITSpeculate &&
+         options->JITCompileThreads > 0;
+};
+
+void JIT::speculateCallees(llvm::Module &m,
+                           llvm::orc::MaterializationResponsibility &r) {
+  auto &es = engine->getExecutionSession();
+  llvm::orc::MangleAndInterner mangle(es, m.getDataLayout());
+
+  llvm::SmallPtrSet<const llvm::Function *, 16> seen;
+  llvm::orc::SymbolLookupSet callees;
+
+  for (auto &f : m) {
+    for (auto &bb : f) {
+      for (auto &inst : bb) {
+        const auto *call = llvm::dyn_cast<llvm::CallBase>(&inst);
+        if (call == nullptr) {
+          continue;
+        }
+
+        const auto *callee = call->getCalledFunction();
+        if (callee == nullptr || !callee->isDeclaration() ||
+            callee->isIntrinsic() || !seen.insert(callee).second) {
+          continue;
+        }
+
+        // The callee might not live in the same JITDylib at all
+        callees.add(mangle(callee->getName()),
+                    llvm::orc::SymbolLookupFlags::WeaklyReferencedSymbol);
+      }
+    }
   }
 
-  if (options->compilationPhase == CompilationPhase::O1) {
-    return 1;
+  if (callees.empty()) {
+    return;
   }
-  if (options->compilationPhase == CompilationPhase::O2) {
-    return 2;
+
+  // In the lazy mode, the target JITDylib is the one that contains the
+  // actual bodies of the functions. Looking up the callees there starts
+  // compiling them on the compile threads without waiting for the results.
+  es.lookup(
+      llvm::orc::LookupKind::Static,
+      llvm::orc::makeJITDylibSearchOrder(
+          &r.getTargetJITDylib(),
+          llvm::orc::JITDylibLookupFlags::MatchAllSymbols),
+      std::move(callees), llvm::orc::SymbolState::Ready,
+      [](llvm::Expected<llvm::orc::SymbolMap> result) {
+        if (!result) {
+          auto msg = llvm::toString(result.takeError());
+          JIT_LOG("Speculative compilation failed: " << msg);
+        }
+      },
+      llvm::orc::NoDependenciesToRegister);
+};
+
+llvm::Expected<llvm::orc::ThreadSafeModule>
+JIT::transformModule(llvm::orc::ThreadSafeModule tsm,
+                     llvm::orc::MaterializationResponsibility &r) {
+  if (shouldSpeculate()) {
+    tsm.withModuleDo([&](llvm::Module &m) { speculateCallees(m, r); });
   }
-  return 3;
-}
+
+  if (profile || profiler) {
+    tsm.withModuleDo([&](llvm::Module &m) {
+      // The profile only matches the functions as they were instrumented
+      if (profile) {
+        profile->apply(m);
+      }
+
+      if (profiler) {
+        profiler->instrument(m);
+      }
+
+      // In the tiered mode the hot functions get optimized on tier up
+      if (profile && !tiering) {
+        optimizeModule(m, getOptimizatioLevel());
+      }
+    });
+  }
+
+  if (tiering) {
+    return tiering->transform(std::move(tsm), r);
+  }
+
+  return std::move(tsm);
+};
+
+int JIT::getBaseOptimizationLevel() const {
+  return options->JITTiered ? 0 : getOptimizatioLevel();
+};
 
 llvm::Error JIT::createCurrentProcessJD() {
 
@@ -188,6 +830,49 @@ llvm::Error JIT::createCurrentProcessJD() {
   return llvm::Error::success();
 };
 
+llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>>
+JIT::createJITLinkLayer(llvm::orc::ExecutionSession &es) {
+  // All the objects share the same slabs instead of getting their own pages,
+  // which is much better for lots of small modules, e.g. in a REPL.
+  auto memMgr = llvm::orc::MapperJITLinkMemoryManager::CreateWithMapper<
+      llvm::orc::InProcessMemoryMapper>(options->JITLinkSlabSize);
+
+  if (!memMgr) {
+    return memMgr.takeError();
+  }
+
+  auto objectLayer =
+      std::make_unique<llvm::orc::ObjectLinkingLayer>(es, std::move(*memMgr));
+
+  // The JITEventListeners only work with RuntimeDyld, JITLink uses plugins
+  // instead.
+  if (options->JITenableGDBNotificationListener) {
+    // We pass the address of the registration function directly, since
+    // it is not going to be visible to `dlsym` in a static binary
+    auto registrar = std::make_unique<llvm::orc::EPCDebugObjectRegistrar>(
+        es, llvm::orc::ExecutorAddr::fromPtr(
+                &llvm_orc_registerJITLoaderGDBWrapper));
+
+    objectLayer->addPlugin(
+        std::make_unique<llvm::orc::DebugObjectManagerPlugin>(
+            es, std::move(registrar)));
+  }
+
+  if (options->JITPerfMap) {
+    auto plugin = PerfMapPlugin::create();
+
+    if (!plugin) {
+      // Not being able to profile is not a reason to stop
+      auto msg = llvm::toString(plugin.takeError());
+      JIT_LOG("Can't create the perf map: " << msg);
+    } else {
+      objectLayer->addPlugin(std::move(*plugin));
+    }
+  }
+
+  return objectLayer;
+};
+
 MaybeJIT JIT::make(llvm::orc::JITTargetMachineBuilder &&jtmb,
                    std::unique_ptr<Options> opts) {
   auto dl = jtmb.getDefaultDataLayoutForTarget();
@@ -196,20 +881,18 @@ MaybeJIT JIT::make(llvm::orc::JITTargetMachineBuilder &&jtmb,
   }
 
   auto jitEngine = std::make_unique<JIT>(std::move(jtmb), std::move(opts));
-  //
-  // What might go wrong?
-  // in a repl env when we have to create new modules on top of each other
-  // having two different contex might be a problem, but i think since we
-  // use the first context to generate the IR and the second one to just
-  // run it.
-  std::unique_ptr<llvm::LLVMContext> ctx(new llvm::LLVMContext);
 
   // Callback to create the object layer with symbol resolution to current
   // process and dynamically linked libraries.
   auto objectLinkingLayerCreator = [&](llvm::orc::ExecutionSession &session,
-                                       const llvm::Triple &tt) {
+                                       const llvm::Triple &tt)
+      -> llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>> {
     (void)tt;
 
+    if (jitEngine->options->JITUseJITLink) {
+      return jitEngine->createJITLinkLayer(session);
+    }
+
     auto objectLayer =
         std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(session, []() {
           return std::make_unique<llvm::SectionMemoryManager>();
@@ -239,18 +922,31 @@ MaybeJIT JIT::make(llvm::orc::JITTargetMachineBuilder &&jtmb,
   auto compileFunctionCreator = [&](llvm::orc::JITTargetMachineBuilder JTMB)
       -> llvm::Expected<
           std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
-    llvm::CodeGenOpt::Level jitCodeGenOptLevel =
-        static_cast<llvm::CodeGenOpt::Level>(jitEngine->getOptimizatioLevel());
+    configureTargetMachine(JTMB, jitEngine->getBaseOptimizationLevel());
+
+    std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> compiler;
 
-    JTMB.setCodeGenOptLevel(jitCodeGenOptLevel);
+    // A single target machine can't be used from different threads, so
+    // the concurrent compiler creates one per compilation. Besides the
+    // compile threads, the eager JIT compiles on the workers of
+    // `addModules` as well.
+    if (jitEngine->options->JITCompileThreads > 0 ||
+        !jitEngine->options->JITLazy) {
+      compiler =
+          std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(JTMB));
+    } else {
+      auto targetMachine = JTMB.createTargetMachine();
+      if (!targetMachine) {
+        return targetMachine.takeError();
+      }
 
-    auto targetMachine = JTMB.createTargetMachine();
-    if (!targetMachine) {
-      return targetMachine.takeError();
+      compiler = std::make_unique<llvm::orc::TMOwningSimpleCompiler>(
+          std::move(*targetMachine));
     }
 
-    return std::make_unique<llvm::orc::TMOwningSimpleCompiler>(
-        std::move(*targetMachine), jitEngine->cache.get());
+    // The object cache is consulted by the instrumented compiler instead
+    return std::make_unique<InstrumentedIRCompiler>(
+        std::move(compiler), *jitEngine, jitEngine->cache.get());
   };
 
   auto compileNotifier = [&](llvm::orc::MaterializationResponsibility &r,
@@ -262,11 +958,16 @@ MaybeJIT JIT::make(llvm::orc::JITTargetMachineBuilder &&jtmb,
     });
   };
 
+  // With any compile threads, LLJIT dispatches the materialization tasks of
+  // the execution session to a thread pool of this size.
+  auto threads = jitEngine->options->JITCompileThreads;
+
   if (jitEngine->options->JITLazy) {
     // Setup a LLLazyJIT instance to the times that latency is important
     // for example in a REPL. This way
     auto jit =
         cantFail(llvm::orc::LLLazyJITBuilder()
+                     .setNumCompileThreads(threads)
                      .setCompileFunctionCreator(compileFunctionCreator)
                      .setObjectLinkingLayerCreator(objectLinkingLayerCreator)
                      .create());
@@ -279,6 +980,7 @@ MaybeJIT JIT::make(llvm::orc::JITTargetMachineBuilder &&jtmb,
     // when we run the JIT in the compiler
     auto jit =
         cantFail(llvm::orc::LLJITBuilder()
+                     .setNumCompileThreads(threads)
                      .setCompileFunctionCreator(compileFunctionCreator)
                      .setObjectLinkingLayerCreator(objectLinkingLayerCreator)
                      .create());
@@ -286,6 +988,37 @@ MaybeJIT JIT::make(llvm::orc::JITTargetMachineBuilder &&jtmb,
     jitEngine->engine = std::move(jit);
   }
 
+  if (jitEngine->options->JITTiered) {
+    // There is no point in tiering up to a level lower than O2
+    auto level = std::max(jitEngine->getOptimizatioLevel(), 2);
+
+    jitEngine->tiering = std::make_unique<Tiering>(
+        *jitEngine->engine, jitEngine->jtmb, level,
+        jitEngine->options->JITTierUpThreshold);
+  }
+
+  if (!jitEngine->options->JITProfileGenerate.empty()) {
+    jitEngine->profiler = std::make_unique<Profiler>();
+  }
+
+  if (!jitEngine->options->profileUse.empty()) {
+    auto profile = Profile::read(jitEngine->options->profileUse);
+    if (!profile) {
+      return profile.takeError();
+    }
+    jitEngine->profile = std::make_unique<Profile>(std::move(*profile));
+  }
+
+  if (jitEngine->tiering || jitEngine->shouldSpeculate() ||
+      jitEngine->profiler || jitEngine->profile) {
+    jitEngine->engine->getIRTransformLayer().setTransform(
+        [engine = jitEngine.get()](
+            llvm::orc::ThreadSafeModule tsm,
+            llvm::orc::MaterializationResponsibility &r) {
+          return engine->transformModule(std::move(tsm), r);
+        });
+  }
+
   if (auto err = jitEngine->createCurrentProcessJD()) {
     return err;
   }
@@ -303,4 +1036,67 @@ MaybeJIT makeJIT(std::unique_ptr<Options> opts) {
 
   return maybeJIT;
 };
+
+int getOptimizationLevel(const Options &opts) {
+  if (opts.compilationPhase <= CompilationPhase::NoOptimization) {
+    return 0;
+  }
+
+  if (opts.compilationPhase == CompilationPhase::O1) {
+    return 1;
+  }
+  if (opts.compilationPhase == CompilationPhase::O2) {
+    return 2;
+  }
+  return 3;
+};
+
+void configureTargetMachine(llvm::orc::JITTargetMachineBuilder &jtmb,
+                            int level, bool aot) {
+  jtmb.setCodeGenOptLevel(static_cast<llvm::CodeGenOpt::Level>(level));
+
+  if (!aot) {
+    return;
+  }
+
+  // The objects end up in an executable that gets linked with
+  // `--gc-sections` just like our own binary, so each function and global
+  // needs its own section for the linker to strip the unused ones
+  jtmb.setRelocationModel(llvm::Reloc::PIC_);
+  jtmb.getOptions().FunctionSections = true;
+  jtmb.getOptions().DataSections     = true;
+};
+
+void optimizeModule(llvm::Module &m, int level, llvm::TargetMachine *tm) {
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+
+  llvm::PassBuilder pb(tm);
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  llvm::ModulePassManager mpm;
+
+  switch (level) {
+  case 0:
+    mpm = pb.buildO0DefaultPipeline(llvm::OptimizationLevel::O0);
+    break;
+  case 1:
+    mpm = pb.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O1);
+    break;
+  case 2:
+    mpm = pb.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2);
+    break;
+  default:
+    mpm = pb.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3);
+    break;
+  }
+
+  mpm.run(m, mam);
+};
 } // namespace serene::jit
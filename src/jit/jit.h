@@ -20,30 +20,45 @@
  * Commentary:
   - It operates in lazy (for REPL) and non-lazy mode and wraps LLJIT
     and LLLazyJIT
-  - It uses an object cache layer to cache module (not NSs) objects.
+  - It uses an object cache layer to cache module (not NSs) objects. The
+    cache can be persisted on the disk, in that case objects are
+    addressed by a hash of the module's bitcode, the target triple and the
+    optimization level. So a warm start skips the codegen entirely.
+  - Every namespace gets lowered in its own LLVM context, so `addModules`
+    can lower and compile the namespaces of a build on a thread pool.
+  - It can collect a profile of the JITed code or optimize the code with
+    the profile of a previous run (look at `jit/profile.h`).
  */
 
 #ifndef JIT_JIT_H
 #define JIT_JIT_H
 
+#include "instrumentation.h"
 #include "options.h"
+#include "symbol_table.h"
 
 #include <__memory/unique_ptr.h>
 
 #include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringMap.h>
 #include <llvm/ADT/StringRef.h>
 #include <llvm/ExecutionEngine/ObjectCache.h>
 #include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/Support/Debug.h>
 #include <llvm/Support/Error.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/MemoryBufferRef.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <functional>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <stddef.h>
+#include <string>
 #include <variant>
 #include <vector>
 
@@ -51,12 +66,17 @@ namespace llvm {
 class JITEventListener;
 } // namespace llvm
 namespace llvm {
+class LLVMContext;
 class Module;
+class TargetMachine;
 } // namespace llvm
 namespace llvm::orc {
+class ExecutionSession;
 class JITDylib;
 class LLJIT;
 class LLLazyJIT;
+class MaterializationResponsibility;
+class ObjectLayer;
 } // namespace llvm::orc
 
 namespace serene {
@@ -76,10 +96,35 @@ using MaybeJIT          = llvm::Expected<JITPtr>;
 using JitWrappedAddress = void (*)(void **);
 using MaybeJitAddress   = llvm::Expected<JitWrappedAddress>;
 
+/// Generate the LLVM module of a namespace in the given context. It might
+/// run on any thread, but never on the same context as another generator.
+using ModuleGenerator =
+    std::function<llvm::Expected<std::unique_ptr<llvm::Module>>(
+        llvm::LLVMContext &)>;
+
+/// A namespace and the generator of its LLVM module.
+struct NamespaceModule {
+  std::string nsName;
+  ModuleGenerator generate;
+};
+
+/// Return a generator that parses the LLVM IR (textual or bitcode) in the
+/// given \p file.
+ModuleGenerator irFileGenerator(llvm::StringRef file);
+
 /// A simple object cache following Lang's LLJITWithObjectCache example and
 /// MLIR's SimpelObjectCache.
+///
+/// If a cache directory is given, each object will be stored in a file named
+/// after the hash of the module's bitcode, the target triple and the
+/// optimization level. Files are written to a temporary file first and then
+/// renamed, so different processes can share the same directory safely.
 class ObjectCache : public llvm::ObjectCache {
 public:
+  ObjectCache() = default;
+  ObjectCache(llvm::StringRef cacheDir, llvm::StringRef triple, int optLevel,
+              uint64_t maxSize = 0);
+
   /// Cache the given `objBuffer` for the given module `m`. The buffer contains
   /// the combiled objects of the module
   void notifyObjectCompiled(const llvm::Module *m,
@@ -88,19 +133,67 @@ public:
   // Lookup the cache for the given module `m` or returen a nullptr.
   std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *m) override;
 
+  /// Drop what `getObject` remembered about \p m. Call it when compiling
+  /// \p m fails, since `notifyObjectCompiled` won't be called for it and
+  /// another module might get the same address later on.
+  void forget(const llvm::Module *m);
+
   /// Dump cached object to output file `filename`.
   void dumpToObjectFile(llvm::StringRef filename);
 
+  /// Count the cache hits and misses in the given \p i from now on.
+  void setInstrumentation(Instrumentation *i) { instr = i; };
+
 private:
+  std::mutex lock;
+
+  Instrumentation *instr = nullptr;
+
+  /// The objects in memory by the content address of their modules (look
+  /// at `getKey`)
   llvm::StringMap<std::unique_ptr<llvm::MemoryBuffer>> cachedObjects;
+
+  /// The directory of the persistent cache or empty if the cache lives only
+  /// in memory.
+  std::string cacheDir;
+  std::string triple;
+  int optLevel     = 0;
+  uint64_t maxSize = 0;
+
+  /// The keys that we computed in `getObject` for the modules that are being
+  /// compiled. So we don't have to serialize them again in
+  /// `notifyObjectCompiled`.
+  llvm::DenseMap<const llvm::Module *, std::string> pendingKeys;
+
+  /// Return the content address of the given module \p m.
+  std::string getKey(const llvm::Module &m) const;
+
+  /// Return the path to the cache file for the given \p key.
+  std::string getCachePath(llvm::StringRef key) const;
+
+  void prune();
 };
 
+class Profile;
+class Profiler;
+class Tiering;
+
 class JIT {
   std::unique_ptr<const Options> options;
 
+  /// Owns the counters of the instrumented code, if we are collecting a
+  /// profile. It has to outlive the engine.
+  std::unique_ptr<Profiler> profiler;
+  /// The profile to optimize the code with, if any
+  std::unique_ptr<Profile> profile;
+
   std::unique_ptr<orc::LLJIT> engine;
   std::unique_ptr<ObjectCache> cache;
 
+  /// It's only available in the tiered mode. It has to be destroyed before
+  /// the engine.
+  std::unique_ptr<Tiering> tiering;
+
   llvm::JITEventListener *gdbListener;
   /// Perf notification listener.
   llvm::JITEventListener *perfListener;
@@ -109,20 +202,87 @@ class JIT {
 
   std::vector<const char *> loadPaths;
 
-  // We keep the jibDylibs for each name space in a mapping from the ns
-  // name to a vector of jitdylibs, the last element is always the newest
-  // jitDylib
-  //
-  // Questions:
-  // Is using string as the key good enough, what about an ID for NSs
-  // or even a pointer to the ns?
-  llvm::StringMap<llvm::SmallVector<llvm::orc::JITDylib *, 1>> jitDylibs;
+  /// Where to report the compile time of the modules and the object cache
+  /// stats to, if any.
+  Instrumentation *instr = nullptr;
+
+  /// The JITDylibs of a namespace
+  struct NamespaceDylibs {
+    /// Live generations of the namespace, the last element is always the
+    /// newest one.
+    llvm::SmallVector<llvm::orc::JITDylib *, 1> generations;
+
+    /// The number of generations that we have ever created for the
+    /// namespace. We use it to name the new ones.
+    size_t created = 0;
+
+    /// The cache of the resolved addresses of the functions of the newest
+    /// generation, from the ID of the fully qualified symbol names to their
+    /// addresses. It gets invalidated whenever a new generation is pushed.
+    mutable llvm::DenseMap<SymbolID, JitWrappedAddress> addresses;
+  };
+
+  /// From the interned ID of the ns name to the namespace ID that we assign
+  /// using `ns_counter`.
+  llvm::DenseMap<SymbolID, uint> nsIDs;
+
+  /// The JITDylibs of all the namespaces, indexed by the namespace ID.
+  std::vector<NamespaceDylibs> nsDylibs;
+
+  /// Guards `nsIDs` and `nsDylibs`.
+  mutable std::shared_mutex dylibLock;
+
+  /// Return the JITDylibs of the given namespace or `nullptr` if there is
+  /// none. The caller has to hold the `dylibLock`.
+  NamespaceDylibs *getNamespaceDylibs(SymbolID nsName);
+  const NamespaceDylibs *getNamespaceDylibs(SymbolID nsName) const;
+
+  /// Same as `getNamespaceDylibs` but creates the entry for the namespace
+  /// if it doesn't exist. The caller has to hold the `dylibLock` exclusively.
+  NamespaceDylibs &getOrCreateNamespaceDylibs(SymbolID nsName);
 
   void pushJITDylib(const llvm::StringRef &nsName, llvm::orc::JITDylib *l);
   size_t getNumberOfJITDylibs(const llvm::StringRef &nsName);
 
+  /// Create a new JITDylib for the next generation of the given namespace
+  /// \p nsName. It doesn't register the new JITDylib for the namespace.
+  llvm::Expected<llvm::orc::JITDylib *>
+  createJITDylib(const llvm::StringRef &nsName);
+
   llvm::Error createCurrentProcessJD();
 
+  /// Create a JITLink based object layer that allocates the memory for all
+  /// the objects from shared slabs.
+  llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>>
+  createJITLinkLayer(llvm::orc::ExecutionSession &es);
+
+  /// Generate the module of the given namespace \p ns in a new context and
+  /// add it to the JIT as the newest generation of the namespace. If
+  /// \p materialize is true, it compiles the module right away on the
+  /// current thread instead of waiting for the first lookup.
+  llvm::Error lowerNamespace(const NamespaceModule &ns, bool materialize);
+
+  /// Look up \p fqName in the latest generation of the namespace \p nsID and
+  /// cache the result under \p symID. An invalid \p symID gets interned only
+  /// if the symbol is found.
+  MaybeJitAddress lookup(SymbolID nsID, SymbolID symID,
+                         llvm::StringRef fqName) const;
+
+  /// Whether to compile the callees of the functions that are being
+  /// compiled ahead of time.
+  bool shouldSpeculate() const;
+
+  /// Start compiling the functions that the functions of the given module
+  /// \p m call, in the background.
+  void speculateCallees(llvm::Module &m,
+                        llvm::orc::MaterializationResponsibility &r);
+
+  /// The IR transformation that every module goes through before getting
+  /// compiled.
+  llvm::Expected<llvm::orc::ThreadSafeModule>
+  transformModule(llvm::orc::ThreadSafeModule tsm,
+                  llvm::orc::MaterializationResponsibility &r);
+
   // Anonymous function counter. We need to assing a unique name to each
   // anonymous function and we use this counter to generate those names
   std::atomic<uint> fn_counter = 0;
@@ -134,6 +294,7 @@ class JIT {
 
 public:
   JIT(llvm::orc::JITTargetMachineBuilder &&jtmb, std::unique_ptr<Options> opts);
+  ~JIT();
   static MaybeJIT make(llvm::orc::JITTargetMachineBuilder &&jtmb,
                        std::unique_ptr<Options> opts);
 
@@ -141,33 +302,93 @@ public:
   // set. 0 == No optimizaion -> it includes compling to IR and AST
   int getOptimizatioLevel() const;
 
+  /// Return the codegen optimization level of the code that we compile
+  /// first. It is the same as `getOptimizatioLevel` unless we are in the
+  /// tiered mode.
+  int getBaseOptimizationLevel() const;
+
   /// Return a pointer to the most registered JITDylib of the given \p ns
   ////name
   llvm::orc::JITDylib *getLatestJITDylib(const llvm::StringRef &nsName);
 
+  /// Remove all but the newest \p keep generations of the JITDylibs of the
+  /// given namespace \p nsName from the JIT to reclaim their memory. The
+  /// caller has to make sure that no code or address from the removed
+  /// generations is in use.
+  llvm::Error removeOldJITDylibs(const llvm::StringRef &nsName,
+                                 size_t keep = 1);
+
   /// Looks up a packed-argument function with the given sym name and returns a
   /// pointer to it. Propagates errors in case of failure.
+  ///
+  /// It looks for the fully qualified name of the symbol in the latest
+  /// JITDylib of the namespace. The result gets cached, so looking up the
+  /// same symbol again costs two lookups in the symbol table and one in the
+  /// cache. It never interns the names that the JIT doesn't know about.
   MaybeJitAddress lookup(const llvm::StringRef &nsName,
                          const llvm::StringRef &sym) const;
 
+  /// The same as the other `lookup` but takes the interned IDs of the
+  /// namespace and the fully qualified symbol name. Once cached, it's a
+  /// single hash lookup under a shared lock.
+  MaybeJitAddress lookup(SymbolID nsID, SymbolID symID) const;
+
   /// Invokes the function with the given name passing it the list of opaque
-  /// pointers containing the actual arguments.
+  /// pointers containing the actual arguments. \p symbolName has to be a
+  /// fully qualified symbol name (`ns/sym`).
   llvm::Error
   invokePacked(const llvm::StringRef &symbolName,
                llvm::MutableArrayRef<void *> args = std::nullopt) const;
 
+  /// Load the LLVM IR (textual or bitcode) in the given \p file as the new
+  /// generation of the namespace \p nsName.
   llvm::Error loadModule(const llvm::StringRef &nsName,
                          const llvm::StringRef &file);
+
+  /// Generate and add the modules of all the given namespaces in parallel,
+  /// each one in its own `ThreadSafeContext` and as the new generation of
+  /// its namespace. Unless the JIT is lazy, the modules get compiled on the
+  /// same worker threads as well. Each namespace can appear only once.
+  llvm::Error addModules(llvm::ArrayRef<NamespaceModule> modules);
+
   void dumpToObjectFile(const llvm::StringRef &filename);
 
+  /// Write the profile that the instrumented code has collected so far to
+  /// the `JITProfileGenerate` file. It does nothing if we are not collecting
+  /// any profile.
+  llvm::Error writeProfile() const;
+
   /// Setup the load path for namespace lookups
   void setLoadPaths(std::vector<const char *> &dirs) { loadPaths.swap(dirs); };
   /// Return the load paths for namespaces
   llvm::ArrayRef<const char *> getLoadPaths() { return loadPaths; };
 
   const Options &getOptions() const { return *options; };
+
+  /// Report the time of loading and compiling the modules and the object
+  /// cache hits and misses to the given \p i from now on. \p i has to
+  /// outlive the JIT.
+  void setInstrumentation(Instrumentation *i);
+  Instrumentation *getInstrumentation() const { return instr; };
 };
 
 MaybeJIT makeJIT(std::unique_ptr<Options> opts);
+
+/// Return the optimization level (0 to 3) of the compilation phase of the
+/// given \p opts.
+int getOptimizationLevel(const Options &opts);
+
+/// Set up the given \p jtmb to generate code at the given codegen
+/// optimization \p level. The JIT and the AOT compiler (\p aot) share it, so
+/// they generate the same code, except that the AOT code is position
+/// independent and has a section per function and global.
+void configureTargetMachine(llvm::orc::JITTargetMachineBuilder &jtmb,
+                            int level, bool aot = false);
+
+/// Run the default optimization pipeline of the given \p level (0 to 3) on
+/// the module \p m. If the target machine \p tm is given, the pipeline will
+/// be tuned for it.
+void optimizeModule(llvm::Module &m, int level,
+                    llvm::TargetMachine *tm = nullptr);
 } // namespace serene::jit
 #endif
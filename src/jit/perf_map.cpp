@@ -0,0 +1,79 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jit/perf_map.h"
+
+#include "jit/jit.h"
+#include "utils.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/Process.h>
+
+#include <string>
+#include <system_error>
+
+namespace serene::jit {
+
+llvm::Expected<std::unique_ptr<PerfMapPlugin>> PerfMapPlugin::create() {
+  auto path =
+      llvm::formatv("/tmp/perf-{0}.map", llvm::sys::Process::getProcessId())
+          .str();
+
+  std::error_code ec;
+  auto os = std::make_unique<llvm::raw_fd_ostream>(path, ec,
+                                                   llvm::sys::fs::OF_Append);
+  if (ec) {
+    return llvm::errorCodeToError(ec);
+  }
+
+  JIT_LOG("Writing the perf map to: " << path);
+  return std::unique_ptr<PerfMapPlugin>(new PerfMapPlugin(std::move(os)));
+};
+
+void PerfMapPlugin::modifyPassConfig(
+    llvm::orc::MaterializationResponsibility &mr, llvm::jitlink::LinkGraph &g,
+    llvm::jitlink::PassConfiguration &config) {
+  UNUSED(mr);
+  UNUSED(g);
+
+  // Addresses are final after the fixups
+  config.PostFixupPasses.push_back(
+      [this](llvm::jitlink::LinkGraph &g) { return writeSymbols(g); });
+};
+
+llvm::Error PerfMapPlugin::writeSymbols(llvm::jitlink::LinkGraph &g) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  for (auto *sym : g.defined_symbols()) {
+    if (!sym->hasName() || !sym->isCallable() || sym->getSize() == 0) {
+      continue;
+    }
+
+    // The format is `START SIZE NAME` with hex numbers and no prefix
+    *os << llvm::format_hex_no_prefix(sym->getAddress().getValue(), 1) << " "
+        << llvm::format_hex_no_prefix(sym->getSize(), 1) << " "
+        << sym->getName() << "\n";
+  }
+
+  os->flush();
+  return llvm::Error::success();
+};
+
+} // namespace serene::jit
@@ -0,0 +1,85 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * A JITLink plugin that writes the address, size and name of every
+ * function that we link into the perf map file of the process
+ * (`/tmp/perf-<pid>.map`), so `perf` can symbolize the JITed code. It plays
+ * the same role for the `ObjectLinkingLayer` that the perf event listener
+ * plays for the `RTDyldObjectLinkingLayer`. Look at `Options::JITPerfMap`.
+ */
+
+#ifndef SERENE_JIT_PERF_MAP_H
+#define SERENE_JIT_PERF_MAP_H
+
+#include "utils.h"
+
+#include <llvm/ExecutionEngine/JITLink/JITLink.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <memory>
+#include <mutex>
+
+namespace serene::jit {
+
+class PerfMapPlugin : public llvm::orc::ObjectLinkingLayer::Plugin {
+  std::mutex lock;
+  std::unique_ptr<llvm::raw_fd_ostream> os;
+
+  PerfMapPlugin(std::unique_ptr<llvm::raw_fd_ostream> os)
+      : os(std::move(os)){};
+
+  llvm::Error writeSymbols(llvm::jitlink::LinkGraph &g);
+
+public:
+  /// Open the perf map file of the current process and create the plugin.
+  static llvm::Expected<std::unique_ptr<PerfMapPlugin>> create();
+
+  void modifyPassConfig(llvm::orc::MaterializationResponsibility &mr,
+                        llvm::jitlink::LinkGraph &g,
+                        llvm::jitlink::PassConfiguration &config) override;
+
+  llvm::Error
+  notifyFailed(llvm::orc::MaterializationResponsibility &mr) override {
+    UNUSED(mr);
+    return llvm::Error::success();
+  };
+
+  llvm::Error notifyRemovingResources(llvm::orc::JITDylib &jd,
+                                      llvm::orc::ResourceKey k) override {
+    UNUSED(jd);
+    UNUSED(k);
+    return llvm::Error::success();
+  };
+
+  void notifyTransferringResources(llvm::orc::JITDylib &jd,
+                                   llvm::orc::ResourceKey dstKey,
+                                   llvm::orc::ResourceKey srcKey) override {
+    UNUSED(jd);
+    UNUSED(dstKey);
+    UNUSED(srcKey);
+  };
+};
+
+} // namespace serene::jit
+
+#endif
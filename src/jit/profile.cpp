@@ -0,0 +1,306 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jit/profile.h"
+
+#include "jit/jit.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/ProfileSummary.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ToolOutputFile.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace serene::jit {
+
+/// Return the conditional branches of the given function \p f in the order
+/// that their counters appear in the profile.
+static llvm::SmallVector<llvm::BranchInst *, 8>
+getConditionalBranches(llvm::Function &f) {
+  llvm::SmallVector<llvm::BranchInst *, 8> branches;
+
+  for (auto &bb : f) {
+    auto *br = llvm::dyn_cast<llvm::BranchInst>(bb.getTerminator());
+    if (br != nullptr && br->isConditional()) {
+      branches.push_back(br);
+    }
+  }
+
+  return branches;
+};
+
+/// Return the name of the given function \p f in the profile. The functions
+/// with local linkage of different modules might have the same name, so
+/// they get qualified by the source file of their module.
+static std::string getProfileName(const llvm::Function &f) {
+  if (!f.hasLocalLinkage()) {
+    return f.getName().str();
+  }
+
+  return llvm::formatv("{0}:{1}", f.getParent()->getSourceFileName(),
+                       f.getName())
+      .str();
+};
+
+// ============================================================================
+// Profile
+// ============================================================================
+void Profile::add(llvm::StringRef name, llvm::ArrayRef<uint64_t> counts) {
+  auto &existing = functions[name];
+
+  if (existing.size() != counts.size()) {
+    existing.assign(counts.begin(), counts.end());
+    return;
+  }
+
+  for (size_t i = 0; i < counts.size(); i++) {
+    existing[i] += counts[i];
+  }
+};
+
+llvm::ArrayRef<uint64_t> Profile::lookup(llvm::StringRef name) const {
+  auto i = functions.find(name);
+  if (i == functions.end()) {
+    return {};
+  }
+
+  return i->second;
+};
+
+void Profile::apply(llvm::Module &m) const {
+  llvm::InstrProfSummaryBuilder summary(
+      llvm::ProfileSummaryBuilder::DefaultCutoffs);
+  llvm::MDBuilder mdb(m.getContext());
+  bool applied = false;
+
+  for (auto &f : m) {
+    if (f.isDeclaration()) {
+      continue;
+    }
+
+    auto counts = lookup(getProfileName(f));
+    if (counts.empty()) {
+      continue;
+    }
+
+    auto branches = getConditionalBranches(f);
+    if (counts.size() != 1 + 2 * branches.size()) {
+      JIT_LOG("The profile of '" << getProfileName(f)
+                                 << "' is stale, ignoring it");
+      continue;
+    }
+
+    f.setEntryCount(
+        llvm::Function::ProfileCount(counts[0], llvm::Function::PCT_Real));
+    // Just like ours, the first count of a record is the entry count
+    summary.addRecord(llvm::InstrProfRecord(counts.vec()));
+
+    for (size_t i = 0; i < branches.size(); i++) {
+      uint64_t taken    = counts[1 + 2 * i];
+      uint64_t notTaken = counts[2 + 2 * i];
+
+      // Branch weights are 32 bits, only their ratio matters though
+      uint64_t scale = std::max(taken, notTaken) /
+                           std::numeric_limits<uint32_t>::max() +
+                       1;
+
+      branches[i]->setMetadata(
+          llvm::LLVMContext::MD_prof,
+          mdb.createBranchWeights(static_cast<uint32_t>(taken / scale),
+                                  static_cast<uint32_t>(notTaken / scale)));
+    }
+
+    applied = true;
+  }
+
+  // Without a summary, the profile summary analysis considers nothing hot
+  if (applied) {
+    m.setProfileSummary(summary.getSummary()->getMD(m.getContext()),
+                        llvm::ProfileSummary::PSK_Instr);
+  }
+};
+
+llvm::Expected<Profile> Profile::read(llvm::StringRef path) {
+  auto buf = llvm::MemoryBuffer::getFile(path, /*IsText=*/true);
+  if (!buf) {
+    return llvm::make_error<llvm::StringError>(
+        llvm::formatv("Can't read the profile '{0}'", path), buf.getError());
+  }
+
+  auto root = llvm::json::parse((*buf)->getBuffer());
+  if (!root) {
+    return root.takeError();
+  }
+
+  auto invalid = [&]() {
+    return llvm::make_error<llvm::StringError>(
+        llvm::formatv("'{0}' is not a valid profile", path),
+        llvm::inconvertibleErrorCode());
+  };
+
+  const auto *obj = root->getAsObject();
+  if (obj == nullptr) {
+    return invalid();
+  }
+
+  auto version = obj->getInteger("version");
+  if (!version || *version != FORMAT_VERSION) {
+    return invalid();
+  }
+
+  const auto *fns = obj->getObject("functions");
+  if (fns == nullptr) {
+    return invalid();
+  }
+
+  Profile profile;
+  std::vector<uint64_t> counts;
+
+  for (const auto &[name, value] : *fns) {
+    const auto *list = value.getAsArray();
+    if (list == nullptr || list->empty() || list->size() % 2 == 0) {
+      return invalid();
+    }
+
+    counts.clear();
+    for (const auto &count : *list) {
+      auto n = count.getAsInteger();
+      if (!n || *n < 0) {
+        return invalid();
+      }
+      counts.push_back(static_cast<uint64_t>(*n));
+    }
+
+    profile.add(name.str(), counts);
+  }
+
+  return profile;
+};
+
+llvm::Error Profile::write(llvm::StringRef path) const {
+  std::error_code ec;
+  llvm::ToolOutputFile out(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    return llvm::make_error<llvm::StringError>(
+        llvm::formatv("Can't open the profile '{0}'", path), ec);
+  }
+
+  // Sort the functions to keep the output stable
+  std::vector<llvm::StringRef> names;
+  names.reserve(functions.size());
+  for (const auto &entry : functions) {
+    names.push_back(entry.getKey());
+  }
+  llvm::sort(names);
+
+  {
+    llvm::json::OStream j(out.os(), 2);
+    j.object([&] {
+      j.attribute("version", FORMAT_VERSION);
+      j.attributeObject("functions", [&] {
+        for (auto name : names) {
+          j.attributeArray(name, [&] {
+            for (auto count : functions.find(name)->second) {
+              j.value(static_cast<int64_t>(count));
+            }
+          });
+        }
+      });
+    });
+  }
+
+  out.os() << "\n";
+  out.keep();
+  return llvm::Error::success();
+};
+
+// ============================================================================
+// Profiler
+// ============================================================================
+void Profiler::instrument(llvm::Module &m) {
+  auto &ctx  = m.getContext();
+  auto *i64  = llvm::Type::getInt64Ty(ctx);
+  auto *ptrT = llvm::PointerType::getUnqual(i64);
+  auto *one  = llvm::ConstantInt::get(i64, 1);
+
+  for (auto &f : m) {
+    if (f.isDeclaration()) {
+      continue;
+    }
+
+    auto branches = getConditionalBranches(f);
+    auto size     = 1 + 2 * branches.size();
+
+    uint64_t *counts = nullptr;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      counters.push_back({getProfileName(f), size,
+                          std::make_unique<uint64_t[]>(size)});
+      counts = counters.back().counts.get();
+    }
+
+    auto *base = llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(i64, reinterpret_cast<uint64_t>(counts)), ptrT);
+
+    auto bump = [&](llvm::IRBuilder<> &builder, llvm::Value *idx) {
+      auto *slot  = builder.CreateGEP(i64, base, idx);
+      auto *count = builder.CreateLoad(i64, slot);
+      builder.CreateStore(builder.CreateAdd(count, one), slot);
+    };
+
+    llvm::IRBuilder<> builder(&*f.getEntryBlock().getFirstInsertionPt());
+    bump(builder, llvm::ConstantInt::get(i64, 0));
+
+    for (size_t i = 0; i < branches.size(); i++) {
+      auto *br = branches[i];
+      builder.SetInsertPoint(br);
+
+      auto *idx = builder.CreateSelect(
+          br->getCondition(), llvm::ConstantInt::get(i64, 1 + 2 * i),
+          llvm::ConstantInt::get(i64, 2 + 2 * i));
+      bump(builder, idx);
+    }
+  }
+};
+
+Profile Profiler::collect() const {
+  Profile profile;
+
+  std::lock_guard<std::mutex> guard(lock);
+  for (const auto &c : counters) {
+    profile.add(c.name, llvm::ArrayRef<uint64_t>(c.counts.get(), c.size));
+  }
+
+  return profile;
+};
+
+} // namespace serene::jit
@@ -0,0 +1,119 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * Profile guided optimization for the JIT and the AOT compiler. In the
+ * instrumented mode (`Options::JITProfileGenerate`) the `Profiler` adds
+ * counters to every function that goes through the JIT:
+ *  - One for the number of calls to the function.
+ *  - Two for each conditional branch, one per successor.
+ *
+ * The counters live in the memory of the `Profiler` and the JITed code bumps
+ * them directly, without any atomic operation. So the counts might be a bit
+ * off with concurrent callers, which is fine for a profile.
+ *
+ * The collected `Profile` gets written to a JSON file of the form:
+ * `{"version": 1, "functions": {"ns/fn": [calls, taken, not-taken, ...]}}`
+ * The functions with local linkage are qualified by the source file of their
+ * module, e.g. `src/foo.ll:helper`.
+ *
+ * A later run of the JIT or an AOT build (`Options::profileUse`) reads the
+ * file back and annotates the functions with their entry counts and the
+ * branches with their weights before running the optimization pipeline, so
+ * the inliner and the block placement get to see the real traffic. The
+ * profile of a function only gets applied if the function still has the
+ * same number of conditional branches.
+ */
+
+#ifndef JIT_PROFILE_H
+#define JIT_PROFILE_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Module;
+} // namespace llvm
+
+namespace serene::jit {
+
+/// The call and branch counts of a set of functions.
+class Profile {
+  /// From the name of a function to its call count followed by the counts of
+  /// the successors of its conditional branches.
+  llvm::StringMap<std::vector<uint64_t>> functions;
+
+public:
+  constexpr static int FORMAT_VERSION = 1;
+
+  /// Add the given \p counts of the function \p name to the profile. The
+  /// counts of the functions with the same shape get summed up, otherwise
+  /// the new counts replace the old ones.
+  void add(llvm::StringRef name, llvm::ArrayRef<uint64_t> counts);
+
+  /// Return the counts of the given function or an empty list.
+  llvm::ArrayRef<uint64_t> lookup(llvm::StringRef name) const;
+
+  size_t size() const { return functions.size(); };
+
+  /// Annotate the functions of \p m that are in the profile with their
+  /// entry counts and branch weights and attach the profile summary to
+  /// \p m. It has to run before any other transformation, while the
+  /// functions have the same shape as they had when they got instrumented.
+  void apply(llvm::Module &m) const;
+
+  /// Read the profile in the given file \p path.
+  static llvm::Expected<Profile> read(llvm::StringRef path);
+
+  /// Write the profile to the given file \p path.
+  llvm::Error write(llvm::StringRef path) const;
+};
+
+/// Instruments the JITed code and owns its counters.
+class Profiler {
+  struct Counters {
+    std::string name;
+    size_t size;
+    std::unique_ptr<uint64_t[]> counts;
+  };
+
+  mutable std::mutex lock;
+  /// The JITed code refers to the counters directly, so they never move
+  std::deque<Counters> counters;
+
+public:
+  /// Add the counters to all the functions defined in \p m.
+  void instrument(llvm::Module &m);
+
+  /// Return a snapshot of the counts collected so far. The counts of the
+  /// different generations of the same function get merged.
+  Profile collect() const;
+};
+
+} // namespace serene::jit
+#endif
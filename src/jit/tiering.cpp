@@ -0,0 +1,356 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jit/tiering.h"
+
+#include "jit/jit.h"
+#include "utils.h"
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include <vector>
+
+namespace serene::jit {
+
+/// Whether we should put a stub in front of the given function \p f or not
+static bool isTierable(const llvm::Function &f) {
+  return !f.isDeclaration() && !f.isIntrinsic() && !f.isVarArg() &&
+         !f.hasAvailableExternallyLinkage();
+};
+
+Tiering::Tiering(llvm::orc::LLJIT &engine,
+                 llvm::orc::JITTargetMachineBuilder jtmb, int level,
+                 uint64_t threshold)
+    : engine(engine), level(level), threshold(threshold),
+      pool(llvm::hardware_concurrency(1)) {
+  configureTargetMachine(jtmb, level);
+
+  optimizedLayer = std::make_unique<llvm::orc::IRCompileLayer>(
+      engine.getExecutionSession(), engine.getObjLinkingLayer(),
+      std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(jtmb)));
+};
+
+Tiering::~Tiering() { pool.wait(); };
+
+void Tiering::tierUpCallback(uint64_t self, uint64_t id) {
+  // NOLINTNEXTLINE(performance-no-int-to-ptr)
+  reinterpret_cast<Tiering *>(self)->requestTierUp(id);
+};
+
+void Tiering::requestTierUp(uint64_t id) {
+  pool.async([this, id] {
+    if (auto err = compile(id)) {
+      auto msg = llvm::toString(std::move(err));
+      JIT_LOG("Tier up failed: " << msg);
+    }
+  });
+};
+
+void Tiering::wait() { pool.wait(); };
+
+llvm::Error Tiering::removeDylibsOf(llvm::orc::JITDylib &jd) {
+  // Let the ongoing recompilations finish first, they might be using `jd`
+  pool.wait();
+
+  llvm::SmallVector<llvm::orc::JITDylib *, 4> dylibs;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (auto &fn : functions) {
+      if (fn.jd == &jd) {
+        fn.jd = nullptr;
+        fn.bitcode.reset();
+      }
+    }
+
+    auto i = optimizedDylibs.find(&jd);
+    if (i != optimizedDylibs.end()) {
+      dylibs = std::move(i->second);
+      optimizedDylibs.erase(i);
+    }
+  }
+
+  auto &es        = engine.getExecutionSession();
+  llvm::Error err = llvm::Error::success();
+
+  for (auto *dylib : dylibs) {
+    err = llvm::joinErrors(std::move(err), es.removeJITDylib(*dylib));
+  }
+
+  return err;
+};
+
+llvm::Expected<llvm::orc::ThreadSafeModule>
+Tiering::transform(llvm::orc::ThreadSafeModule tsm,
+                   llvm::orc::MaterializationResponsibility &r) {
+  auto err = tsm.withModuleDo([&](llvm::Module &m) -> llvm::Error {
+    llvm::SmallVector<llvm::Function *, 8> fns;
+    for (auto &f : m) {
+      if (isTierable(f)) {
+        fns.push_back(&f);
+      }
+    }
+
+    if (fns.empty()) {
+      return llvm::Error::success();
+    }
+
+    // The symbols that we add to the module are not part of the interface
+    // of the materialization unit, we have to claim them.
+    llvm::orc::MangleAndInterner mangle(r.getExecutionSession(),
+                                        m.getDataLayout());
+    llvm::orc::SymbolFlagsMap newSymbols;
+    auto claim = [&](const llvm::GlobalValue &gv) {
+      newSymbols[mangle(gv.getName())] =
+          llvm::JITSymbolFlags::fromGlobalValue(gv);
+    };
+
+    // The tier-1 code lives in a different JITDylib, so it can't reach the
+    // local symbols of this module.
+    std::vector<llvm::GlobalValue *> promoted;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      promoted = promote(m);
+    }
+
+    for (auto *gv : promoted) {
+      claim(*gv);
+    }
+
+    auto bitcode = std::make_shared<std::string>();
+    {
+      llvm::raw_string_ostream os(*bitcode);
+      llvm::WriteBitcodeToFile(m, os);
+    }
+
+    auto &ctx      = m.getContext();
+    auto &dl       = m.getDataLayout();
+    auto *i64      = llvm::Type::getInt64Ty(ctx);
+    auto *cbTy     = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx),
+                                             {i64, i64}, false);
+    auto *callback = llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(
+            i64, reinterpret_cast<uint64_t>(&Tiering::tierUpCallback)),
+        llvm::PointerType::getUnqual(cbTy));
+    auto *self =
+        llvm::ConstantInt::get(i64, reinterpret_cast<uint64_t>(this));
+
+    for (auto *f : fns) {
+      std::string name = f->getName().str();
+
+      uint64_t id = 0;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        id = functions.size();
+        functions.push_back({name, bitcode, &r.getTargetJITDylib()});
+      }
+
+      f->setName(name + ".tier0");
+
+      auto *stub = llvm::Function::Create(f->getFunctionType(),
+                                          f->getLinkage(), name, m);
+      stub->copyAttributesFrom(f);
+      f->replaceAllUsesWith(stub);
+
+      f->setLinkage(llvm::GlobalValue::ExternalLinkage);
+      f->setVisibility(llvm::GlobalValue::HiddenVisibility);
+
+      auto *slot = new llvm::GlobalVariable(
+          m, f->getType(), false, llvm::GlobalValue::ExternalLinkage, f,
+          name + ".slot");
+      slot->setVisibility(llvm::GlobalValue::HiddenVisibility);
+
+      claim(*f);
+      claim(*slot);
+
+      auto *counter = new llvm::GlobalVariable(
+          m, i64, false, llvm::GlobalValue::InternalLinkage,
+          llvm::ConstantInt::get(i64, 0), name + ".count");
+
+      auto *entry  = llvm::BasicBlock::Create(ctx, "entry", stub);
+      auto *count  = llvm::BasicBlock::Create(ctx, "count", stub);
+      auto *tierUp = llvm::BasicBlock::Create(ctx, "tier_up", stub);
+      auto *call   = llvm::BasicBlock::Create(ctx, "call", stub);
+
+      llvm::IRBuilder<> builder(entry);
+      auto *impl =
+          builder.CreateAlignedLoad(f->getType(), slot,
+                                    dl.getPointerABIAlignment(0), "impl");
+      impl->setAtomic(llvm::AtomicOrdering::Acquire);
+
+      // Once the slot points to the tier-1 code, there is nothing to count
+      builder.CreateCondBr(builder.CreateICmpEQ(impl, f), count, call);
+
+      builder.SetInsertPoint(count);
+      auto *calls = builder.CreateAtomicRMW(
+          llvm::AtomicRMWInst::Add, counter, llvm::ConstantInt::get(i64, 1),
+          llvm::MaybeAlign(8), llvm::AtomicOrdering::Monotonic);
+      // The old value hits the threshold only once
+      auto *isHot =
+          builder.CreateICmpEQ(calls, llvm::ConstantInt::get(i64, threshold));
+      builder.CreateCondBr(isHot, tierUp, call);
+
+      builder.SetInsertPoint(tierUp);
+      builder.CreateCall(cbTy, callback,
+                         {self, llvm::ConstantInt::get(i64, id)});
+      builder.CreateBr(call);
+
+      builder.SetInsertPoint(call);
+      llvm::SmallVector<llvm::Value *, 8> args;
+      for (auto &arg : stub->args()) {
+        args.push_back(&arg);
+      }
+
+      auto *result = builder.CreateCall(f->getFunctionType(), impl, args);
+      result->setCallingConv(f->getCallingConv());
+      result->setAttributes(f->getAttributes());
+      result->setTailCallKind(llvm::CallInst::TCK_Tail);
+
+      if (f->getReturnType()->isVoidTy()) {
+        builder.CreateRetVoid();
+      } else {
+        builder.CreateRet(result);
+      }
+    }
+
+    return r.defineMaterializing(std::move(newSymbols));
+  });
+
+  if (err) {
+    return std::move(err);
+  }
+
+  return std::move(tsm);
+};
+
+llvm::Error Tiering::compile(uint64_t id) {
+  TieredFunction fn;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    fn = functions[id];
+  }
+
+  if (fn.jd == nullptr) {
+    // The tier-0 code is gone
+    return llvm::Error::success();
+  }
+
+  JIT_LOG("Tiering up: " << fn.name);
+
+  auto ctx = std::make_unique<llvm::LLVMContext>();
+  std::unique_ptr<llvm::Module> m;
+
+  // Everything in this scope refers to `ctx` and has to go away before we
+  // hand the context over to the compile layer.
+  {
+    auto src = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(*fn.bitcode, fn.name), *ctx);
+
+    if (!src) {
+      return src.takeError();
+    }
+
+    auto *srcFn = (*src)->getFunction(fn.name);
+    if (srcFn == nullptr) {
+      return llvm::make_error<llvm::StringError>(
+          "Can't find the function in the bitcode",
+          llvm::inconvertibleErrorCode());
+    }
+
+    // We only need the body of the hot function. Everything else will be a
+    // declaration that resolves to the tier-0 JITDylib.
+    llvm::ValueToValueMapTy vmap;
+    m = llvm::CloneModule(**src, vmap, [&](const llvm::GlobalValue *gv) {
+      return gv == srcFn;
+    });
+  }
+
+  auto *f = m->getFunction(fn.name);
+  f->setName(fn.name + ".tier1");
+  f->setLinkage(llvm::GlobalValue::ExternalLinkage);
+
+  optimizeModule(*m, level);
+
+  auto &es = engine.getExecutionSession();
+  auto jd  = es.createJITDylib(
+      llvm::formatv("{0}.tier1.{1}", fn.jd->getName(), id).str());
+
+  if (!jd) {
+    return jd.takeError();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    optimizedDylibs[fn.jd].push_back(&*jd);
+  }
+
+  llvm::orc::JITDylibSearchOrder linkOrder;
+  linkOrder.push_back(
+      {fn.jd, llvm::orc::JITDylibLookupFlags::MatchAllSymbols});
+  fn.jd->withLinkOrderDo([&](const llvm::orc::JITDylibSearchOrder &order) {
+    linkOrder.insert(linkOrder.end(), order.begin(), order.end());
+  });
+  jd->setLinkOrder(std::move(linkOrder));
+
+  if (auto err = optimizedLayer->add(
+          *jd, llvm::orc::ThreadSafeModule(std::move(m), std::move(ctx)))) {
+    return err;
+  }
+
+  auto impl = engine.lookup(*jd, fn.name + ".tier1");
+  if (!impl) {
+    return impl.takeError();
+  }
+
+  auto slot = engine.lookup(*fn.jd, fn.name + ".slot");
+  if (!slot) {
+    return slot.takeError();
+  }
+
+  // The stubs load the slot with an acquire load
+  __atomic_store_n(slot->toPtr<void **>(), impl->toPtr<void *>(),
+                   __ATOMIC_RELEASE);
+
+  // It won't be compiled again, so the function doesn't need the bitcode
+  // anymore. It goes away with the last function of the module.
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    functions[id].bitcode.reset();
+  }
+
+  JIT_LOG("Tiered up: " << fn.name);
+  return llvm::Error::success();
+};
+
+} // namespace serene::jit
@@ -0,0 +1,146 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * Tiered compilation for the JIT. In the tiered mode every function is
+ * compiled quickly without any optimization first (tier 0) and gets
+ * recompiled with optimizations (tier 1) in the background as soon as it
+ * gets hot.
+ *
+ * To do that, each function `f` in a module that goes through the JIT gets
+ * replaced by a small stub with the same name and signature that:
+ *  - Loads the address of the current implementation of `f` from `f.slot`.
+ *  - As long as it is still the tier-0 code, bumps the call counter of `f`
+ *    (`f.count`) and asks for a tier up when the counter hits the threshold.
+ *  - Tail calls the implementation.
+ *
+ * The original body of `f` is kept as `f.tier0` and `f.slot` initially points
+ * to it. Since all the callers (including the other tier-1 functions) go
+ * through the stub, swapping the address in the slot is enough to move them
+ * all to the optimized version.
+ *
+ * The optimized version of `f` lives in its own JITDylib which links against
+ * the JITDylib of the tier-0 code, so it can reach the rest of the module.
+ */
+
+#ifndef SERENE_JIT_TIERING_H
+#define SERENE_JIT_TIERING_H
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/ThreadPool.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace llvm::orc {
+class LLJIT;
+} // namespace llvm::orc
+
+namespace serene::jit {
+
+class Tiering {
+  /// A function that has been compiled in tier 0
+  struct TieredFunction {
+    std::string name;
+    /// The bitcode of the module that contained the function before adding
+    /// the stubs. It's shared between all the functions of the module. Each
+    /// function releases it after tiering up or when the tier-0 JITDylib
+    /// goes away.
+    std::shared_ptr<const std::string> bitcode;
+    /// The JITDylib of the tier-0 code or `nullptr` if it's been removed
+    llvm::orc::JITDylib *jd;
+  };
+
+  llvm::orc::LLJIT &engine;
+
+  /// The compile layer for the tier-1 code. It sits on top of the object
+  /// linking layer of the engine but uses a target machine with a higher
+  /// codegen optimization level.
+  std::unique_ptr<llvm::orc::IRCompileLayer> optimizedLayer;
+
+  /// The optimization level of tier 1
+  int level;
+
+  /// The number of calls before a function gets recompiled
+  uint64_t threshold;
+
+  /// Guards `functions`, `optimizedDylibs` and `promote`.
+  std::mutex lock;
+
+  /// Promotes the local symbols of the modules to hidden globals. It's
+  /// shared by all the modules, so the renamed symbols of different modules
+  /// in the same JITDylib don't clash.
+  llvm::orc::SymbolLinkagePromoter promote;
+
+  /// The index of each function in this container is its ID
+  std::deque<TieredFunction> functions;
+
+  /// The JITDylibs of the tier-1 code of each tier-0 JITDylib
+  llvm::DenseMap<llvm::orc::JITDylib *,
+                 llvm::SmallVector<llvm::orc::JITDylib *, 4>>
+      optimizedDylibs;
+
+  /// Recompiling happens here
+  llvm::ThreadPool pool;
+
+  /// The entry point of the generated stubs for tier up requests.
+  static void tierUpCallback(uint64_t self, uint64_t id);
+
+  /// Compile the function with the given \p id in tier 1 and make its slot
+  /// point to the optimized version.
+  llvm::Error compile(uint64_t id);
+
+public:
+  Tiering(llvm::orc::LLJIT &engine, llvm::orc::JITTargetMachineBuilder jtmb,
+          int level, uint64_t threshold);
+  ~Tiering();
+
+  /// The IR transformation that puts the stubs in place for all of the
+  /// functions of the given module \p tsm. It is meant to be used with the
+  /// IR transform layer of the engine.
+  llvm::Expected<llvm::orc::ThreadSafeModule>
+  transform(llvm::orc::ThreadSafeModule tsm,
+            llvm::orc::MaterializationResponsibility &r);
+
+  /// Schedule the function with the given \p id to be recompiled in tier 1
+  /// in the background.
+  void requestTierUp(uint64_t id);
+
+  /// Block until all the scheduled recompilations are done.
+  void wait();
+
+  /// Remove the tier-1 JITDylibs that belong to the tier-0 JITDylib \p jd
+  /// and stop tiering up its functions. It has to be called before removing
+  /// \p jd itself.
+  llvm::Error removeDylibsOf(llvm::orc::JITDylib &jd);
+};
+
+} // namespace serene::jit
+
+#endif
@@ -22,46 +22,43 @@
 #include <mlir/IR/Diagnostics.h>
 #include <mlir/IR/Location.h>
 
+#include <cstdint>
+#include <limits>
 #include <string>
 
 namespace serene {
 
-/// It represents a location in the input string to the parser via `line`,
+/// It represents a location in the input buffer via the ID of the buffer in
+/// the `SourceMgr` and a byte offset into that buffer. It is intentionally
+/// compact (8 bytes) since every node in the AST carries two of them. The line
+/// and column of a location are resolved lazily via the `SourceMgr` whenever
+/// we need them (e.g. for diagnostics) and not during parsing.
 struct Location {
-  /// Since namespaces are our unit of compilation, we need to have
-  /// a namespace in hand
-  llvm::StringRef ns;
+  /// Any offset equal to this value means that we don't know the location
+  constexpr static uint32_t UnknownOffset =
+      std::numeric_limits<uint32_t>::max();
 
-  std::optional<llvm::StringRef> filename = std::nullopt;
-  /// A pointer to the character that this location is pointing to
-  /// it the input buffer
-  const char *c = nullptr;
+  /// The ID of the source buffer in the `SourceMgr` that this location
+  /// belongs to. `0` means that the input is not managed by any `SourceMgr`
+  /// (for example an input string passed to the reader directly).
+  uint32_t bufferId = 0;
 
-  /// At this stage we only support 65535 lines of code in each file
-  unsigned short int line = 0;
-  /// At this stage we only support 65535 chars in each line
-  unsigned short int col = 0;
-
-  bool knownLocation = true;
+  /// The offset of the character that this location is pointing to in the
+  /// input buffer. Buffers bigger than 4GB are not supported.
+  uint32_t offset = UnknownOffset;
 
   ::std::string toString() const;
 
   Location() = default;
-  explicit Location(llvm::StringRef ns,
-                    std::optional<llvm::StringRef> fname = std::nullopt,
-                    const char *c = nullptr, unsigned short int line = 0,
-                    unsigned short int col = 0, bool knownLocation = true)
-      : ns(ns), filename(fname), c(c), line(line), col(col),
-        knownLocation(knownLocation){};
+  explicit Location(uint32_t bufferId, uint32_t offset = UnknownOffset)
+      : bufferId(bufferId), offset(offset){};
 
-  Location clone() const;
+  bool isKnownLocation() const { return offset != UnknownOffset; };
 
   // mlir::Location toMLIRLocation(mlir::MLIRContext &ctx);
 
-  /// Returns an unknown location for the given \p ns.
-  static Location UnknownLocation(llvm::StringRef ns) {
-    return Location(ns, std::nullopt, nullptr, 0, 0, false);
-  }
+  /// Returns an unknown location.
+  static Location UnknownLocation() { return Location(); }
 
   ~Location() = default;
 };
@@ -74,23 +71,18 @@ public:
   LocationRange() = default;
   explicit LocationRange(Location _start) : start(_start), end(_start){};
   LocationRange(Location _start, Location _end) : start(_start), end(_end){};
-  // LocationRange(const LocationRange &);
 
-  LocationRange(LocationRange &lr) : start(lr.start), end(lr.end){};
+  LocationRange(const LocationRange &lr)            = default;
+  LocationRange &operator=(const LocationRange &lr) = default;
 
-  LocationRange(const LocationRange &lr) : start(lr.start), end(lr.end){};
+  bool isKnownLocation() const { return start.isKnownLocation(); };
 
-  bool isKnownLocation() const { return start.knownLocation; };
-
-  static LocationRange UnknownLocation(llvm::StringRef ns) {
-    return LocationRange(Location::UnknownLocation(ns));
+  static LocationRange UnknownLocation() {
+    return LocationRange(Location::UnknownLocation());
   }
 
   ~LocationRange() = default;
 };
 
-void incLocation(Location &, const char *);
-void decLocation(Location &, const char *);
-
 } // namespace serene
 #endif
@@ -21,6 +21,9 @@
 
 #include <llvm/TargetParser/Triple.h> // for Triple
 
+#include <cstdint>
+#include <string>
+
 namespace serene {
 /// This enum describes the different operational phases for the compiler
 /// in order. Anything below `NoOptimization` is considered only for debugging
@@ -37,6 +40,12 @@ enum class CompilationPhase {
   O3,
 };
 
+/// The formats that we can print the instrumentation report in.
+enum class InstrumentationFormat {
+  Tree,
+  JSON,
+};
+
 /// Options describes the compiler options that can be passed to the
 /// compiler via command line. Anything that user should be able to
 /// tweak about the compiler has to end up here regardless of the
@@ -48,12 +57,60 @@ struct Options {
   /// Whether to use colors for the output or not
   bool withColors = true;
 
+  /// Whether to collect and report the time of each phase of the compiler
+  /// and some counters (look at `Instrumentation`) or not
+  bool instrument                             = false;
+  InstrumentationFormat instrumentationFormat = InstrumentationFormat::Tree;
+
   // JIT related flags
   bool JITenableObjectCache              = true;
   bool JITenableGDBNotificationListener  = true;
   bool JITenablePerfNotificationListener = true;
   bool JITLazy                           = false;
 
+  // Use JITLink instead of RuntimeDyld to link the JITed code. With JITLink
+  // the code of all the modules gets allocated from shared slabs instead of
+  // separate pages for each module.
+  bool JITUseJITLink = false;
+  // The size of the address space that each slab reserves
+  uint64_t JITLinkSlabSize = 64 * 1024 * 1024;
+  // With JITLink, write the JITed functions to the perf map of the process
+  // (`/tmp/perf-<pid>.map`) so `perf` can symbolize them. It's off by
+  // default, since every run leaves a file behind.
+  bool JITPerfMap = false;
+
+  // In the tiered mode, functions get compiled without any optimization
+  // first and the hot ones get recompiled in the background using the
+  // optimization level of `compilationPhase`.
+  bool JITTiered = false;
+  // The number of calls that makes a function hot
+  uint64_t JITTierUpThreshold = 1000;
+
+  // The number of threads to compile the code on. With `0` everything gets
+  // compiled on the thread that needs the code.
+  unsigned JITCompileThreads = 0;
+  // The number of threads to lower the namespaces of a build on, each
+  // namespace in its own LLVM context. With `0` we use one per core.
+  unsigned JITLoweringThreads = 0;
+  // In the lazy mode and with compile threads, start compiling the callees
+  // of a function as soon as the function itself gets compiled.
+  bool JITSpeculate = true;
+
+  // The directory to persist the compiled objects in. The objects will be
+  // kept only in memory if it is empty.
+  std::string JITObjectCacheDir;
+  // The maximum size of the object cache directory in bytes. Older objects
+  // get evicted when the cache grows beyond this size. `0` means no limit.
+  uint64_t JITObjectCacheMaxSize = 0;
+
+  // Instrument the JITed code to count the calls to the functions and the
+  // branches that they take, and write the profile to this file via
+  // `JIT::writeProfile`. No instrumentation if it is empty.
+  std::string JITProfileGenerate;
+  // The profile to optimize the code with, both in the JIT and in the AOT
+  // compiler. It is the output of `JITProfileGenerate` of a previous run.
+  std::string profileUse;
+
   // We will use this triple to generate code that will endup in the binary
   // for the target platform. If we're not cross compiling, `targetTriple`
   // will be the same as `hostTriple`.
@@ -20,6 +20,7 @@
 
 #include "errors.h"
 #include "jit/jit.h"
+#include "scanner.h"
 #include "utils.h"
 // #include "serene/exprs/expression.h"
 // #include "serene/exprs/list.h"
@@ -48,110 +49,75 @@
 
 namespace serene {
 
-// LocationRange::LocationRange(const LocationRange &loc) {
-//   start = loc.start.clone();
-//   end   = loc.end.clone();
-// }
-
 /// Return the string represenation of the location.
 std::string Location::toString() const {
-  return llvm::formatv("{0}:{1}", line, col);
-};
-
-Location Location::clone() const {
-  return Location{ns, filename, c, line, col, knownLocation};
-}
-
-/// Increase the given location by one and set the line/col value in respect to
-/// the `newline` in place.
-/// \param loc The `Location` data
-/// \param c A pointer to the current char that the location has to point to
-void incLocation(Location &loc, const char *c) {
-  // TODO: Handle the end of line with respect to the OS.
-  // increase the current position in the buffer with respect to the end
-  // of line.
-  auto newline = *c == '\n';
-
-  if (!newline) {
-    loc.col++;
-  } else {
-    loc.line++;
-    loc.col = 0;
-  }
-}
-
-/// decrease the given location by one and set the line/col value in respect to
-/// the `newline` in place.
-/// \param loc The `Location` data
-/// \param c A pointer to the current char that the location has to point to
-void decLocation(Location &loc, const char *c) {
-  // TODO: Handle the end of line with respect to the OS.
-  // increase the current position in the buffer with respect to the end
-  // of line.
-  auto newline = *c == '\n';
-
-  if (newline) {
-    loc.line = loc.line == 0 ? 0 : loc.line - 1;
-
-    // We don't move back the `col` value because we simply don't know it
-  } else {
-    loc.col = loc.col == 0 ? 0 : loc.col - 1;
+  if (!isKnownLocation()) {
+    return "<unknown>";
   }
-}
+  return llvm::formatv("{0}:@{1}", bufferId, offset);
+};
 
-Reader::Reader(llvm::StringRef buffer, llvm::StringRef ns,
-               std::optional<llvm::StringRef> filename)
-    : ns(ns), filename(filename), buf(buffer),
-      currentLocation(Location(ns, filename)) {
+Reader::Reader(ast::Arena &arena, llvm::StringRef buffer, llvm::StringRef ns,
+               unsigned bufferId)
+    : arena(arena), ns(ns), bufferId(bufferId), buf(buffer) {
 
   READER_LOG("Setting the first char of the buffer");
-  currentChar          = buf.begin() - 1;
-  currentPos           = 1;
-  currentLocation.line = 1;
-  currentLocation.col  = 1;
+  currentChar = buf.begin() - 1;
+  currentPos  = 1;
 };
 
-Reader::Reader(llvm::MemoryBufferRef buffer, llvm::StringRef ns,
-               std::optional<llvm::StringRef> filename)
-    : Reader(buffer.getBuffer(), ns, filename){};
+Reader::Reader(ast::Arena &arena, llvm::MemoryBufferRef buffer,
+               llvm::StringRef ns, unsigned bufferId)
+    : Reader(arena, buffer.getBuffer(), ns, bufferId){};
 
 Reader::~Reader() { READER_LOG("Destroying the reader"); }
 
+void Reader::seek(size_t offset) {
+  assert(offset <= buf.size() && "Can't seek beyond the end of the buffer");
+  assert(ast.empty() && "Can't seek after reading");
+
+  READER_LOG("Seeking to offset: " << offset);
+  startOffset = offset;
+  currentChar = buf.begin() + offset - 1;
+  currentPos  = offset + 1;
+};
+
 void Reader::advanceByOne() {
   currentChar++;
   currentPos++;
-  currentLocation.col++;
 
   if (*currentChar == '\n') {
     READER_LOG("Detected end of line");
+    lineOffsets.push_back(currentChar - buf.begin());
+  }
 
-    if (readEOL) {
-      currentLocation.col = 1;
-      currentLocation.line++;
-    }
+  READER_LOG("Moving to Char: " << *currentChar << " at location: "
+                                << getCurrentLocation().toString());
+};
 
-    readEOL = true;
-  } else {
-    if (readEOL) {
-      currentLocation.line++;
-      currentLocation.col = 1;
-    }
-    readEOL = false;
+void Reader::moveTo(const char *target) {
+  const char *targetEnd = target + 1;
+
+  for (const auto *nl = scanner::findNewline(currentChar + 1, targetEnd);
+       nl != targetEnd; nl = scanner::findNewline(nl + 1, targetEnd)) {
+    lineOffsets.push_back(nl - buf.begin());
   }
 
+  currentPos += target - currentChar;
+  currentChar = target;
+
   READER_LOG("Moving to Char: " << *currentChar << " at location: "
-                                << currentLocation.toString());
+                                << getCurrentLocation().toString());
 };
+
 void Reader::advance(bool skipWhitespace) {
   if (skipWhitespace) {
-    for (;;) {
-      const auto *next = currentChar + 1;
-
-      if (isspace(*next) == 0) {
-        return;
-      }
+    const auto *begin = currentChar + 1;
+    const auto *end   = scanner::skipWhitespace(begin, buf.end());
 
-      advanceByOne();
+    // Just like `nextChar` we stop at the last whitespace char
+    if (end != begin) {
+      moveTo(end - 1);
     }
   } else {
     advanceByOne();
@@ -164,69 +130,64 @@ const char *Reader::nextChar(bool skipWhitespace, unsigned count) {
     return currentChar + count;
   }
 
-  const auto *c = currentChar + 1;
-  while (isspace(*c) != 0) {
-    c++;
-  };
+  const auto *c = scanner::skipWhitespace(currentChar + 1, buf.end());
 
   READER_LOG("Next char: " << *c);
   return c;
 };
 
 bool Reader::isEndOfBuffer(const char *c) {
-  return *c == '\0' || currentPos > buf.size() ||
+  return c >= buf.end() || *c == '\0' || currentPos > buf.size() ||
          (static_cast<const int>(*c) == EOF);
 };
 
-Location Reader::getCurrentLocation() { return currentLocation.clone(); };
+Location Reader::getCurrentLocation() {
+  if (baseOffset == Location::UnknownOffset) {
+    return Location(bufferId);
+  }
+
+  return Location(bufferId, baseOffset + static_cast<uint32_t>(
+                                             currentChar - buf.begin()));
+};
 
 /// A predicate function indicating whether the given char `c` is a valid
 /// char for the starting point of a symbol or not.
 bool Reader::isValidForIdentifier(char c) {
-  switch (c) {
-  case '!':
-  case '$':
-  case '%':
-  case '&':
-  case '*':
-  case '+':
-  case '-':
-  case '.':
-  case '~':
-  case '/':
-  case ':':
-  case '<':
-  case '=':
-  case '>':
-  case '?':
-  case '@':
-  case '^':
-  case '_':
-    return true;
-  }
-
-  return std::isalnum(c) != 0;
+  return scanner::isIdentifierChar(c);
 }
 
 /// Reads a number,
 /// \param neg whether to read a negative number or not.
 ast::MaybeNode Reader::readNumber(bool neg) {
   READER_LOG("Reading a number...");
-  std::string number(neg ? "-" : "");
   bool floatNum = false;
   bool empty    = false;
 
   const auto *c = nextChar();
+  // The caller has already swallowed the '-' of a negative number, so it is
+  // the current char. The number starts from there and not its first digit
+  auto signLoc = getCurrentLocation();
   advance();
 
   LocationRange loc(getCurrentLocation());
+  if (neg) {
+    loc.start = signLoc;
+  }
 
   if (isdigit(*c) == 0) {
     return errors::make(errors::Type::InvalidDigitForNumber, loc);
   }
 
+  // The number is going to be a slice of the buffer starting from here
+  const auto *start = c;
+
+  // We convert the digits to a value as we go, so most numbers don't need
+  // a second pass over the text
+  uint64_t digits         = static_cast<uint64_t>(*c - '0');
+  unsigned fractionDigits = 0;
+  bool overflow           = false;
+
   for (;;) {
-    number += *c;
     c     = nextChar(false);
     empty = false;
 
@@ -238,6 +199,18 @@ ast::MaybeNode Reader::readNumber(bool neg) {
 
       if (*c == '.') {
         floatNum = true;
+      } else {
+        auto d = static_cast<uint64_t>(*c - '0');
+
+        if (digits > (UINT64_MAX - d) / 10) {
+          overflow = true;
+        } else {
+          digits = digits * 10 + d;
+        }
+
+        if (floatNum) {
+          fractionDigits++;
+        }
       }
 
       advance();
@@ -253,7 +226,31 @@ ast::MaybeNode Reader::readNumber(bool neg) {
   }
 
   loc.end = getCurrentLocation();
-  return ast::make<ast::Number>(loc, number, neg, floatNum);
+
+  llvm::StringRef number(start, c - start);
+
+  if (!overflow) {
+    if (!floatNum &&
+        digits <= static_cast<uint64_t>(INT64_MAX) + (neg ? 1 : 0)) {
+      auto i = neg ? static_cast<int64_t>(0 - digits)
+                   : static_cast<int64_t>(digits);
+      return ast::make<ast::Number>(arena, loc, number, neg, i);
+    }
+
+    if (floatNum) {
+      if (auto f = ast::Number::fastPathFloat(digits, fractionDigits)) {
+        return ast::make<ast::Number>(arena, loc, number, neg, neg ? -*f : *f);
+      }
+    }
+  }
+
+  // Big integers and the floats that need the slow path
+  auto *n = ast::Number::make(arena, loc, number, neg, floatNum);
+  if (n == nullptr) {
+    return errors::make(errors::Type::NumberOutOfRange, loc);
+  }
+
+  return n;
 };
 
 /// Reads a symbol. If the symbol looks like a number
@@ -289,19 +286,15 @@ ast::MaybeNode Reader::readSymbol() {
     return readNumber(false);
   }
 
-  std::string sym;
+  // The symbol is going to be a slice of the buffer starting from here
+  const auto *start = c;
   advance();
+  loc = LocationRange(getCurrentLocation());
 
-  for (;;) {
-    sym += *c;
-    c = nextChar();
-
-    if (!isEndOfBuffer(c) &&
-        ((((isspace(*c)) == 0) && this->isValidForIdentifier(*c)))) {
-      advance();
-      continue;
-    }
-    break;
+  // Jump to the last char of the identifier in one go
+  c = scanner::skipIdentifier(start + 1, buf.end());
+  if (c - 1 != currentChar) {
+    moveTo(c - 1);
   }
 
   // TODO: Make sure that the symbol has 0 or 1 '/'.
@@ -309,120 +302,272 @@ ast::MaybeNode Reader::readSymbol() {
   // TODO: Make sure that `/` is not at the start or at the end of the symbol
 
   loc.end = getCurrentLocation();
-  return ast::makeSuccessfulNode<ast::Symbol>(loc, sym, this->ns);
-};
 
-/// Reads a list recursively
-ast::MaybeNode Reader::readList() {
-  READER_LOG("Reading a list...");
+  llvm::StringRef sym(start, c - start);
+  auto [nsName, name] = ast::Symbol::split(sym, this->ns);
 
-  const auto *c = nextChar();
-  LocationRange loc(getCurrentLocation());
-  advance();
+  // The same symbols show up over and over in a namespace, so we intern
+  // each spelling once instead of building its fully qualified name and
+  // locking the symbol table for every occurrence of it
+  auto &id = symbolIDs[sym];
+  if (id == InvalidSymbolID) {
+    id = internSymbol(nsName, name);
+  }
 
-  auto list = ast::makeAndCast<ast::List>(loc);
+  return ast::makeSuccessfulNode<ast::Symbol>(arena, loc, name, nsName, id);
+};
 
-  // TODO: Replace the assert with an actual check.
-  assert(*c == '(');
+/// Reads an expression. Instead of recursing into the nested lists, we keep
+/// the lists that are still open on an explicit stack, so the depth of the
+/// nesting is only limited by `maxDepth` and not the call stack.
+ast::MaybeNode Reader::readExpr() {
+  stack.clear();
+
+  for (;;) {
+    const auto *c = nextChar(true);
 
-  bool list_terminated = false;
+    READER_LOG("Read char at `readExpr`: " << *c);
 
-  do {
-    const auto *ch = nextChar(true);
+    if (isEndOfBuffer(c)) {
+      if (stack.empty()) {
+        return ast::EmptyNode;
+      }
 
-    if (isEndOfBuffer(ch)) {
       advance(true);
       advance();
+      auto *list         = stack.back();
       list->location.end = getCurrentLocation();
       return errors::make(errors::Type::EOFWhileScaningAList, list->location);
     }
 
-    switch (*ch) {
-    case ')':
+    ast::Node node = nullptr;
+
+    switch (*c) {
+    case '(': {
+      READER_LOG("Reading a list...");
       advance(true);
       advance();
-      list_terminated    = true;
-      list->location.end = getCurrentLocation();
-      break;
+      LocationRange loc(getCurrentLocation());
 
-    default:
+      if (stack.size() >= maxDepth) {
+        return errors::make(errors::Type::TooDeepNesting, loc,
+                            "The limit is {0} nested lists.", maxDepth);
+      }
+
+      stack.push_back(ast::makeAndCast<ast::List>(arena, loc));
+      continue;
+    }
+
+    case ')': {
+      if (!stack.empty()) {
+        advance(true);
+        advance();
+        node               = stack.pop_back_val();
+        node->location.end = getCurrentLocation();
+        break;
+      }
+
+      // An extra ')', the symbol reader will complain about it
+      [[fallthrough]];
+    }
+
+    default: {
       advance(true);
-      auto expr = readExpr();
+      auto expr = readSymbol();
       if (!expr) {
         return expr;
       }
-
-      list->append(*expr);
+      node = *expr;
+    }
     }
 
-  } while (!list_terminated);
+    if (stack.empty()) {
+      return node;
+    }
 
-  return list;
+    stack.back()->append(node);
+  }
 };
 
-/// Reads an expression by dispatching to the proper reader function.
-ast::MaybeNode Reader::readExpr() {
+/// Reads the next top level expression in the reader's buffer.
+ast::MaybeNode Reader::next() {
   const auto *c = nextChar(true);
 
-  READER_LOG("Read char at `readExpr`: " << *c);
-
   if (isEndOfBuffer(c)) {
-    return ast::EmptyNode;
-  }
-
-  switch (*c) {
-  case '(': {
+    // Walk through the trailing whitespace as well to complete the
+    // line offsets
     advance(true);
-    return readList();
+    scannedWholeBuffer = startOffset == 0 && currentChar + 1 >= buf.end();
+    return ast::EmptyNode;
   }
 
-  default:
-    advance(true);
-    return readSymbol();
-  }
+  advance(true);
+  return readExpr();
 };
 
 /// Reads all the expressions in the reader's buffer as an AST.
 /// Each expression type (from the reader perspective) has a
 /// reader function.
 ast::MaybeAst Reader::read() {
+  for (;;) {
+    auto tmp = next();
 
-  for (size_t current_pos = 0; current_pos < buf.size();) {
-    const auto *c = nextChar(true);
+    if (!tmp) {
+      return tmp.takeError();
+    }
 
-    if (isEndOfBuffer(c)) {
+    if (*tmp == nullptr) {
       break;
     }
 
-    advance(true);
+    this->ast.push_back(*tmp);
+  }
+
+  return std::move(this->ast);
+};
 
-    auto tmp = readExpr();
+StreamReader::StreamReader(ChunkFn fill, llvm::StringRef ns,
+                           unsigned bufferId, size_t chunkSize)
+    : fill(std::move(fill)), ns(ns), bufferId(bufferId),
+      chunkSize(chunkSize){};
 
-    if (tmp) {
-      if (*tmp == nullptr) {
-        break;
+StreamReader::ChunkFn StreamReader::readFile(llvm::sys::fs::file_t file) {
+  return [file](llvm::MutableArrayRef<char> chunk) {
+    return llvm::sys::fs::readNativeFile(file, chunk);
+  };
+};
+
+llvm::Error StreamReader::pull() {
+  // Move the unread part of the window to the front once the read part gets
+  // bigger than the unread part, so we move each char only a few times
+  if (begin > window.size() - begin) {
+    window.erase(window.begin(), window.begin() + begin);
+    scanned -= begin;
+    begin = 0;
+  }
+
+  auto end = window.size();
+  window.resize(end + chunkSize);
+
+  auto n = fill(llvm::MutableArrayRef<char>(window.data() + end, chunkSize));
+  if (!n) {
+    window.resize(end);
+    return n.takeError();
+  }
+
+  READER_LOG("Pulled a chunk of " << *n << " chars");
+  window.resize(end + *n);
+  endOfStream = *n == 0;
+  return llvm::Error::success();
+};
+
+void StreamReader::consume(size_t n) {
+  begin += n;
+  streamOffset += n;
+  scanned = begin;
+  depth   = 0;
+};
+
+std::optional<size_t> StreamReader::findEndOfForm() {
+  const auto *first = window.data() + begin;
+  const auto *end   = window.data() + window.size();
+  const auto *c     = window.data() + scanned;
+
+  if (first == end) {
+    return std::nullopt;
+  }
+
+  if (*first == '(') {
+    for (; c != end; c++) {
+      if (*c == '(') {
+        depth++;
+      } else if (*c == ')' && --depth == 0) {
+        return c + 1 - first;
       }
+    }
+  } else if (!scanner::isIdentifierChar(*first)) {
+    // Anything else (e.g. an extra ')') is a form of its own as far as we
+    // are concerned here. The reader will complain about it
+    return 1;
+  } else {
+    // Just like the reader, we stop at the first char that is not valid for
+    // an identifier
+    c = scanner::skipIdentifier(c == first ? c + 1 : c, end);
+    if (c != end) {
+      return c - first;
+    }
+  }
 
-      this->ast.push_back(std::move(*tmp));
+  scanned = c - window.data();
+  return std::nullopt;
+};
 
-    } else {
-      return tmp.takeError();
+ast::MaybeNode StreamReader::next() {
+  std::optional<size_t> size;
+
+  for (;;) {
+    // There is no need to keep the whitespace between the forms around
+    const auto *first = window.data() + begin;
+    const auto *end   = window.data() + window.size();
+    if (scanned == begin) {
+      consume(scanner::skipWhitespace(first, end) - first);
+    }
+
+    size = findEndOfForm();
+    if (size) {
+      break;
+    }
+
+    if (endOfStream) {
+      // Whatever is left is an incomplete form (if anything) and the reader
+      // will complain about it
+      size = window.size() - begin;
+      break;
+    }
+
+    if (auto err = pull()) {
+      return err;
     }
   }
 
-  return std::move(this->ast);
+  if (*size == 0) {
+    return ast::EmptyNode;
+  }
+
+  // The previous form is done with, unless the caller took its arena
+  if (arena) {
+    arena->reset();
+  } else {
+    arena = std::make_unique<ast::Arena>();
+  }
+
+  auto text = arena->copyString(llvm::StringRef(window.data() + begin, *size));
+
+  Reader r(*arena, text, ns, bufferId);
+  r.setMaxDepth(maxDepth);
+
+  auto fits = streamOffset + *size < Location::UnknownOffset;
+  r.setBaseOffset(fits ? static_cast<uint32_t>(streamOffset)
+                       : Location::UnknownOffset);
+
+  auto node = r.next();
+
+  // In case of an error we skip the whole form to let the caller carry on
+  // with the next form.
+  consume(node ? r.tell() : *size);
+  return node;
 };
 
-ast::MaybeAst read(const llvm::StringRef input, llvm::StringRef ns,
-                   std::optional<llvm::StringRef> filename) {
-  Reader r(input, ns, filename);
+ast::MaybeAst read(ast::Arena &arena, const llvm::StringRef input,
+                   llvm::StringRef ns, unsigned bufferId) {
+  Reader r(arena, input, ns, bufferId);
   auto ast = r.read();
   return ast;
 }
 
-ast::MaybeAst read(const llvm::MemoryBufferRef input, llvm::StringRef ns,
-                   std::optional<llvm::StringRef> filename) {
-  Reader r(input, ns, filename);
+ast::MaybeAst read(ast::Arena &arena, const llvm::MemoryBufferRef input,
+                   llvm::StringRef ns, unsigned bufferId) {
+  Reader r(arena, input, ns, bufferId);
 
   auto ast = r.read();
   return ast;
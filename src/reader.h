@@ -29,9 +29,16 @@
  * can't go back. In order to look ahead in the buffer without moving in the
  * buffer we use the `nextChar` method.
  *
- * We have dedicated methods to read different forms like `list`, `symbol`
- * `number` and etc. Each of them return a `MaybeNode` that in the success
- * case contains the node and an `Error` on the failure case.
+ * We have dedicated methods to read different forms like `symbol`, `number`
+ * and etc. Each of them return a `MaybeNode` that in the success case
+ * contains the node and an `Error` on the failure case. Lists are read by
+ * `readExpr` itself without recursion, using an explicit stack of the open
+ * lists, so deeply nested inputs can't overflow the call stack.
+ *
+ * Instead of reading the whole input at once via `read`, we can pull the top
+ * level forms one at a time via `next`. For the inputs that we can't (or
+ * don't want to) hold in memory at once, like pipes or huge data files,
+ * `StreamReader` does the same over a stream of chunks.
  */
 
 #ifndef READER_H
@@ -40,9 +47,19 @@
 #include "ast/ast.h"
 #include "location.h"
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/MemoryBufferRef.h>
 
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
 #define READER_LOG(...)                  \
   DEBUG_WITH_TYPE("READER", llvm::dbgs() \
                                 << "[READER]: " << __VA_ARGS__ << "\n");
@@ -54,9 +71,19 @@ class JIT;
 
 /// Base reader class which reads from a string directly.
 class Reader {
+public:
+  constexpr static size_t DEFAULT_MAX_DEPTH = 1024 * 1024;
+
 private:
+  /// The arena to allocate all the nodes from. The arena has to outlive
+  /// the AST that the reader creates.
+  ast::Arena &arena;
+
   llvm::StringRef ns;
-  std::optional<llvm::StringRef> filename;
+
+  /// The ID of the buffer in the `SourceMgr` that we're reading from. It will
+  /// be used in the locations of the nodes.
+  unsigned bufferId;
 
   const char *currentChar = nullptr;
 
@@ -66,11 +93,26 @@ private:
   /// buffer since the buffer might not be null terminated
   size_t currentPos = static_cast<size_t>(-1);
 
-  Location currentLocation;
+  /// The offsets of all the '\n' chars that the reader has stepped on so far
+  /// in ascending order. We collect them while skipping whitespace, so the
+  /// source manager doesn't need to scan the buffer again to build its line
+  /// index.
+  std::vector<size_t> lineOffsets;
+
+  /// Whether the reader has walked through the entire buffer or not. The
+  /// `lineOffsets` is only complete if this is true.
+  bool scannedWholeBuffer = false;
+
+  /// The offset of the buffer that the reader started reading from. Anything
+  /// other than `0` means that the `lineOffsets` are partial.
+  size_t startOffset = 0;
 
-  bool readEOL = false;
+  /// The offset of `buf` in the original input that we will add to the
+  /// offset of all the locations. It is useful when `buf` is only a slice of
+  /// the input (look at `StreamReader`).
+  uint32_t baseOffset = 0;
 
-  /// Returns a clone of the current location
+  /// Returns the location of the current char
   Location getCurrentLocation();
   /// Returns the next character from the stream.
   /// @param skip_whitespace An indicator to whether skip white space like chars
@@ -78,6 +120,10 @@ private:
   void advance(bool skipWhitespace = false);
   void advanceByOne();
 
+  /// Move the current char forward to the given \p target in one go and
+  /// update the line offsets accordingly.
+  void moveTo(const char *target);
+
   const char *nextChar(bool skipWhitespace = false, unsigned count = 1);
 
   /// Returns a boolean indicating whether the given input character is valid
@@ -87,34 +133,172 @@ private:
   // The property to store the ast tree
   ast::Ast ast;
 
+  /// The lists that we're reading at the moment, from the outermost to the
+  /// innermost one. We keep it around to reuse its storage for the next
+  /// forms.
+  llvm::SmallVector<ast::List *, 32> stack;
+
+  /// The maximum number of nested lists that we read before giving up.
+  size_t maxDepth = DEFAULT_MAX_DEPTH;
+
+  /// The IDs of the symbols that we have read so far by their spelling in
+  /// the buffer.
+  llvm::StringMap<SymbolID> symbolIDs;
+
   ast::MaybeNode readSymbol();
   ast::MaybeNode readNumber(bool);
-  ast::MaybeNode readList();
   ast::MaybeNode readExpr();
 
   bool isEndOfBuffer(const char *);
 
 public:
-  Reader(llvm::StringRef buf, llvm::StringRef ns,
-         std::optional<llvm::StringRef> filename);
-  Reader(llvm::MemoryBufferRef buf, llvm::StringRef ns,
-         std::optional<llvm::StringRef> filename);
+  /// Create a reader for the given \p buf that reads the forms of namespace
+  /// \p ns. \p bufferId is the ID of the buffer in the `SourceMgr` (if
+  /// any) which will be used in the locations of the nodes.
+  Reader(ast::Arena &arena, llvm::StringRef buf, llvm::StringRef ns,
+         unsigned bufferId = 0);
+  Reader(ast::Arena &arena, llvm::MemoryBufferRef buf, llvm::StringRef ns,
+         unsigned bufferId = 0);
 
   // void setInput(const llvm::StringRef string);
 
+  /// Start reading from the given \p offset of the buffer instead of its
+  /// beginning. The locations of the nodes are still relative to the
+  /// beginning of the buffer. It is useful to re-read a part of a buffer
+  /// (e.g. a few top level forms) without walking through the rest of it.
+  /// \p offset has to point to a char between two top level forms.
+  void seek(size_t offset);
+
+  /// Set the offset of the buffer in the original input to \p offset. The
+  /// locations of the nodes will be relative to the beginning of the
+  /// original input from now on. `Location::UnknownOffset` results in
+  /// unknown locations.
+  void setBaseOffset(uint32_t offset) { baseOffset = offset; };
+
+  /// Set the maximum number of nested lists that the reader accepts to
+  /// \p depth. Deeper lists result in a `TooDeepNesting` error.
+  void setMaxDepth(size_t depth) { maxDepth = depth; };
+
+  /// Return the offset of the first char of the buffer that is not read yet.
+  size_t tell() const { return currentChar + 1 - buf.begin(); };
+
+  /// Read the next top level form of the input and return it, or
+  /// `ast::EmptyNode` if there is nothing left to read. Unlike `read`, it
+  /// doesn't keep the forms around, so the caller can process the forms one
+  /// at a time while reading the rest of the input.
+  ast::MaybeNode next();
+
   /// Parses the the input and creates a possible AST out of it or errors
   /// otherwise.
   ast::MaybeAst read();
 
+  /// Return the offsets of all the newlines in the buffer only if the
+  /// reader managed to scan the entire buffer.
+  std::optional<llvm::ArrayRef<size_t>> getLineOffsets() const {
+    if (!scannedWholeBuffer) {
+      return std::nullopt;
+    }
+    return llvm::ArrayRef<size_t>(lineOffsets);
+  };
+
   ~Reader();
 };
 
+/// A reader that pulls its input from a stream (e.g. a pipe or a huge file)
+/// one chunk at a time and reads one top level form at a time via `next`.
+///
+/// It keeps a window of the input that is not read yet, and as soon as the
+/// window contains a complete top level form, it copies the form into its own
+/// arena (since the nodes are slices of the input) and reads it with a
+/// `Reader`. The arena gets recycled on each call to `next`, so the memory
+/// usage is bounded by the biggest top level form of the input and not the
+/// size of the input. A caller that needs a form to outlive the next call
+/// can take the arena of it via `takeArena`.
+///
+/// The offsets of the locations are relative to the beginning of the stream.
+/// Since the locations are 32-bit, the forms beyond the first 4GB of the
+/// stream get unknown locations.
+class StreamReader {
+public:
+  /// A function that fills the given buffer with the next chunk of the input
+  /// and returns the number of chars that it wrote. `0` means that we
+  /// reached the end of the input.
+  using ChunkFn =
+      std::function<llvm::Expected<size_t>(llvm::MutableArrayRef<char>)>;
+
+  constexpr static size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+  /// Create a stream reader that reads the forms of namespace \p ns from the
+  /// chunks that \p fill provides. \p bufferId will be used in the
+  /// locations of the nodes.
+  StreamReader(ChunkFn fill, llvm::StringRef ns, unsigned bufferId = 0,
+               size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+  /// Return a `ChunkFn` that reads the chunks from the given \p file (e.g.
+  /// `llvm::sys::fs::getStdinHandle()`). It doesn't take the ownership of
+  /// \p file.
+  static ChunkFn readFile(llvm::sys::fs::file_t file);
+
+  /// Set the maximum number of nested lists that the reader accepts to
+  /// \p depth (look at `Reader::setMaxDepth`).
+  void setMaxDepth(size_t depth) { maxDepth = depth; };
+
+  /// Read the next top level form of the stream and return it, or
+  /// `ast::EmptyNode` at the end of the stream. It only pulls as many chunks
+  /// as it needs to complete the form.
+  ///
+  /// The form lives in the arena of the stream and it is valid until the
+  /// next call to `next` unless the caller takes the arena via `takeArena`.
+  ast::MaybeNode next();
+
+  /// Hand over the arena that holds the last form that `next` returned to
+  /// the caller. The stream starts a new arena for the next form.
+  std::unique_ptr<ast::Arena> takeArena() { return std::move(arena); };
+
+private:
+  /// The arena of the current form. We reset it for each form instead of
+  /// allocating a new one, to reuse its first slab.
+  std::unique_ptr<ast::Arena> arena;
+  ChunkFn fill;
+  llvm::StringRef ns;
+  unsigned bufferId;
+  size_t chunkSize;
+  size_t maxDepth = Reader::DEFAULT_MAX_DEPTH;
+
+  /// The input that we pulled from the stream so far. Everything before
+  /// `begin` is read already.
+  std::vector<char> window;
+  size_t begin = 0;
+
+  /// The offset of `begin` in the stream.
+  uint64_t streamOffset = 0;
+
+  /// How far we have scanned the form at the beginning of the window for its
+  /// end, and the depth of the parens at that point. We keep them around so
+  /// we don't scan a long form again after pulling each chunk.
+  size_t scanned = 0;
+  size_t depth   = 0;
+
+  bool endOfStream = false;
+
+  /// Pull the next chunk of the stream into the window.
+  llvm::Error pull();
+
+  /// Drop the first \p n chars of the window.
+  void consume(size_t n);
+
+  /// Return the size of the form at the beginning of the window if the whole
+  /// form is in the window or `std::nullopt` otherwise.
+  std::optional<size_t> findEndOfForm();
+};
+
 /// Parses the given `input` string and returns a `Result<ast>`
-/// which may contains an AST or an `llvm::Error`
-ast::MaybeAst read(llvm::StringRef input, llvm::StringRef ns,
-                   std::optional<llvm::StringRef> filename);
-ast::MaybeAst read(llvm::MemoryBufferRef input, llvm::StringRef ns,
-                   std::optional<llvm::StringRef> filename);
+/// which may contains an AST or an `llvm::Error`. All the nodes of the
+/// AST will be allocated from the given \p arena.
+ast::MaybeAst read(ast::Arena &arena, llvm::StringRef input,
+                   llvm::StringRef ns, unsigned bufferId = 0);
+ast::MaybeAst read(ast::Arena &arena, llvm::MemoryBufferRef input,
+                   llvm::StringRef ns, unsigned bufferId = 0);
 
 } // namespace serene
 #endif
@@ -0,0 +1,827 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "runtime/collections.h"
+
+#include "runtime/gc.h"
+
+#include <llvm/ADT/bit.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace serene::runtime {
+
+namespace {
+constexpr uint32_t BITS      = 5;
+constexpr uint32_t WIDTH     = 1U << BITS;
+constexpr uint32_t MASK      = WIDTH - 1;
+constexpr uint32_t HASH_BITS = 32;
+} // namespace
+
+struct VectorNode {
+  /// The transient that owns this node, if any
+  Edit *edit;
+
+  /// The leaves hold the elements and the rest of the nodes the children
+  union {
+    VectorNode *children[WIDTH];
+    Value values[WIDTH];
+  };
+};
+
+/// The slots of the node come right after it. They hold the key value pairs
+/// of the inline entries followed by the pointers to the subnodes. Collision
+/// nodes only hold the key value pairs of the keys with the same hash.
+struct MapNode {
+  /// The transient that owns this node, if any
+  Edit *edit;
+  uint32_t dataMap;
+  uint32_t nodeMap;
+  /// The number of the entries of a collision node, `0` for the rest
+  uint32_t collisions;
+  /// The number of slots that the node has room for. The nodes of the
+  /// transients get some spare room, so they can grow in place.
+  uint32_t capacity;
+};
+
+/// Whether the transient \p edit can mutate a node owned by \p owner.
+static bool owns(const Edit *edit, const Edit *owner) {
+  return edit != nullptr && edit == owner && edit->live;
+};
+
+static Edit *newEdit() {
+  auto *edit = static_cast<Edit *>(allocScanned(sizeof(Edit)));
+  edit->live = true;
+  return edit;
+};
+
+// ============================================================================
+// Hashing
+// ============================================================================
+/// The finalizer of MurmurHash3, it spreads the bits of \p x
+static uint32_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return static_cast<uint32_t>(x);
+};
+
+uint32_t hashValue(Value v) {
+  if (isNil(v) || !isPointer(v)) {
+    return mix(v);
+  }
+
+  const auto *o = toObject(v);
+
+  if (o->type == &string_type) {
+    const auto *s = reinterpret_cast<const String *>(o);
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned int i = 0; i < s->len; i++) {
+      h = (h ^ static_cast<unsigned char>(s->data[i])) * 0x100000001b3ULL;
+    }
+    return mix(h);
+  }
+
+  if (o->type == &number_type) {
+    const auto *n = reinterpret_cast<const Number *>(o);
+    return mix(static_cast<uint64_t>(n->data));
+  }
+
+  if (o->type == &float_type) {
+    double f = reinterpret_cast<const Float *>(o)->data;
+    // `0.0` and `-0.0` are equal, so they need the same hash
+    if (f == 0) {
+      f = 0;
+    }
+    return mix(llvm::bit_cast<uint64_t>(f));
+  }
+
+  return mix(v);
+};
+
+bool equalValues(Value a, Value b) {
+  if (a == b) {
+    return true;
+  }
+
+  if (isNil(a) || isNil(b) || !isPointer(a) || !isPointer(b)) {
+    return false;
+  }
+
+  const auto *x = toObject(a);
+  const auto *y = toObject(b);
+
+  if (x->type != y->type) {
+    return false;
+  }
+
+  if (x->type == &string_type) {
+    const auto *s1 = reinterpret_cast<const String *>(x);
+    const auto *s2 = reinterpret_cast<const String *>(y);
+    return s1->len == s2->len && std::memcmp(s1->data, s2->data, s1->len) == 0;
+  }
+
+  if (x->type == &number_type) {
+    return reinterpret_cast<const Number *>(x)->data ==
+           reinterpret_cast<const Number *>(y)->data;
+  }
+
+  if (x->type == &float_type) {
+    return reinterpret_cast<const Float *>(x)->data ==
+           reinterpret_cast<const Float *>(y)->data;
+  }
+
+  return false;
+};
+
+// ============================================================================
+// Vector
+// ============================================================================
+static VectorNode *newVectorNode(Edit *edit) {
+  auto *node = static_cast<VectorNode *>(allocScanned(sizeof(VectorNode)));
+  node->edit = edit;
+  return node;
+};
+
+/// Return \p node itself if the transient \p edit owns it, otherwise a copy
+/// of it owned by \p edit.
+static VectorNode *editable(VectorNode *node, Edit *edit) {
+  if (owns(edit, node->edit)) {
+    return node;
+  }
+
+  auto *copy = newVectorNode(edit);
+  std::memcpy(copy->values, node->values, sizeof(copy->values));
+  return copy;
+};
+
+static Vector *copyVector(const Vector *v, Edit *edit) {
+  auto *copy = static_cast<Vector *>(allocScanned(sizeof(Vector)));
+  std::memcpy(copy, v, sizeof(Vector));
+  copy->edit = edit;
+  return copy;
+};
+
+/// Return the index of the first element in the tail of \p v
+static uint32_t tailOffset(const Vector *v) {
+  return v->count < WIDTH ? 0 : ((v->count - 1) >> BITS) << BITS;
+};
+
+/// Create a path of nodes from \p level down to \p node.
+static VectorNode *newPath(uint32_t level, VectorNode *node, Edit *edit) {
+  for (; level > 0; level -= BITS) {
+    auto *parent        = newVectorNode(edit);
+    parent->children[0] = node;
+    node                = parent;
+  }
+
+  return node;
+};
+
+/// Return a version of \p parent at \p level that contains the full \p tail
+/// of a vector with \p count elements.
+static VectorNode *pushTail(uint32_t count, uint32_t level, VectorNode *parent,
+                            VectorNode *tail, Edit *edit) {
+  auto *ret   = editable(parent, edit);
+  auto subidx = ((count - 1) >> level) & MASK;
+
+  VectorNode *node = nullptr;
+
+  if (level == BITS) {
+    node = tail;
+  } else if (auto *child = parent->children[subidx]) {
+    node = pushTail(count, level - BITS, child, tail, edit);
+  } else {
+    node = newPath(level - BITS, tail, edit);
+  }
+
+  ret->children[subidx] = node;
+  return ret;
+};
+
+static void conj(Vector *v, Value x, Edit *edit) {
+  auto tailSize = v->count - tailOffset(v);
+
+  if (tailSize < WIDTH) {
+    v->tail                   = editable(v->tail, edit);
+    v->tail->values[tailSize] = x;
+    v->count++;
+    return;
+  }
+
+  // The tail is full, move it to the tree
+  if ((v->count >> BITS) > (1U << v->shift)) {
+    // No more room in the tree, it needs a new root
+    auto *root        = newVectorNode(edit);
+    root->children[0] = v->root;
+    root->children[1] = newPath(v->shift, v->tail, edit);
+    v->root           = root;
+    v->shift += BITS;
+  } else {
+    v->root = pushTail(v->count, v->shift, v->root, v->tail, edit);
+  }
+
+  v->tail            = newVectorNode(edit);
+  v->tail->values[0] = x;
+  v->count++;
+};
+
+static VectorNode *assoc(uint32_t level, VectorNode *node, uint32_t i,
+                         Value x, Edit *edit) {
+  auto *ret = editable(node, edit);
+
+  if (level == 0) {
+    ret->values[i & MASK] = x;
+  } else {
+    auto subidx           = (i >> level) & MASK;
+    ret->children[subidx] = assoc(level - BITS, node->children[subidx], i, x,
+                                  edit);
+  }
+
+  return ret;
+};
+
+static void assoc(Vector *v, uint32_t i, Value x, Edit *edit) {
+  if (i == v->count) {
+    conj(v, x, edit);
+    return;
+  }
+
+  assert(i < v->count && "Index out of range");
+
+  if (i >= tailOffset(v)) {
+    v->tail                   = editable(v->tail, edit);
+    v->tail->values[i & MASK] = x;
+    return;
+  }
+
+  v->root = assoc(v->shift, v->root, i, x, edit);
+};
+
+Vector *emptyVector() {
+  auto *v        = static_cast<Vector *>(allocScanned(sizeof(Vector)));
+  v->header.type = &vector_type;
+  v->shift       = BITS;
+  v->root        = newVectorNode(nullptr);
+  v->tail        = newVectorNode(nullptr);
+  return v;
+};
+
+Value vectorNth(const Vector *v, uint32_t i) {
+  assert(i < v->count && "Index out of range");
+
+  if (i >= tailOffset(v)) {
+    return v->tail->values[i & MASK];
+  }
+
+  const VectorNode *node = v->root;
+  for (auto level = v->shift; level > 0; level -= BITS) {
+    node = node->children[(i >> level) & MASK];
+  }
+
+  return node->values[i & MASK];
+};
+
+Vector *vectorConj(const Vector *v, Value x) {
+  auto *copy = copyVector(v, nullptr);
+  conj(copy, x, nullptr);
+  return copy;
+};
+
+Vector *vectorAssoc(const Vector *v, uint32_t i, Value x) {
+  auto *copy = copyVector(v, nullptr);
+  assoc(copy, i, x, nullptr);
+  return copy;
+};
+
+Vector *transientVector(const Vector *v) { return copyVector(v, newEdit()); };
+
+Vector *transientConj(Vector *t, Value x) {
+  assert(owns(t->edit, t->edit) && "Not a transient");
+  conj(t, x, t->edit);
+  return t;
+};
+
+Vector *transientAssoc(Vector *t, uint32_t i, Value x) {
+  assert(owns(t->edit, t->edit) && "Not a transient");
+  assoc(t, i, x, t->edit);
+  return t;
+};
+
+Vector *persistentVector(Vector *t) {
+  assert(owns(t->edit, t->edit) && "Not a transient");
+  t->edit->live = false;
+  t->edit       = nullptr;
+  return t;
+};
+
+// ============================================================================
+// HashMap
+// ============================================================================
+static Value *slotsOf(MapNode *node) {
+  return reinterpret_cast<Value *>(node + 1);
+};
+
+static const Value *slotsOf(const MapNode *node) {
+  return reinterpret_cast<const Value *>(node + 1);
+};
+
+static uint32_t numData(const MapNode *node) {
+  return llvm::popcount(node->dataMap);
+};
+
+static uint32_t numNodes(const MapNode *node) {
+  return llvm::popcount(node->nodeMap);
+};
+
+static uint32_t numSlots(const MapNode *node) {
+  if (node->collisions != 0) {
+    return 2 * node->collisions;
+  }
+
+  return 2 * numData(node) + numNodes(node);
+};
+
+/// Return the bit of the given \p hash in a node at the given \p shift
+static uint32_t bitpos(uint32_t hash, uint32_t shift) {
+  return 1U << ((hash >> shift) & MASK);
+};
+
+/// Return the index of the given \p bit among the bits of \p bitmap
+static uint32_t indexOf(uint32_t bitmap, uint32_t bit) {
+  return llvm::popcount(bitmap & (bit - 1));
+};
+
+static MapNode *getChild(const MapNode *node, uint32_t j) {
+  auto child = slotsOf(node)[2 * numData(node) + j];
+  return reinterpret_cast<MapNode *>(static_cast<uintptr_t>(child));
+};
+
+static Value fromNode(const MapNode *node) {
+  return static_cast<Value>(reinterpret_cast<uintptr_t>(node));
+};
+
+/// Return the number of slots to allocate for a node of the transient
+/// \p edit (if any) with \p slots slots.
+static uint32_t roomFor(uint32_t slots, const Edit *edit) {
+  if (edit == nullptr) {
+    return slots;
+  }
+
+  return std::max<uint32_t>(4, llvm::bit_ceil(slots));
+};
+
+static MapNode *newMapNode(Edit *edit, uint32_t dataMap, uint32_t nodeMap,
+                           uint32_t collisions, uint32_t slots) {
+  auto capacity = roomFor(slots, edit);
+  auto *node    = static_cast<MapNode *>(
+      allocScanned(sizeof(MapNode) + capacity * sizeof(Value)));
+  node->edit       = edit;
+  node->dataMap    = dataMap;
+  node->nodeMap    = nodeMap;
+  node->collisions = collisions;
+  node->capacity   = capacity;
+  return node;
+};
+
+/// Return \p node itself if the transient \p edit owns it, otherwise a copy
+/// of it owned by \p edit.
+static MapNode *editable(MapNode *node, Edit *edit) {
+  if (owns(edit, node->edit)) {
+    return node;
+  }
+
+  auto slots = numSlots(node);
+  auto *copy =
+      newMapNode(edit, node->dataMap, node->nodeMap, node->collisions, slots);
+  std::memcpy(slotsOf(copy), slotsOf(node), slots * sizeof(Value));
+  return copy;
+};
+
+/// Return \p node itself if the transient \p edit owns it and it has room
+/// for \p slots slots, otherwise a new node owned by \p edit with the same
+/// bitmaps as \p node and room for \p slots slots. The slots are left to the
+/// caller to move, so the callers have to expect the result to be \p node
+/// itself and move the slots in an order that doesn't overwrite them.
+static MapNode *withRoom(MapNode *node, uint32_t slots, Edit *edit) {
+  if (owns(edit, node->edit) && node->capacity >= slots) {
+    return node;
+  }
+
+  return newMapNode(edit, node->dataMap, node->nodeMap, node->collisions,
+                    slots);
+};
+
+/// Clear the slots of \p node from \p from to \p to that are not used
+/// anymore, so the collector doesn't keep their values alive.
+static void clearSlots(MapNode *node, uint32_t from, uint32_t to) {
+  std::memset(slotsOf(node) + from, 0, (to - from) * sizeof(Value));
+};
+
+/// Return \p node with the new entry of \p key and \p val at the given
+/// \p bit. It updates \p node in place if the transient \p edit owns it.
+static MapNode *withData(MapNode *node, uint32_t bit, Value key, Value val,
+                         Edit *edit) {
+  auto idx   = 2 * indexOf(node->dataMap, bit);
+  auto slots = numSlots(node);
+  auto *ret  = withRoom(node, slots + 2, edit);
+
+  const auto *src = slotsOf(node);
+  auto *dst       = slotsOf(ret);
+
+  std::memmove(dst + idx + 2, src + idx, (slots - idx) * sizeof(Value));
+  std::memmove(dst, src, idx * sizeof(Value));
+  dst[idx]     = key;
+  dst[idx + 1] = val;
+  ret->dataMap |= bit;
+  return ret;
+};
+
+/// Return \p node without the entry at the given \p bit. It updates \p node
+/// in place if the transient \p edit owns it.
+static MapNode *withoutData(MapNode *node, uint32_t bit, Edit *edit) {
+  auto idx   = 2 * indexOf(node->dataMap, bit);
+  auto slots = numSlots(node);
+  auto *ret  = withRoom(node, slots - 2, edit);
+
+  const auto *src = slotsOf(node);
+  auto *dst       = slotsOf(ret);
+
+  std::memmove(dst, src, idx * sizeof(Value));
+  std::memmove(dst + idx, src + idx + 2, (slots - idx - 2) * sizeof(Value));
+
+  if (ret == node) {
+    clearSlots(ret, slots - 2, slots);
+  }
+
+  ret->dataMap &= ~bit;
+  return ret;
+};
+
+/// Return \p node in which the entry at the given \p bit is replaced by the
+/// subnode \p child. It updates \p node in place if the transient \p edit
+/// owns it.
+static MapNode *dataToNode(MapNode *node, uint32_t bit, MapNode *child,
+                           Edit *edit) {
+  auto nodeMap = node->nodeMap | bit;
+  auto idx     = 2 * indexOf(node->dataMap, bit);
+  auto dataEnd = 2 * numData(node);
+  // In the new node, the children start two slots earlier
+  auto childIdx = dataEnd - 2 + indexOf(nodeMap, bit);
+  auto slots    = numSlots(node);
+  auto *ret     = withRoom(node, slots - 1, edit);
+
+  const auto *src = slotsOf(node);
+  auto *dst       = slotsOf(ret);
+
+  // The entries before and after the removed one, and the subnodes before
+  // the new one, and the subnodes after it. They all move to the left, so
+  // the order is safe for updating in place as well
+  std::memmove(dst, src, idx * sizeof(Value));
+  std::memmove(dst + idx, src + idx + 2, (childIdx - idx) * sizeof(Value));
+  dst[childIdx] = fromNode(child);
+  std::memmove(dst + childIdx + 1, src + childIdx + 2,
+               (slots - childIdx - 2) * sizeof(Value));
+
+  if (ret == node) {
+    clearSlots(ret, slots - 1, slots);
+  }
+
+  ret->dataMap &= ~bit;
+  ret->nodeMap = nodeMap;
+  return ret;
+};
+
+/// Return \p node in which the subnode at the given \p bit is replaced by
+/// the entry of \p key and \p val. It updates \p node in place if the
+/// transient \p edit owns it.
+static MapNode *nodeToData(MapNode *node, uint32_t bit, Value key, Value val,
+                           Edit *edit) {
+  auto dataMap  = node->dataMap | bit;
+  auto idx      = 2 * indexOf(dataMap, bit);
+  auto childIdx = 2 * numData(node) + indexOf(node->nodeMap, bit);
+  auto slots    = numSlots(node);
+  auto *ret     = withRoom(node, slots + 1, edit);
+
+  const auto *src = slotsOf(node);
+  auto *dst       = slotsOf(ret);
+
+  // The subnodes after the removed one, the rest of the entries and the
+  // subnodes before the removed one, the entries before the new one and the
+  // new one. They all move to the right, so we start from the end
+  std::memmove(dst + childIdx + 2, src + childIdx + 1,
+               (slots - childIdx - 1) * sizeof(Value));
+  std::memmove(dst + idx + 2, src + idx, (childIdx - idx) * sizeof(Value));
+  std::memmove(dst, src, idx * sizeof(Value));
+  dst[idx]     = key;
+  dst[idx + 1] = val;
+  ret->dataMap = dataMap;
+  ret->nodeMap &= ~bit;
+  return ret;
+};
+
+/// Create a node at the given \p shift that contains both of the entries.
+static MapNode *mergeTwo(Value k1, Value v1, uint32_t h1, Value k2, Value v2,
+                         uint32_t h2, uint32_t shift, Edit *edit) {
+  if (shift >= HASH_BITS) {
+    auto *node  = newMapNode(edit, 0, 0, 2, 4);
+    auto *slots = slotsOf(node);
+    slots[0]    = k1;
+    slots[1]    = v1;
+    slots[2]    = k2;
+    slots[3]    = v2;
+    return node;
+  }
+
+  auto b1 = bitpos(h1, shift);
+  auto b2 = bitpos(h2, shift);
+
+  if (b1 == b2) {
+    auto *node = newMapNode(edit, 0, b1, 0, 1);
+    slotsOf(node)[0] =
+        fromNode(mergeTwo(k1, v1, h1, k2, v2, h2, shift + BITS, edit));
+    return node;
+  }
+
+  auto *node  = newMapNode(edit, b1 | b2, 0, 0, 4);
+  auto *slots = slotsOf(node);
+  // The entries are in the order of their bits
+  auto first  = b1 < b2 ? 0 : 2;
+  auto second = 2 - first;
+
+  slots[first]      = k1;
+  slots[first + 1]  = v1;
+  slots[second]     = k2;
+  slots[second + 1] = v2;
+  return node;
+};
+
+static MapNode *assoc(MapNode *node, uint32_t shift, uint32_t hash, Value key,
+                      Value val, Edit *edit, bool &added) {
+  auto *slots = slotsOf(node);
+
+  if (node->collisions != 0) {
+    for (uint32_t i = 0; i < node->collisions; i++) {
+      if (equalValues(slots[2 * i], key)) {
+        if (slots[2 * i + 1] == val) {
+          return node;
+        }
+
+        auto *ret               = editable(node, edit);
+        slotsOf(ret)[2 * i + 1] = val;
+        return ret;
+      }
+    }
+
+    auto n    = node->collisions;
+    auto *ret = withRoom(node, 2 * (n + 1), edit);
+    std::memmove(slotsOf(ret), slots, 2 * n * sizeof(Value));
+    slotsOf(ret)[2 * n]     = key;
+    slotsOf(ret)[2 * n + 1] = val;
+    ret->collisions         = n + 1;
+    added                   = true;
+    return ret;
+  }
+
+  auto bit = bitpos(hash, shift);
+
+  if ((node->dataMap & bit) != 0) {
+    auto idx = 2 * indexOf(node->dataMap, bit);
+    auto k   = slots[idx];
+
+    if (equalValues(k, key)) {
+      if (slots[idx + 1] == val) {
+        return node;
+      }
+
+      auto *ret             = editable(node, edit);
+      slotsOf(ret)[idx + 1] = val;
+      return ret;
+    }
+
+    // Two different keys in the same slot, push both of them down
+    auto *child = mergeTwo(k, slots[idx + 1], hashValue(k), key, val, hash,
+                           shift + BITS, edit);
+    added = true;
+    return dataToNode(node, bit, child, edit);
+  }
+
+  if ((node->nodeMap & bit) != 0) {
+    auto j         = indexOf(node->nodeMap, bit);
+    auto *child    = getChild(node, j);
+    auto *newChild = assoc(child, shift + BITS, hash, key, val, edit, added);
+
+    // The child is either unchanged or mutated in place
+    if (newChild == child) {
+      return node;
+    }
+
+    auto *ret                          = editable(node, edit);
+    slotsOf(ret)[2 * numData(ret) + j] = fromNode(newChild);
+    return ret;
+  }
+
+  added = true;
+  return withData(node, bit, key, val, edit);
+};
+
+static MapNode *dissoc(MapNode *node, uint32_t shift, uint32_t hash,
+                       Value key, Edit *edit, bool &removed) {
+  auto *slots = slotsOf(node);
+
+  if (node->collisions != 0) {
+    auto n = node->collisions;
+
+    for (uint32_t i = 0; i < n; i++) {
+      if (!equalValues(slots[2 * i], key)) {
+        continue;
+      }
+
+      removed = true;
+
+      if (n == 2) {
+        // A node with a single entry, the parent inlines it
+        auto other      = 2 * (1 - i);
+        auto *ret       = withRoom(node, 2, edit);
+        auto *dst       = slotsOf(ret);
+        dst[0]          = slots[other];
+        dst[1]          = slots[other + 1];
+        ret->dataMap    = 1;
+        ret->collisions = 0;
+
+        if (ret == node) {
+          clearSlots(ret, 2, 4);
+        }
+        return ret;
+      }
+
+      auto *ret = withRoom(node, 2 * (n - 1), edit);
+      std::memmove(slotsOf(ret), slots, 2 * i * sizeof(Value));
+      std::memmove(slotsOf(ret) + 2 * i, slots + 2 * i + 2,
+                   2 * (n - i - 1) * sizeof(Value));
+
+      if (ret == node) {
+        clearSlots(ret, 2 * (n - 1), 2 * n);
+      }
+
+      ret->collisions = n - 1;
+      return ret;
+    }
+
+    return node;
+  }
+
+  auto bit = bitpos(hash, shift);
+
+  if ((node->dataMap & bit) != 0) {
+    auto idx = 2 * indexOf(node->dataMap, bit);
+    if (!equalValues(slots[idx], key)) {
+      return node;
+    }
+
+    removed = true;
+    return withoutData(node, bit, edit);
+  }
+
+  if ((node->nodeMap & bit) != 0) {
+    auto j         = indexOf(node->nodeMap, bit);
+    auto *child    = getChild(node, j);
+    auto *newChild = dissoc(child, shift + BITS, hash, key, edit, removed);
+
+    if (!removed) {
+      return node;
+    }
+
+    // Subnodes with a single entry get inlined, to keep the tree compact
+    if (newChild->collisions == 0 && newChild->nodeMap == 0 &&
+        numData(newChild) == 1) {
+      const auto *entry = slotsOf(newChild);
+      return nodeToData(node, bit, entry[0], entry[1], edit);
+    }
+
+    if (newChild == child) {
+      return node;
+    }
+
+    auto *ret                          = editable(node, edit);
+    slotsOf(ret)[2 * numData(ret) + j] = fromNode(newChild);
+    return ret;
+  }
+
+  return node;
+};
+
+static HashMap *copyMap(const HashMap *m, Edit *edit) {
+  auto *copy = static_cast<HashMap *>(allocScanned(sizeof(HashMap)));
+  std::memcpy(copy, m, sizeof(HashMap));
+  copy->edit = edit;
+  return copy;
+};
+
+static void assoc(HashMap *m, Value key, Value val, Edit *edit) {
+  bool added = false;
+  m->root    = assoc(m->root, 0, hashValue(key), key, val, edit, added);
+  m->count += added ? 1 : 0;
+};
+
+static void dissoc(HashMap *m, Value key, Edit *edit) {
+  bool removed = false;
+  m->root      = dissoc(m->root, 0, hashValue(key), key, edit, removed);
+  m->count -= removed ? 1 : 0;
+};
+
+HashMap *emptyMap() {
+  auto *m        = static_cast<HashMap *>(allocScanned(sizeof(HashMap)));
+  m->header.type = &map_type;
+  m->root        = newMapNode(nullptr, 0, 0, 0, 0);
+  return m;
+};
+
+std::optional<Value> mapGet(const HashMap *m, Value key) {
+  auto hash           = hashValue(key);
+  const MapNode *node = m->root;
+
+  for (uint32_t shift = 0;; shift += BITS) {
+    const auto *slots = slotsOf(node);
+
+    if (node->collisions != 0) {
+      for (uint32_t i = 0; i < node->collisions; i++) {
+        if (equalValues(slots[2 * i], key)) {
+          return slots[2 * i + 1];
+        }
+      }
+      return std::nullopt;
+    }
+
+    auto bit = bitpos(hash, shift);
+
+    if ((node->dataMap & bit) != 0) {
+      auto idx = 2 * indexOf(node->dataMap, bit);
+      if (equalValues(slots[idx], key)) {
+        return slots[idx + 1];
+      }
+      return std::nullopt;
+    }
+
+    if ((node->nodeMap & bit) == 0) {
+      return std::nullopt;
+    }
+
+    node = getChild(node, indexOf(node->nodeMap, bit));
+  }
+};
+
+HashMap *mapAssoc(const HashMap *m, Value key, Value val) {
+  auto *copy = copyMap(m, nullptr);
+  assoc(copy, key, val, nullptr);
+  return copy;
+};
+
+HashMap *mapDissoc(const HashMap *m, Value key) {
+  auto *copy = copyMap(m, nullptr);
+  dissoc(copy, key, nullptr);
+  return copy;
+};
+
+HashMap *transientMap(const HashMap *m) { return copyMap(m, newEdit()); };
+
+HashMap *transientMapAssoc(HashMap *t, Value key, Value val) {
+  assert(owns(t->edit, t->edit) && "Not a transient");
+  assoc(t, key, val, t->edit);
+  return t;
+};
+
+HashMap *transientMapDissoc(HashMap *t, Value key) {
+  assert(owns(t->edit, t->edit) && "Not a transient");
+  dissoc(t, key, t->edit);
+  return t;
+};
+
+HashMap *persistentMap(HashMap *t) {
+  assert(owns(t->edit, t->edit) && "Not a transient");
+  t->edit->live = false;
+  t->edit       = nullptr;
+  return t;
+};
+
+} // namespace serene::runtime
@@ -0,0 +1,149 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * The persistent collections of the runtime:
+ *
+ * - `Vector` is a 32-way trie of the elements plus a tail of up to 32
+ *   elements, so indexed access and update are O(log32 n) and appending is
+ *   amortized O(1).
+ * - `HashMap` is a hash array mapped trie (HAMT) with two bitmaps per node
+ *   (one for the inline entries and one for the subnodes), so looking up,
+ *   adding and removing a key is O(log32 n).
+ *
+ * Both of them share the structure with the previous versions, so every
+ * update only copies the nodes on the path from the root to the changed
+ * element.
+ *
+ * To build a collection in bulk, turn it into a transient via
+ * `transientVector` or `transientMap`, update it in place and turn it back
+ * into a persistent collection via `persistentVector` or `persistentMap`.
+ * A transient copies each node at most once and mutates the nodes that it
+ * owns in place afterwards. The map nodes of a transient have some spare
+ * room, so adding an entry to them grows them in place as well and they only
+ * get reallocated when they run out of room. A transient must not be used
+ * after it's turned back into a persistent collection, and it's not thread
+ * safe.
+ *
+ * All the structures are allocated from the GC heap.
+ */
+
+#ifndef SERENE_RUNTIME_COLLECTIONS_H
+#define SERENE_RUNTIME_COLLECTIONS_H
+
+#include "types.h"
+
+#include <cstdint>
+#include <optional>
+
+namespace serene::runtime {
+
+/// The owner of the nodes of a transient collection. It's live as long as
+/// the transient is not turned back into a persistent collection.
+struct Edit {
+  bool live;
+};
+
+struct VectorNode;
+struct MapNode;
+
+typedef struct {
+  Object header;
+  uint32_t count;
+  /// The number of bits to shift the index by at the root
+  uint32_t shift;
+  VectorNode *root;
+  VectorNode *tail;
+  /// `nullptr` for persistent vectors
+  Edit *edit;
+} Vector;
+
+typedef struct {
+  Object header;
+  uint32_t count;
+  MapNode *root;
+  /// `nullptr` for persistent maps
+  Edit *edit;
+} HashMap;
+
+/// Return the hash of the given value \p v. Equal values (look at
+/// `equalValues`) have the same hash.
+uint32_t hashValue(Value v);
+
+/// Whether \p a and \p b are equal. Strings and boxed numbers are compared
+/// by their content, the rest by identity.
+bool equalValues(Value a, Value b);
+
+// ============================================================================
+// Vector
+// ============================================================================
+Vector *emptyVector();
+
+/// Return the element at the given index \p i. \p i has to be in range.
+Value vectorNth(const Vector *v, uint32_t i);
+
+/// Return a new vector with \p x appended to the end of \p v.
+Vector *vectorConj(const Vector *v, Value x);
+
+/// Return a new vector in which the element at the index \p i of \p v is
+/// replaced by \p x. \p i can be the count of \p v, which appends \p x.
+Vector *vectorAssoc(const Vector *v, uint32_t i, Value x);
+
+/// Return a transient version of \p v. \p v itself remains untouched.
+Vector *transientVector(const Vector *v);
+
+/// Append \p x to the transient \p t in place and return \p t.
+Vector *transientConj(Vector *t, Value x);
+
+/// Replace the element at the index \p i of the transient \p t in place and
+/// return \p t.
+Vector *transientAssoc(Vector *t, uint32_t i, Value x);
+
+/// Turn the transient \p t into a persistent vector in place and return it.
+Vector *persistentVector(Vector *t);
+
+// ============================================================================
+// HashMap
+// ============================================================================
+HashMap *emptyMap();
+
+/// Return the value of the given \p key in \p m, if any.
+std::optional<Value> mapGet(const HashMap *m, Value key);
+
+/// Return a new map with \p key bound to \p val.
+HashMap *mapAssoc(const HashMap *m, Value key, Value val);
+
+/// Return a new map without \p key.
+HashMap *mapDissoc(const HashMap *m, Value key);
+
+/// Return a transient version of \p m. \p m itself remains untouched.
+HashMap *transientMap(const HashMap *m);
+
+/// Bind \p key to \p val in the transient \p t in place and return \p t.
+HashMap *transientMapAssoc(HashMap *t, Value key, Value val);
+
+/// Remove \p key from the transient \p t in place and return \p t.
+HashMap *transientMapDissoc(HashMap *t, Value key);
+
+/// Turn the transient \p t into a persistent map in place and return it.
+HashMap *persistentMap(HashMap *t);
+
+} // namespace serene::runtime
+
+#endif
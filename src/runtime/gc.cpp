@@ -0,0 +1,237 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The thread support and the thread local allocation of the collector are
+// only available with this macro
+#define GC_THREADS
+
+#include "runtime/gc.h"
+
+#include "instrumentation.h"
+
+#include <gc/gc.h>
+#include <gc/gc_typed.h>
+#include <llvm/Support/ErrorHandling.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace serene::runtime {
+
+namespace {
+/// The descriptors of the typed objects, they're created by `initGC`
+struct Descriptors {
+  GC_descr pair;
+  GC_descr list;
+  GC_descr string;
+  GC_descr closure;
+};
+
+Descriptors descriptors;
+std::once_flag initialized;
+
+std::atomic<Instrumentation *> gcInstr = nullptr;
+
+/// The start time of the collection in progress, in nanoseconds
+std::atomic<uint64_t> collectionStart = 0;
+} // namespace
+
+static uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+};
+
+/// Create a descriptor for the type `T` in which only the words at the
+/// given \p offsets (in bytes) hold pointers.
+template <typename T, size_t N>
+static GC_descr makeDescriptor(const size_t (&offsets)[N]) {
+  GC_word bitmap[GC_BITMAP_SIZE(T)] = {0};
+
+  for (auto offset : offsets) {
+    GC_set_bit(bitmap, offset / sizeof(GC_word));
+  }
+
+  return GC_make_descriptor(bitmap, GC_WORD_LEN(T));
+};
+
+/// It's called by the collector, possibly while the world is stopped. So it
+/// must neither allocate nor take any lock.
+static void onCollectionEvent(GC_EventType event) {
+  auto *instr = gcInstr.load(std::memory_order_relaxed);
+  if (instr == nullptr) {
+    return;
+  }
+
+  switch (event) {
+  case GC_EVENT_START:
+    collectionStart.store(now(), std::memory_order_relaxed);
+    break;
+
+  case GC_EVENT_END:
+    instr->add(Counter::GCCollections);
+    instr->add(Counter::GCPauseNanos,
+               now() - collectionStart.load(std::memory_order_relaxed));
+    break;
+
+  default:
+    break;
+  }
+};
+
+void initGC() {
+  std::call_once(initialized, [] {
+    GC_INIT();
+    GC_allow_register_threads();
+    GC_set_on_collection_event(onCollectionEvent);
+
+    // `Object::type` points to the statically allocated types, so it is not
+    // a pointer that the collector cares about.
+    descriptors.pair =
+        makeDescriptor<Pair>({offsetof(Pair, first), offsetof(Pair, second)});
+    descriptors.list   = makeDescriptor<List>({offsetof(List, head)});
+    descriptors.string = makeDescriptor<String>({offsetof(String, data)});
+    descriptors.closure =
+        makeDescriptor<Closure>({offsetof(Closure, captures)});
+  });
+};
+
+GCThread::GCThread() {
+  // The main thread is already registered
+  if (GC_thread_is_registered() != 0) {
+    return;
+  }
+
+  struct GC_stack_base base {};
+  if (GC_get_stack_base(&base) == GC_SUCCESS) {
+    registered = GC_register_my_thread(&base) == GC_SUCCESS;
+  }
+};
+
+GCThread::~GCThread() {
+  if (registered) {
+    GC_unregister_my_thread();
+  }
+};
+
+void setGCInstrumentation(Instrumentation *instr) {
+  gcInstr.store(instr, std::memory_order_relaxed);
+};
+
+void reportGCStats(Instrumentation &instr) {
+  struct GC_prof_stats_s stats {};
+  GC_get_prof_stats(&stats, sizeof(stats));
+
+  instr.add(Counter::GCHeapBytes, stats.heapsize_full);
+  instr.add(Counter::GCBytesAllocated,
+            stats.allocd_bytes_before_gc + stats.bytes_allocd_since_gc);
+};
+
+/// Allocate a typed object of type `T` with the descriptor \p descr and
+/// construct it with the given \p args.
+template <typename T, typename... Args>
+static T *makeTyped(GC_descr descr, Args &&...args) {
+  void *mem = GC_malloc_explicitly_typed(sizeof(T), descr);
+  if (mem == nullptr) {
+    llvm::report_bad_alloc_error("The GC heap is exhausted");
+  }
+
+  return new (mem) T{std::forward<Args>(args)...};
+};
+
+/// Allocate a pointer free object of type `T` and construct it with the
+/// given \p args.
+template <typename T, typename... Args>
+static T *makeAtomic(Args &&...args) {
+  void *mem = GC_malloc_atomic(sizeof(T));
+  if (mem == nullptr) {
+    llvm::report_bad_alloc_error("The GC heap is exhausted");
+  }
+
+  return new (mem) T{std::forward<Args>(args)...};
+};
+
+Pair *allocPair(Value first, Value second) {
+  return makeTyped<Pair>(descriptors.pair, Object{&list_type}, first, second);
+};
+
+List *allocList(const Pair *head, unsigned int len) {
+  return makeTyped<List>(descriptors.list, Object{&list_type}, head, len);
+};
+
+String *allocString(const char *data, unsigned int len) {
+  // The payload doesn't contain any pointer, so the collector never scans it
+  auto *payload = static_cast<char *>(GC_malloc_atomic(len + 1));
+  if (payload == nullptr) {
+    llvm::report_bad_alloc_error("The GC heap is exhausted");
+  }
+
+  std::memcpy(payload, data, len);
+  payload[len] = '\0';
+
+  return makeTyped<String>(descriptors.string, Object{&string_type},
+                           static_cast<const char *>(payload), len);
+};
+
+Number *allocNumber(int64_t n) {
+  return makeAtomic<Number>(Object{&number_type}, n);
+};
+
+Float *allocFloat(double f) {
+  return makeAtomic<Float>(Object{&float_type}, f);
+};
+
+Closure *allocClosure(const void *fn, unsigned int numCaptures) {
+  Value *captures = nullptr;
+
+  if (numCaptures != 0) {
+    // Captured values might be pointers, so they get scanned. `GC_malloc`
+    // clears the memory, which means all of them are `nil`.
+    captures = static_cast<Value *>(GC_malloc(sizeof(Value) * numCaptures));
+    if (captures == nullptr) {
+      llvm::report_bad_alloc_error("The GC heap is exhausted");
+    }
+  }
+
+  return makeTyped<Closure>(descriptors.closure, Object{&function_type}, fn,
+                            numCaptures, static_cast<const Value *>(captures));
+};
+
+void *allocScanned(size_t size) {
+  void *mem = GC_malloc(size);
+  if (mem == nullptr) {
+    llvm::report_bad_alloc_error("The GC heap is exhausted");
+  }
+
+  return mem;
+};
+
+Value makeInteger(int64_t n) {
+  if (fitsInFixnum(n)) {
+    return fromFixnum(n);
+  }
+
+  return fromObject(&allocNumber(n)->header);
+};
+
+} // namespace serene::runtime
@@ -0,0 +1,104 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * The allocator of the runtime objects (look at `types.h`), backed by the
+ * Boehm-Demers-Weiser collector.
+ *
+ * - Objects without any pointer to the GC heap (strings' payload and the
+ *   number boxes) are allocated as atomic objects, so the collector never
+ *   scans them.
+ * - The rest of the objects get a typed descriptor that tells the collector
+ *   exactly which words of the object may hold a pointer, instead of
+ *   scanning the whole object conservatively.
+ * - The collector is built with thread support, so small objects come from
+ *   the thread local free lists of the calling thread. Any thread other than
+ *   the main thread that runs JITed code has to be registered via
+ *   `GCThread` first.
+ *
+ * The number of collections, the time spent in them and the heap size get
+ * reported via `Instrumentation`, look at `setGCInstrumentation`.
+ */
+
+#ifndef SERENE_RUNTIME_GC_H
+#define SERENE_RUNTIME_GC_H
+
+#include "types.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace serene {
+class Instrumentation;
+} // namespace serene
+
+namespace serene::runtime {
+
+/// Initialize the collector. It has to be called once on the main thread
+/// before allocating any runtime object. Calling it again is a noop.
+void initGC();
+
+/// Register the current thread with the collector for the lifetime of this
+/// object, so the collector scans its stack and it gets its own thread local
+/// allocation buffers. The main thread is registered by `initGC`.
+class GCThread {
+  bool registered = false;
+
+public:
+  GCThread();
+  GCThread(const GCThread &)            = delete;
+  GCThread &operator=(const GCThread &) = delete;
+  ~GCThread();
+};
+
+/// Report the collections to \p instr from now on, or stop reporting if it
+/// is `nullptr`. \p instr has to outlive the reporting.
+void setGCInstrumentation(Instrumentation *instr);
+
+/// Add the current size of the heap and the total number of allocated bytes
+/// to the counters of \p instr.
+void reportGCStats(Instrumentation &instr);
+
+Pair *allocPair(Value first, Value second);
+
+List *allocList(const Pair *head, unsigned int len);
+
+/// Allocate a string with a copy of the given \p len bytes of \p data.
+String *allocString(const char *data, unsigned int len);
+
+Number *allocNumber(int64_t n);
+
+Float *allocFloat(double f);
+
+/// Allocate a closure of the function \p fn with room for \p numCaptures
+/// captured values, all of them `nil`.
+Closure *allocClosure(const void *fn, unsigned int numCaptures);
+
+/// Allocate \p size bytes of cleared memory that the collector scans
+/// conservatively. It's meant for the internal structures of the runtime,
+/// e.g. the nodes of the collections, in which every word may be a pointer.
+void *allocScanned(size_t size);
+
+/// Return the value of the integer \p n, either as a fixnum or a boxed
+/// number if it doesn't fit in a fixnum.
+Value makeInteger(int64_t n);
+
+} // namespace serene::runtime
+
+#endif
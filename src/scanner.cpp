@@ -0,0 +1,247 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "scanner.h"
+
+#include <llvm/ADT/bit.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace serene::scanner {
+
+namespace {
+// ============================================================================
+// Block primitives
+// Each implementation has to provide a block size and three functions that
+// return a bit mask of the chars of a block that belong to a char class.
+// Each char (lane) of the block is represented by `laneBits` bits in the
+// mask and `laneMask` selects exactly one bit of each lane.
+// ============================================================================
+#if defined(__AVX2__)
+constexpr size_t blockSize   = 32;
+constexpr unsigned laneBits  = 1;
+constexpr uint64_t laneMask  = 0xFFFFFFFFULL;
+constexpr bool hasBlockScans = true;
+
+using Block = __m256i;
+
+inline Block load(const char *p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+inline Block eq(Block v, char c) {
+  return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+/// Whether each byte of `v` is in `[lo, hi]` treating bytes as unsigned.
+inline Block inRange(Block v, char lo, char hi) {
+  auto t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+  return _mm256_cmpeq_epi8(
+      _mm256_min_epu8(t, _mm256_set1_epi8(static_cast<char>(hi - lo))), t);
+}
+
+inline Block any(Block a, Block b) { return _mm256_or_si256(a, b); }
+
+inline uint64_t toMask(Block v) {
+  return static_cast<uint32_t>(_mm256_movemask_epi8(v));
+}
+
+#elif defined(__SSE2__)
+constexpr size_t blockSize   = 16;
+constexpr unsigned laneBits  = 1;
+constexpr uint64_t laneMask  = 0xFFFFULL;
+constexpr bool hasBlockScans = true;
+
+using Block = __m128i;
+
+inline Block load(const char *p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+inline Block eq(Block v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+
+/// Whether each byte of `v` is in `[lo, hi]` treating bytes as unsigned.
+inline Block inRange(Block v, char lo, char hi) {
+  auto t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+  return _mm_cmpeq_epi8(
+      _mm_min_epu8(t, _mm_set1_epi8(static_cast<char>(hi - lo))), t);
+}
+
+inline Block any(Block a, Block b) { return _mm_or_si128(a, b); }
+
+inline uint64_t toMask(Block v) {
+  return static_cast<uint32_t>(_mm_movemask_epi8(v));
+}
+
+#elif defined(__ARM_NEON)
+constexpr size_t blockSize   = 16;
+constexpr unsigned laneBits  = 4;
+constexpr uint64_t laneMask  = 0x8888888888888888ULL;
+constexpr bool hasBlockScans = true;
+
+using Block = uint8x16_t;
+
+inline Block load(const char *p) {
+  return vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+}
+
+inline Block eq(Block v, char c) {
+  return vceqq_u8(v, vdupq_n_u8(static_cast<uint8_t>(c)));
+}
+
+/// Whether each byte of `v` is in `[lo, hi]` treating bytes as unsigned.
+inline Block inRange(Block v, char lo, char hi) {
+  return vcleq_u8(vsubq_u8(v, vdupq_n_u8(static_cast<uint8_t>(lo))),
+                  vdupq_n_u8(static_cast<uint8_t>(hi - lo)));
+}
+
+inline Block any(Block a, Block b) { return vorrq_u8(a, b); }
+
+/// NEON doesn't have a movemask, so we narrow each byte to a nibble instead.
+inline uint64_t toMask(Block v) {
+  auto narrowed = vshrn_n_u16(vreinterpretq_u16_u8(v), 4);
+  return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+#else
+constexpr size_t blockSize   = 0;
+constexpr unsigned laneBits  = 1;
+constexpr uint64_t laneMask  = 0;
+constexpr bool hasBlockScans = false;
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__ARM_NEON)
+inline uint64_t whitespaceMask(const char *p) {
+  auto v = load(p);
+  // '\t', '\n', '\v', '\f' and '\r' are consecutive
+  return toMask(any(eq(v, ' '), inRange(v, '\t', '\r')));
+}
+
+inline uint64_t identifierMask(const char *p) {
+  auto v = load(p);
+  // Look at `isIdentifierChar`. The valid chars boil down to these ranges
+  auto m = any(eq(v, '!'), inRange(v, '$', '&'));
+  m      = any(m, inRange(v, '*', '+'));
+  m      = any(m, inRange(v, '-', ':')); // - . / 0-9 :
+  m      = any(m, inRange(v, '<', 'Z')); // < = > ? @ A-Z
+  m      = any(m, inRange(v, '^', '_'));
+  m      = any(m, inRange(v, 'a', 'z'));
+  m      = any(m, eq(v, '~'));
+  return toMask(m);
+}
+
+inline uint64_t newlineMask(const char *p) { return toMask(eq(load(p), '\n')); }
+#else
+inline uint64_t whitespaceMask(const char *) { return 0; }
+inline uint64_t identifierMask(const char *) { return 0; }
+inline uint64_t newlineMask(const char *) { return 0; }
+#endif
+
+inline unsigned firstLane(uint64_t mask) {
+  return llvm::countr_zero(mask) / laneBits;
+}
+
+/// Skip the chars in `[p, end)` as long as they are in the char class
+/// described by the block function `blockMask` and the scalar predicate
+/// `pred`. A `p` at or past `end` is returned as is.
+template <typename BlockFn, typename Pred>
+inline const char *skipWhile(const char *p, const char *end, BlockFn blockMask,
+                             Pred pred) {
+  // `end - p` would wrap around and the block loads would run past the end
+  if (p >= end) {
+    return p;
+  }
+
+  if constexpr (hasBlockScans) {
+    while (static_cast<size_t>(end - p) >= blockSize) {
+      auto misses = ~blockMask(p) & laneMask;
+
+      if (misses != 0) {
+        return p + firstLane(misses);
+      }
+
+      p += blockSize;
+    }
+  }
+
+  while (p < end && pred(*p)) {
+    p++;
+  }
+
+  return p;
+}
+} // namespace
+
+const char *skipWhitespace(const char *begin, const char *end) {
+  return skipWhile(begin, end, whitespaceMask,
+                   [](char c) { return isspace(c) != 0; });
+};
+
+const char *skipIdentifier(const char *begin, const char *end) {
+  return skipWhile(begin, end, identifierMask, isIdentifierChar);
+};
+
+const char *findNewline(const char *begin, const char *end) {
+  return skipWhile(
+      begin, end, [](const char *p) { return ~newlineMask(p); },
+      [](char c) { return c != '\n'; });
+};
+
+template <typename T>
+void findNewlines(llvm::StringRef buf, std::vector<T> &offsets) {
+  const char *start = buf.begin();
+  const char *end   = buf.end();
+  const char *p     = start;
+
+  if constexpr (hasBlockScans) {
+    while (static_cast<size_t>(end - p) >= blockSize) {
+      auto hits = newlineMask(p) & laneMask;
+
+      while (hits != 0) {
+        offsets.push_back(static_cast<T>(p - start + firstLane(hits)));
+        // Clear the lowest hit
+        hits &= hits - 1;
+      }
+
+      p += blockSize;
+    }
+  }
+
+  for (; p < end; p++) {
+    if (*p == '\n') {
+      offsets.push_back(static_cast<T>(p - start));
+    }
+  }
+};
+
+template void findNewlines<uint8_t>(llvm::StringRef, std::vector<uint8_t> &);
+template void findNewlines<uint16_t>(llvm::StringRef, std::vector<uint16_t> &);
+template void findNewlines<uint32_t>(llvm::StringRef, std::vector<uint32_t> &);
+template void findNewlines<uint64_t>(llvm::StringRef, std::vector<uint64_t> &);
+
+} // namespace serene::scanner
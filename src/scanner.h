@@ -0,0 +1,91 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * Commentary:
+ * The scanner is a tiny layer of vectorized routines that the reader (and
+ * the source manager) use to walk through the hot character classes of the
+ * input buffer, like whitespace runs, identifier runs and newlines, a block
+ * at a time instead of a single char at a time.
+ *
+ * Depending on the target, it uses AVX2, SSE2 or NEON and falls back to
+ * plain scalar loops otherwise. All of the functions work on a half open
+ * range `[begin, end)` and never read beyond `end`, so the buffer doesn't
+ * have to be null terminated.
+ */
+
+#ifndef SERENE_SCANNER_H
+#define SERENE_SCANNER_H
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cctype>
+#include <vector>
+
+namespace serene::scanner {
+
+/// A predicate function indicating whether the given char `c` is a valid
+/// char for an identifier (symbol) or not.
+inline bool isIdentifierChar(char c) {
+  switch (c) {
+  case '!':
+  case '$':
+  case '%':
+  case '&':
+  case '*':
+  case '+':
+  case '-':
+  case '.':
+  case '~':
+  case '/':
+  case ':':
+  case '<':
+  case '=':
+  case '>':
+  case '?':
+  case '@':
+  case '^':
+  case '_':
+    return true;
+  }
+
+  return std::isalnum(c) != 0;
+};
+
+/// Return a pointer to the first non whitespace char in `[begin, end)` or
+/// `end` if the whole range is whitespace. It uses the same definition of
+/// whitespace as `isspace` in the "C" locale. All of the scanning functions
+/// return \p begin as is if it's at or past \p end.
+const char *skipWhitespace(const char *begin, const char *end);
+
+/// Return a pointer to the first char in `[begin, end)` that is not valid
+/// for an identifier (look at `isIdentifierChar`) or `end`.
+const char *skipIdentifier(const char *begin, const char *end);
+
+/// Return a pointer to the first '\n' in `[begin, end)` or `end`.
+const char *findNewline(const char *begin, const char *end);
+
+/// Append the offset of every '\n' in the given \p buf to \p offsets in
+/// ascending order.
+template <typename T>
+void findNewlines(llvm::StringRef buf, std::vector<T> &offsets);
+
+} // namespace serene::scanner
+
+#endif
@@ -16,7 +16,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "commands/commands.h" // for cc, run
+#include "commands/commands.h" // for cc, run, server
+#include "options.h"           // for Options
 #include "serene/config.h"     // for SERENE_VERSION
                                //
 #include <__fwd/string.h>      // for string
@@ -25,10 +26,12 @@
 #include <llvm/Support/CommandLine.h>           // for SubCommand, ParseCom...
 #include <llvm/Support/FormatVariadic.h>        // for formatv, formatv_object
 #include <llvm/Support/FormatVariadicDetails.h> // for provider_format_adapter
+#include <llvm/TargetParser/Host.h>             // for getProcessTriple
 
 #include <cstring> // for strcmp
 #include <string>  // for basic_string
 #include <tuple>   // for tuple
+#include <utility> // for move
 
 namespace cl = llvm::cl;
 
@@ -50,9 +53,61 @@ static cl::opt<bool> verbose("v", cl::desc("Use verbose output"),
 
 // Subcommands ==============================================================
 // We don't use this subcommand directly but we need it for the CLI interface
-static cl::SubCommand CC("cc", "Serene's C compiler interface");
+static cl::SubCommand CC("cc", "Compile namespaces to objects ahead of time");
 
 static cl::SubCommand Run("run", "Run a Serene file");
+
+static cl::SubCommand
+    Server("server", "Keep a warm compiler running and serve the requests "
+                     "over a Unix socket");
+
+// Run options ==============================================================
+static cl::opt<bool>
+    instrument("instrument",
+               cl::desc("Report the time of each phase of the compiler and "
+                        "some stats"),
+               cl::sub(Run));
+
+static cl::opt<InstrumentationFormat> instrumentationFormat(
+    "instrument-format", cl::desc("The format of the instrumentation report"),
+    cl::values(clEnumValN(InstrumentationFormat::Tree, "tree",
+                          "A human readable tree (default)"),
+               clEnumValN(InstrumentationFormat::JSON, "json", "JSON")),
+    cl::init(InstrumentationFormat::Tree), cl::sub(Run));
+
+static cl::list<std::string> namespaces(cl::Positional,
+                                        cl::desc("<namespace>..."),
+                                        cl::sub(Run));
+
+// Server options ===========================================================
+static cl::opt<std::string> socketPath("socket",
+                                       cl::desc("The Unix socket to listen on"),
+                                       cl::init("serene.sock"),
+                                       cl::sub(Server));
+
+static cl::list<std::string>
+    loadPaths("load-path", cl::desc("The directories to look up namespaces in"),
+              cl::CommaSeparated, cl::sub(Server), cl::sub(Run));
+
+static cl::opt<std::string>
+    astCacheDir("ast-cache-dir",
+                cl::desc("The directory to cache the parsed namespaces in"),
+                cl::sub(Server));
+
+static cl::opt<std::string>
+    objectCacheDir("object-cache-dir",
+                   cl::desc("The directory to cache the compiled objects in"),
+                   cl::sub(Server));
+
+static cl::opt<std::string> profileGenerate(
+    "profile-generate",
+    cl::desc("Instrument the JITed code and write its profile to the file"),
+    cl::sub(Server));
+
+static cl::opt<std::string>
+    profileUse("profile-use",
+               cl::desc("Optimize the JITed code with the given profile"),
+               cl::sub(Server));
 } // namespace serene::opts
 
 int main(int argc, char **argv) {
@@ -68,7 +123,38 @@ int main(int argc, char **argv) {
   cl::ParseCommandLineOptions(argc, argv, banner);
 
   if (serene::opts::Run) {
-    serene::commands::run();
+    llvm::Triple triple(llvm::sys::getProcessTriple());
+    serene::Options options{.targetTriple = triple, .hostTriple = triple};
+
+    options.verbose               = serene::opts::verbose;
+    options.instrument            = serene::opts::instrument;
+    options.instrumentationFormat = serene::opts::instrumentationFormat;
+
+    serene::commands::RunOptions ropts;
+    ropts.namespaces.assign(serene::opts::namespaces.begin(),
+                            serene::opts::namespaces.end());
+    ropts.loadPaths.assign(serene::opts::loadPaths.begin(),
+                           serene::opts::loadPaths.end());
+
+    return serene::commands::run(options, std::move(ropts));
+  }
+
+  if (serene::opts::Server) {
+    llvm::Triple triple(llvm::sys::getProcessTriple());
+    serene::Options options{.targetTriple = triple, .hostTriple = triple};
+
+    options.verbose            = serene::opts::verbose;
+    options.JITObjectCacheDir  = serene::opts::objectCacheDir;
+    options.JITProfileGenerate = serene::opts::profileGenerate;
+    options.profileUse         = serene::opts::profileUse;
+
+    serene::commands::ServerOptions sopts;
+    sopts.socketPath = serene::opts::socketPath;
+    sopts.loadPaths.assign(serene::opts::loadPaths.begin(),
+                           serene::opts::loadPaths.end());
+    sopts.astCacheDir = serene::opts::astCacheDir;
+
+    return serene::commands::server(options, std::move(sopts));
   }
 
   return 0;
@@ -0,0 +1,129 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "source_cache.h"
+
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+
+namespace serene {
+
+SharedMemoryBuffer::SharedMemoryBuffer(std::shared_ptr<llvm::MemoryBuffer> buf)
+    : owner(std::move(buf)) {
+  init(owner->getBufferStart(), owner->getBufferEnd(),
+       /*RequiresNullTerminator=*/false);
+};
+
+std::unique_ptr<llvm::MemoryBuffer> SourceCache::getFile(llvm::StringRef path) {
+  llvm::sys::fs::file_status status;
+
+  if (llvm::sys::fs::status(path, status) ||
+      !llvm::sys::fs::is_regular_file(status)) {
+    return nullptr;
+  }
+
+  auto mtime = status.getLastModificationTime();
+  auto size  = status.getSize();
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto i = files.find(path);
+
+    if (i != files.end() && i->second.mtime == mtime &&
+        i->second.size == size) {
+      return std::make_unique<SharedMemoryBuffer>(i->second.buffer);
+    }
+  }
+
+  bool copy = false;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    copy = isVolatile;
+  }
+
+  // Unless the cache is volatile, LLVM is free to mmap the source files
+  auto bufOrErr = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/true,
+                                              /*IsVolatile=*/copy);
+  if (auto err = bufOrErr.getError()) {
+    llvm::consumeError(llvm::errorCodeToError(err));
+    return nullptr;
+  }
+
+  std::shared_ptr<llvm::MemoryBuffer> buf(std::move(*bufOrErr));
+
+  std::lock_guard<std::mutex> guard(lock);
+  files[path] = Entry{buf, mtime, size};
+
+  return std::make_unique<SharedMemoryBuffer>(std::move(buf));
+};
+
+void SourceCache::setVolatile(bool v) {
+  std::lock_guard<std::mutex> guard(lock);
+  isVolatile = v;
+};
+
+std::optional<std::string>
+SourceCache::getResolvedPath(llvm::StringRef ns) const {
+  std::lock_guard<std::mutex> guard(lock);
+  auto i = resolved.find(ns);
+
+  if (i == resolved.end()) {
+    return std::nullopt;
+  }
+
+  return i->second;
+};
+
+void SourceCache::setResolvedPath(llvm::StringRef ns, llvm::StringRef path) {
+  std::lock_guard<std::mutex> guard(lock);
+  misses.erase(ns);
+  resolved[ns] = path.str();
+};
+
+bool SourceCache::isMissing(llvm::StringRef ns) const {
+  std::lock_guard<std::mutex> guard(lock);
+  return misses.contains(ns);
+};
+
+void SourceCache::setMissing(llvm::StringRef ns) {
+  std::lock_guard<std::mutex> guard(lock);
+  resolved.erase(ns);
+  misses.insert(ns);
+};
+
+void SourceCache::invalidate(llvm::StringRef ns) {
+  std::lock_guard<std::mutex> guard(lock);
+  resolved.erase(ns);
+  misses.erase(ns);
+};
+
+void SourceCache::clearResolutions() {
+  std::lock_guard<std::mutex> guard(lock);
+  resolved.clear();
+  misses.clear();
+};
+
+void SourceCache::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+  files.clear();
+  resolved.clear();
+  misses.clear();
+};
+
+} // namespace serene
@@ -0,0 +1,132 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Commentary:
+ * `SourceCache` keeps the content of the source files that we have already
+ * loaded, keyed by their resolved path and validated against the file's
+ * modification time and size. Files are opened as non-volatile memory
+ * buffers so LLVM maps them into memory instead of copying them, unless the
+ * cache is marked as volatile. Long running processes like the server have to
+ * use a volatile cache, since a mapped file changes with the file on disk.
+ *
+ * A cached buffer is shared between its users, each one of them gets a
+ * lightweight `MemoryBuffer` view that keeps the underlying buffer alive even
+ * if the cache entry gets replaced because the file changed on disk.
+ *
+ * In addition to the file cache, it remembers which path a namespace was
+ * resolved to and which namespaces couldn't be found in the load path, so
+ * repeated imports don't have to probe the file system for every load path.
+ * The negative entries never expire on their own, look at `invalidate` and
+ * `clearResolutions`.
+ *
+ * It's safe to use the cache from different threads.
+ */
+
+#ifndef SERENE_SOURCE_CACHE_H
+#define SERENE_SOURCE_CACHE_H
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace serene {
+
+/// A `MemoryBuffer` that shares the ownership of another buffer.
+class SharedMemoryBuffer : public llvm::MemoryBuffer {
+  std::shared_ptr<llvm::MemoryBuffer> owner;
+
+public:
+  explicit SharedMemoryBuffer(std::shared_ptr<llvm::MemoryBuffer> buf);
+
+  llvm::StringRef getBufferIdentifier() const override {
+    return owner->getBufferIdentifier();
+  };
+
+  BufferKind getBufferKind() const override { return owner->getBufferKind(); };
+};
+
+class SourceCache {
+  struct Entry {
+    std::shared_ptr<llvm::MemoryBuffer> buffer;
+    llvm::sys::TimePoint<> mtime;
+    uint64_t size = 0;
+  };
+
+  mutable std::mutex lock;
+
+  /// Resolved file path -> the content of the file
+  llvm::StringMap<Entry> files;
+
+  /// Namespace name -> the path of the file that contains it
+  llvm::StringMap<std::string> resolved;
+
+  /// The namespaces that we couldn't find in any of the load paths
+  llvm::StringSet<> misses;
+
+  /// Whether the files might change while we still use their content
+  bool isVolatile = false;
+
+public:
+  SourceCache()                               = default;
+  SourceCache(const SourceCache &)            = delete;
+  SourceCache &operator=(const SourceCache &) = delete;
+
+  /// Return a view to the content of the file at \p path, or `nullptr` if
+  /// the file doesn't exist or can't be read. The file is read only if it is
+  /// not in the cache or it has changed since the last time we read it.
+  std::unique_ptr<llvm::MemoryBuffer> getFile(llvm::StringRef path);
+
+  /// Copy the content of the files instead of mapping them into memory if
+  /// \p v is true. It only affects the files that are read from now on.
+  void setVolatile(bool v);
+
+  /// Return the path that the namespace \p ns was resolved to before.
+  std::optional<std::string> getResolvedPath(llvm::StringRef ns) const;
+
+  /// Remember that the namespace \p ns lives in the file at \p path.
+  void setResolvedPath(llvm::StringRef ns, llvm::StringRef path);
+
+  /// Whether we already know that \p ns is not in the load path.
+  bool isMissing(llvm::StringRef ns) const;
+
+  /// Remember that \p ns is not in the load path.
+  void setMissing(llvm::StringRef ns);
+
+  /// Forget everything that we know about the location of \p ns. It's useful
+  /// when a namespace file gets created or moved.
+  void invalidate(llvm::StringRef ns);
+
+  /// Forget all the namespace resolutions, e.g. when the load path changes.
+  /// It keeps the content of the files.
+  void clearResolutions();
+
+  /// Drop everything.
+  void clear();
+};
+
+} // namespace serene
+
+#endif
@@ -18,20 +18,30 @@
 
 #include "source_mgr.h"
 
+#include "ast/flat.h"
 #include "errors.h"
 #include "jit/jit.h"
 #include "location.h"
 #include "reader.h"
+#include "scanner.h"
 #include "utils.h"
 
 #include <system_error>
 
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/CachePruning.h>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/FormatVariadic.h>
 #include <llvm/Support/Locale.h>
 #include <llvm/Support/MemoryBufferRef.h>
 #include <llvm/Support/Path.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
 #include <mlir/Support/LogicalResult.h>
 
 namespace serene {
@@ -52,81 +62,583 @@ bool SourceMgr::isValidBufferID(unsigned i) const {
 
 SourceMgr::MemBufPtr SourceMgr::findFileInLoadPath(const std::string &name,
                                                    std::string &importedFile) {
+  // We have already found this namespace before, no need to probe all the
+  // load paths again
+  if (auto path = cache.getResolvedPath(name)) {
+    if (auto buf = cache.getFile(*path)) {
+      importedFile = std::move(*path);
+      return buf;
+    }
 
-  auto path = convertNamespaceToPath(name);
+    // The file is gone, let's look for it again
+    cache.invalidate(name);
+  }
 
-  // If the file didn't exist directly, see if it's in an include path.
-  for (unsigned i = 0, e = loadPaths.size(); i != e; ++i) {
+  if (cache.isMissing(name)) {
+    SMGR_LOG("Namespace is known to be missing: " + name);
+    return nullptr;
+  }
 
-    // TODO: Ugh, Udgly, fix this using llvm::sys::path functions
-    importedFile = loadPaths[i] + llvm::sys::path::get_separator().data() +
-                   path + "." + DEFAULT_SUFFIX;
+  auto path = convertNamespaceToPath(name) + "." + DEFAULT_SUFFIX;
 
-    SMGR_LOG("Try to load the ns from: " + importedFile);
-    auto newBufOrErr = llvm::MemoryBuffer::getFile(importedFile);
+  for (const auto &dir : loadPaths) {
+    llvm::SmallString<MAX_PATH_SLOTS> candidate(dir);
+    llvm::sys::path::append(candidate, path);
 
-    if (auto err = newBufOrErr.getError()) {
-      llvm::consumeError(llvm::errorCodeToError(err));
-      continue;
-    }
+    SMGR_LOG("Try to load the ns from: " << candidate);
 
-    return std::move(*newBufOrErr);
+    if (auto buf = cache.getFile(candidate)) {
+      importedFile = std::string(candidate);
+      cache.setResolvedPath(name, importedFile);
+      return buf;
+    }
   }
 
+  cache.setMissing(name);
   return nullptr;
 };
 
+void SourceMgr::setASTCacheDir(llvm::StringRef dir, uint64_t maxSize) {
+  astCacheDir     = dir.str();
+  astCacheMaxSize = maxSize;
+
+  if (dir.empty()) {
+    return;
+  }
+
+  if (auto ec = llvm::sys::fs::create_directories(dir)) {
+    SMGR_LOG("Can't create the AST cache directory '" << dir
+                                                      << "': " << ec.message());
+    astCacheDir.clear();
+  }
+};
+
+std::string SourceMgr::getASTCachePath(llvm::StringRef name,
+                                       llvm::StringRef content) const {
+  // The hash doesn't have to be cryptographic, but it has to be fast since
+  // we hash every source file that we load. The format version of the tree
+  // is checked when reading the file.
+  auto key = llvm::utohexstr(llvm::xxHash64(content), /*LowerCase=*/true);
+
+  // `pruneCache` only considers the files with this prefix
+  llvm::SmallString<MAX_PATH_SLOTS> path(astCacheDir);
+  llvm::sys::path::append(path, "llvmcache-" + name + "-" + key + ".ast");
+  return std::string(path);
+};
+
+void SourceMgr::pruneASTCache() {
+  llvm::CachePruningPolicy policy;
+  policy.MaxSizeBytes = astCacheMaxSize;
+
+  // It's a noop if the cache got pruned recently
+  UNUSED(llvm::pruneCache(astCacheDir, policy));
+};
+
+std::optional<ast::Ast> SourceMgr::loadCachedAst(llvm::StringRef path,
+                                                 unsigned bufferId,
+                                                 ast::Arena &arena) {
+  auto miss = [this]() -> std::optional<ast::Ast> {
+    if (instr != nullptr) {
+      instr->add(Counter::ASTCacheMisses);
+    }
+    return std::nullopt;
+  };
+
+  // Cache files are not volatile, so LLVM is free to mmap them
+  auto maybeBuf = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false,
+                                              /*IsVolatile=*/false);
+  if (!maybeBuf) {
+    return miss();
+  }
+
+  auto tree = ast::FlatTree::read((*maybeBuf)->getBuffer(), bufferId);
+  if (!tree) {
+    auto msg = llvm::toString(tree.takeError());
+    SMGR_LOG("Ignoring the AST cache file '" << path << "': " << msg);
+    return miss();
+  }
+
+  // The limit might be lower than the one that the tree was read with. Let
+  // the reader report the error.
+  if (tree->getDepth() > maxDepth) {
+    return miss();
+  }
+
+  // The nodes point to the text in the mapped file instead of copying it
+  auto ast = tree->toAst(arena, /*copyText=*/false);
+  if (!ast) {
+    auto msg = llvm::toString(ast.takeError());
+    SMGR_LOG("Ignoring the AST cache file '" << path << "': " << msg);
+    return miss();
+  }
+
+  if (instr != nullptr) {
+    instr->add(Counter::ASTCacheHits);
+  }
+
+  arena.adopt(std::move(*maybeBuf));
+  return std::move(*ast);
+};
+
+void SourceMgr::storeCachedAst(llvm::StringRef path, const ast::Ast &ast) {
+  llvm::SmallString<MAX_PATH_SLOTS> model(astCacheDir);
+  llvm::sys::path::append(model, "tmp-%%%%%%%%.ast");
+
+  auto temp = llvm::sys::fs::TempFile::create(model);
+  if (!temp) {
+    auto msg = llvm::toString(temp.takeError());
+    SMGR_LOG("Can't create a temporary file in the AST cache: " << msg);
+    return;
+  }
+
+  std::error_code ec;
+  {
+    llvm::raw_fd_ostream os(temp->FD, /*shouldClose=*/false);
+    ast::FlatTree::build(ast).write(os);
+    os.flush();
+
+    // The stream is fatal about the errors that nobody looked at
+    ec = os.error();
+    os.clear_error();
+  }
+
+  if (ec) {
+    SMGR_LOG("Can't write to the AST cache: " << ec.message());
+    llvm::consumeError(temp->discard());
+    return;
+  }
+
+  // Renaming is atomic, so other processes either see the whole tree or
+  // nothing at all.
+  if (auto err = temp->keep(path)) {
+    auto msg = llvm::toString(std::move(err));
+    SMGR_LOG("Can't store the AST in '" << path << "': " << msg);
+    return;
+  }
+
+  pruneASTCache();
+};
+
 ast::MaybeNS SourceMgr::readNamespace(std::string name,
                                       const LocationRange &importLoc) {
   std::string importedFile;
 
+  // Finding and loading the file is part of the parsing, as far as the
+  // instrumentation is concerned
+  Instrumentation::Scope phase;
+  Instrumentation::Scope timer;
+  if (instr != nullptr) {
+    phase = instr->time("Parse");
+    timer = phase.nest(name);
+  }
+
   SMGR_LOG("Attempt to load namespace: " + name);
   MemBufPtr newBufOrErr(findFileInLoadPath(name, importedFile));
 
   if (newBufOrErr == nullptr) {
-    auto msg = llvm::formatv("Couldn't find namespace '{0}'", name).str();
-    return errors::make(errors::Type::NSLoadError, importLoc, msg);
+    return errors::make(errors::Type::NSLoadError, importLoc,
+                        "Couldn't find namespace '{0}'", name);
   }
 
   auto bufferId = AddNewSourceBuffer(std::move(newBufOrErr), importLoc);
 
-  UNUSED(nsTable.insert_or_assign(name, bufferId));
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    UNUSED(nsTable.insert_or_assign(name, bufferId));
+  }
 
   if (bufferId == 0) {
-    auto msg = llvm::formatv("Couldn't add namespace '{0}'", name).str();
-    return errors::make(errors::Type::NSAddToSMError, importLoc, msg);
+    return errors::make(errors::Type::NSAddToSMError, importLoc,
+                        "Couldn't add namespace '{0}'", name);
   }
 
   // Since we moved the buffer to be added as the source storage we
   // need to get a pointer to it again
   const auto *buf = getMemoryBuffer(bufferId);
 
-  // Read the content of the buffer by passing it the reader
-  auto maybeAst = read(buf->getBuffer(), name,
-                       std::optional(llvm::StringRef(importedFile)));
-
-  if (!maybeAst) {
-    SMGR_LOG("Couldn't Read namespace: " + name);
-    return maybeAst.takeError();
+  // Locations are 32-bit offsets into the buffer
+  if (buf->getBufferSize() >= Location::UnknownOffset) {
+    return errors::make(errors::Type::NSLoadError, importLoc,
+                        "Namespace '{0}' is too big", name);
   }
 
-  // Create the NS and set the AST
-  auto ns = ast::makeAndCast<ast::Namespace>(
+  // Create the NS first, since it is the owner of the arena that the reader
+  // allocates the nodes from. From now on we use the name that the namespace
+  // owns.
+  auto ns = std::make_unique<ast::Namespace>(
       importLoc, name, std::optional(llvm::StringRef(importedFile)));
 
-  if (auto errs = ns->ExpandTree(*maybeAst)) {
+  std::string cachePath;
+  std::optional<ast::Ast> tree;
+
+  if (!astCacheDir.empty()) {
+    cachePath = getASTCachePath(ns->name, buf->getBuffer());
+    tree      = loadCachedAst(cachePath, bufferId, ns->getArena());
+  }
+
+  if (!tree) {
+    // Read the content of the buffer by passing it the reader
+    Reader r(ns->getArena(), buf->getBuffer(), ns->name, bufferId);
+    r.setMaxDepth(maxDepth);
+    auto maybeAst = r.read();
+
+    if (!maybeAst) {
+      SMGR_LOG("Couldn't Read namespace: " + name);
+      return maybeAst.takeError();
+    }
+
+    // The reader already found all the newlines while reading the buffer,
+    // there is no need to scan the buffer again for the line index
+    if (auto lineOffsets = r.getLineOffsets()) {
+      std::lock_guard<std::mutex> guard(lock);
+      buffers[bufferId - 1].setLineOffsets(*lineOffsets);
+    }
+
+    if (!cachePath.empty()) {
+      storeCachedAst(cachePath, *maybeAst);
+    }
+
+    tree = std::move(*maybeAst);
+  }
+
+  if (auto errs = ns->ExpandTree(*tree)) {
     SMGR_LOG("Couldn't set thre AST for namespace: " + name);
     return errs;
   }
 
+  if (instr != nullptr) {
+    instr->add(Counter::BytesRead, buf->getBufferSize());
+    instr->add(Counter::NodesAllocated, ns->getArena().getNumberOfNodes());
+    instr->add(Counter::NamespacesRead);
+  }
+
   return ns;
 };
 
+llvm::Expected<ast::Namespaces>
+SourceMgr::readNamespaces(llvm::ArrayRef<std::string> names,
+                          const LocationRange &importLoc, DependencyFn deps,
+                          unsigned threads) {
+  llvm::ThreadPool pool(llvm::hardware_concurrency(threads));
+
+  ast::Namespaces result;
+  llvm::Error errs = llvm::Error::success();
+  llvm::StringSet<> seen;
+
+  std::vector<std::string> wave;
+  for (const auto &name : names) {
+    if (seen.insert(name).second) {
+      wave.push_back(name);
+    }
+  }
+
+  while (!wave.empty()) {
+    SMGR_LOG("Loading a wave of " << wave.size() << " namespaces");
+
+    std::vector<std::unique_ptr<ast::Namespace>> loaded(wave.size());
+    std::vector<llvm::Error> waveErrs;
+    waveErrs.reserve(wave.size());
+
+    for (size_t i = 0; i < wave.size(); i++) {
+      waveErrs.push_back(llvm::Error::success());
+    }
+
+    // Each task only touches its own slots, so the result vectors don't need
+    // any synchronization. The `SourceMgr` itself takes care of its state.
+    for (size_t i = 0; i < wave.size(); i++) {
+      pool.async([this, i, &wave, &loaded, &waveErrs, &importLoc] {
+        auto maybeNS = readNamespace(wave[i], importLoc);
+        if (!maybeNS) {
+          waveErrs[i] = maybeNS.takeError();
+          return;
+        }
+        loaded[i] = std::move(*maybeNS);
+      });
+    }
+
+    pool.wait();
+
+    std::vector<std::string> nextWave;
+
+    for (size_t i = 0; i < wave.size(); i++) {
+      if (waveErrs[i]) {
+        errs = llvm::joinErrors(std::move(errs), std::move(waveErrs[i]));
+        continue;
+      }
+
+      if (deps) {
+        for (auto &dep : deps(*loaded[i])) {
+          if (seen.insert(dep).second) {
+            nextWave.push_back(std::move(dep));
+          }
+        }
+      }
+
+      result.push_back(std::move(loaded[i]));
+    }
+
+    wave.swap(nextWave);
+  }
+
+  if (errs) {
+    return std::move(errs);
+  }
+
+  return result;
+};
+
+/// Point the locations of the given \p node and all of its children to the
+/// buffer with the ID \p bufferId and move their offsets by \p delta.
+static void relocate(ast::Node node, uint32_t bufferId, int64_t delta) {
+  llvm::SmallVector<ast::Node, 16> worklist{node};
+
+  auto move = [&](Location &loc) {
+    loc.bufferId = bufferId;
+    if (loc.isKnownLocation()) {
+      loc.offset = static_cast<uint32_t>(loc.offset + delta);
+    }
+  };
+
+  while (!worklist.empty()) {
+    auto *n = worklist.pop_back_val();
+    move(n->location.start);
+    move(n->location.end);
+
+    if (auto *list = llvm::dyn_cast<ast::List>(n)) {
+      worklist.append(list->elements.begin(), list->elements.end());
+    }
+  }
+};
+
+llvm::Error
+SourceMgr::updateNamespace(ast::Namespace &ns,
+                           std::unique_ptr<llvm::MemoryBuffer> newBuf,
+                           uint32_t begin, uint32_t end) {
+  unsigned oldId = 0;
+  LocationRange importLoc;
+  llvm::StringRef oldContent;
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    oldId = nsTable.lookup(ns.name);
+
+    if (oldId != 0) {
+      importLoc  = buffers[oldId - 1].importLoc;
+      oldContent = buffers[oldId - 1].buffer->getBuffer();
+    }
+  }
+
+  if (oldId == 0) {
+    return errors::make(errors::Type::NSLoadError, ns.location,
+                        "Namespace '{0}' is not loaded", ns.name);
+  }
+
+  int64_t delta = static_cast<int64_t>(newBuf->getBufferSize()) -
+                  static_cast<int64_t>(oldContent.size());
+
+  if (begin > end || end > oldContent.size() || end + delta < begin) {
+    return errors::make(errors::Type::NSLoadError, ns.location,
+                        "Invalid edit range [{0}, {1}) for namespace '{2}'",
+                        begin, end, ns.name);
+  }
+
+  if (newBuf->getBufferSize() >= Location::UnknownOffset) {
+    return errors::make(errors::Type::NSLoadError, ns.location,
+                        "Namespace '{0}' is too big", ns.name);
+  }
+
+  Instrumentation::Scope phase;
+  Instrumentation::Scope timer;
+  if (instr != nullptr) {
+    phase = instr->time("Parse");
+    timer = phase.nest(ns.name);
+  }
+
+  auto &tree = ns.getTree();
+
+  // We can only reuse the nodes if all of them are read from the previous
+  // buffer, otherwise we can't tell where they are
+  bool reusable = llvm::all_of(tree, [oldId](const ast::Node &n) {
+    return n->location.start.bufferId == oldId &&
+           n->location.end.isKnownLocation();
+  });
+
+  // The affected forms are [first, last). A form is unaffected only if there
+  // is at least one unchanged whitespace between the form and the edited
+  // range, so it would be read exactly the same if we read the whole buffer
+  // again. Top level forms might be glued together (e.g. `1-` is a number
+  // and a symbol), so the forms touching the affected ones are affected too.
+  size_t first = 0;
+  size_t last  = tree.size();
+
+  if (reusable) {
+    first = std::partition_point(tree.begin(), tree.end(),
+                                 [begin](const ast::Node &n) {
+                                   return n->location.end.offset + 1 < begin;
+                                 }) -
+            tree.begin();
+    last = std::partition_point(tree.begin() + first, tree.end(),
+                                [end](const ast::Node &n) {
+                                  return n->location.start.offset <= end;
+                                }) -
+           tree.begin();
+
+    auto touching = [&tree](size_t i) {
+      return tree[i - 1]->location.end.offset + 1 ==
+             tree[i]->location.start.offset;
+    };
+
+    while (first > 0 && first < tree.size() && touching(first)) {
+      first--;
+    }
+
+    while (last > first && last < tree.size() && touching(last)) {
+      last++;
+    }
+  }
+
+  SMGR_LOG("Re-reading " << last - first << " out of " << tree.size()
+                         << " forms of namespace: " << ns.name);
+
+  // We only register the new buffer once the update can't fail anymore, so
+  // a failed update doesn't leave a buffer behind. Till then the new forms
+  // are read without a buffer ID and relocated to the new buffer later on.
+  auto content = newBuf->getBuffer();
+
+  auto regionStart = first == 0 ? 0 : tree[first - 1]->location.end.offset + 1;
+  auto nodes       = ns.getArena().getNumberOfNodes();
+
+  auto readRegion = [&](size_t regionEnd) {
+    if (instr != nullptr) {
+      instr->add(Counter::BytesRead, regionEnd - regionStart);
+    }
+
+    Reader r(ns.getArena(), content.substr(0, regionEnd), ns.name);
+    r.setMaxDepth(maxDepth);
+    r.seek(regionStart);
+    return r.read();
+  };
+
+  auto maybeAst = readRegion(last == tree.size()
+                                 ? content.size()
+                                 : tree[last]->location.start.offset + delta);
+
+  if (!maybeAst && last != tree.size()) {
+    // The edit changed the structure of the forms beyond the affected ones
+    // (e.g. an unbalanced paren), so we have to read the rest of the buffer
+    SMGR_LOG("Re-reading the rest of namespace: " << ns.name);
+    llvm::consumeError(maybeAst.takeError());
+    last     = tree.size();
+    maybeAst = readRegion(content.size());
+  }
+
+  if (!maybeAst) {
+    SMGR_LOG("Couldn't re-read namespace: " + ns.name);
+    return maybeAst.takeError();
+  }
+
+  auto numNewForms = maybeAst->size();
+
+  if (auto errs = ns.SpliceTree(first, last, *maybeAst)) {
+    SMGR_LOG("Couldn't update the AST for namespace: " + ns.name);
+    return errs;
+  }
+
+  auto bufferId = AddNewSourceBuffer(std::move(newBuf), importLoc);
+
+  // The new forms are already relative to the new buffer, the forms after
+  // them have to move by the change in the size of the content
+  for (size_t i = 0; i < first + numNewForms; i++) {
+    relocate(tree[i], bufferId, 0);
+  }
+
+  for (size_t i = first + numNewForms; i < tree.size(); i++) {
+    relocate(tree[i], bufferId, delta);
+  }
+
+  if (instr != nullptr) {
+    instr->add(Counter::NodesAllocated,
+               ns.getArena().getNumberOfNodes() - nodes);
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  UNUSED(nsTable.insert_or_assign(ns.name, bufferId));
+  return llvm::Error::success();
+};
+
+llvm::Error
+SourceMgr::updateNamespace(ast::Namespace &ns,
+                           std::unique_ptr<llvm::MemoryBuffer> newBuf) {
+  llvm::StringRef oldContent;
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto oldId = nsTable.lookup(ns.name);
+
+    if (oldId != 0) {
+      oldContent = buffers[oldId - 1].buffer->getBuffer();
+    }
+  }
+
+  auto newContent = newBuf->getBuffer();
+
+  // The edited range is whatever is left after dropping the common prefix and
+  // suffix of the old and the new content
+  auto prefix = std::mismatch(oldContent.begin(), oldContent.end(),
+                              newContent.begin(), newContent.end())
+                    .first -
+                oldContent.begin();
+
+  auto maxSuffix = std::min(oldContent.size(), newContent.size()) - prefix;
+  size_t suffix  = 0;
+
+  while (suffix < maxSuffix &&
+         oldContent[oldContent.size() - suffix - 1] ==
+             newContent[newContent.size() - suffix - 1]) {
+    suffix++;
+  }
+
+  return updateNamespace(ns, std::move(newBuf), static_cast<uint32_t>(prefix),
+                         static_cast<uint32_t>(oldContent.size() - suffix));
+};
+
+std::pair<unsigned, unsigned>
+SourceMgr::getLineAndColumn(const Location &loc) const {
+  // The line offset cache of a buffer is created lazily
+  std::lock_guard<std::mutex> guard(lock);
+
+  if (!loc.isKnownLocation() || !isValidBufferID(loc.bufferId)) {
+    return {0, 0};
+  }
+
+  const auto &buf = buffers[loc.bufferId - 1];
+  if (loc.offset > buf.buffer->getBufferSize()) {
+    return {0, 0};
+  }
+
+  return buf.getLineAndColumn(loc.offset);
+};
+
+std::string SourceMgr::toString(const Location &loc) const {
+  if (!loc.isKnownLocation() || loc.bufferId == 0 ||
+      loc.bufferId > getNumBuffers()) {
+    return loc.toString();
+  }
+
+  auto [line, col] = getLineAndColumn(loc);
+  return llvm::formatv("{0}:{1}:{2}",
+                       getMemoryBuffer(loc.bufferId)->getBufferIdentifier(),
+                       line, col);
+};
+
 unsigned SourceMgr::AddNewSourceBuffer(std::unique_ptr<llvm::MemoryBuffer> f,
                                        const LocationRange &includeLoc) {
   SrcBuffer nb;
   nb.buffer    = std::move(f);
   nb.importLoc = includeLoc;
+
+  std::lock_guard<std::mutex> guard(lock);
   buffers.push_back(std::move(nb));
   return buffers.size();
 };
@@ -145,17 +657,91 @@ static std::vector<T> &GetOrCreateOffsetCache(void *&offsetCache,
   // TODO: Replace this assert with a realtime check
   assert(sz <= std::numeric_limits<T>::max());
 
-  llvm::StringRef s = buffer->getBuffer();
-  for (size_t n = 0; n < sz; ++n) {
-    if (s[n] == '\n') {
-      offsets->push_back(static_cast<T>(n));
-    }
-  }
+  scanner::findNewlines(buffer->getBuffer(), *offsets);
 
   offsetCache = offsets;
   return *offsets;
 }
 
+template <typename T>
+static void SetOffsetCache(void *&offsetCache, llvm::ArrayRef<size_t> lines) {
+  assert(offsetCache == nullptr && "The offset cache is already populated");
+
+  auto *offsets = new std::vector<T>();
+  offsets->reserve(lines.size());
+
+  for (auto offset : lines) {
+    offsets->push_back(static_cast<T>(offset));
+  }
+
+  offsetCache = offsets;
+}
+
+void SourceMgr::SrcBuffer::setLineOffsets(llvm::ArrayRef<size_t> lines) {
+  if (offsetCache != nullptr) {
+    return;
+  }
+
+  size_t sz = buffer->getBufferSize();
+  if (sz <= std::numeric_limits<uint8_t>::max()) {
+    SetOffsetCache<uint8_t>(offsetCache, lines);
+  } else if (sz <= std::numeric_limits<uint16_t>::max()) {
+    SetOffsetCache<uint16_t>(offsetCache, lines);
+  } else if (sz <= std::numeric_limits<uint32_t>::max()) {
+    SetOffsetCache<uint32_t>(offsetCache, lines);
+  } else {
+    SetOffsetCache<uint64_t>(offsetCache, lines);
+  }
+}
+
+template <typename T>
+unsigned
+SourceMgr::SrcBuffer::getLineNumberSpecialized(const char *ptr) const {
+  std::vector<T> &offsets =
+      GetOrCreateOffsetCache<T>(offsetCache, buffer.get());
+
+  const char *bufStart = buffer->getBufferStart();
+  assert(ptr >= bufStart && ptr <= buffer->getBufferEnd());
+
+  ptrdiff_t ptrDiff = ptr - bufStart;
+  assert(ptrDiff >= 0 &&
+         static_cast<size_t>(ptrDiff) <= std::numeric_limits<T>::max());
+  T ptrOffset = static_cast<T>(ptrDiff);
+
+  // llvm::lower_bound gives the number of EOL before PtrOffset. Add 1 to get
+  // the line number.
+  return llvm::lower_bound(offsets, ptrOffset) - offsets.begin() + 1;
+}
+
+/// Look up a given \p ptr in in the buffer, determining which line it came
+/// from.
+unsigned SourceMgr::SrcBuffer::getLineNumber(const char *ptr) const {
+  size_t sz = buffer->getBufferSize();
+  if (sz <= std::numeric_limits<uint8_t>::max()) {
+    return getLineNumberSpecialized<uint8_t>(ptr);
+  }
+
+  if (sz <= std::numeric_limits<uint16_t>::max()) {
+    return getLineNumberSpecialized<uint16_t>(ptr);
+  }
+
+  if (sz <= std::numeric_limits<uint32_t>::max()) {
+    return getLineNumberSpecialized<uint32_t>(ptr);
+  }
+
+  return getLineNumberSpecialized<uint64_t>(ptr);
+}
+
+std::pair<unsigned, unsigned>
+SourceMgr::SrcBuffer::getLineAndColumn(uint32_t offset) const {
+  const char *ptr = buffer->getBufferStart() + offset;
+  auto line       = getLineNumber(ptr);
+  const char *bol = getPointerForLineNumber(line);
+
+  // We start counting columns from 1
+  return {line, static_cast<unsigned>(ptr - bol) + 1};
+}
+
 template <typename T>
 const char *SourceMgr::SrcBuffer::getPointerForLineNumberSpecialized(
     unsigned lineNo) const {
@@ -20,10 +20,15 @@
 #define SERENE_SOURCE_MGR_H
 
 #include "ast/ast.h"
+#include "instrumentation.h"
 #include "location.h"
+#include "reader.h"
+#include "source_cache.h"
 
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Error.h>
 #include <llvm/Support/ErrorHandling.h>
 #include <llvm/Support/ErrorOr.h>
 #include <llvm/Support/MemoryBuffer.h>
@@ -31,8 +36,13 @@
 #include <mlir/IR/Diagnostics.h>
 #include <mlir/Support/Timing.h>
 
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <vector>
 
 #define SMGR_LOG(...)                       \
   DEBUG_WITH_TYPE("sourcemgr", llvm::dbgs() \
@@ -83,12 +93,21 @@ private:
     /// dynamically based on the size of Buffer.
     mutable void *offsetCache = nullptr;
 
+    /// Populate the offset cache with the given offsets of the line endings
+    /// that are collected by someone else (e.g. the reader) while walking
+    /// through the buffer. \p lines has to be in ascending order.
+    void setLineOffsets(llvm::ArrayRef<size_t> lines);
+
     /// Look up a given \p ptr in in the buffer, determining which line it came
     /// from.
     unsigned getLineNumber(const char *ptr) const;
     template <typename T>
     unsigned getLineNumberSpecialized(const char *ptr) const;
 
+    /// Return the line and the column (both starting from 1) of the char at
+    /// the given \p offset of the buffer.
+    std::pair<unsigned, unsigned> getLineAndColumn(uint32_t offset) const;
+
     /// Return a pointer to the first character of the specified line number or
     /// null if the line number is invalid.
     const char *getPointerForLineNumber(unsigned lineNo) const;
@@ -108,16 +127,55 @@ private:
   };
   using MemBufPtr = std::unique_ptr<llvm::MemoryBuffer>;
 
-  /// This is all of the buffers that we are reading from.
-  std::vector<SrcBuffer> buffers;
+  /// This is all of the buffers that we are reading from. We use a deque
+  /// here since it keeps the references to the existing elements valid while
+  /// other namespaces are being loaded concurrently.
+  std::deque<SrcBuffer> buffers;
 
   /// A hashtable that works as an index from namespace names to the buffer
   /// position it the `buffer`
   llvm::StringMap<unsigned> nsTable;
 
+  /// Guards `buffers` and `nsTable` against concurrent access while loading
+  /// namespaces in parallel.
+  mutable std::mutex lock;
+
   // This is the list of directories we should search for include files in.
   std::vector<std::string> loadPaths;
 
+  /// The maximum number of nested lists that we accept in a namespace.
+  size_t maxDepth = Reader::DEFAULT_MAX_DEPTH;
+
+  /// Where to report the time of parsing and the size of the namespaces to,
+  /// if any.
+  Instrumentation *instr = nullptr;
+
+  /// The content of the files that we have read so far and the result of the
+  /// namespace lookups in the `loadPaths`.
+  SourceCache cache;
+
+  /// The directory of the binary AST cache, or empty if it's disabled. Look
+  /// at `setASTCacheDir`.
+  std::string astCacheDir;
+  uint64_t astCacheMaxSize = 0;
+
+  /// Return the path of the AST cache file of the namespace \p name with
+  /// the content \p content.
+  std::string getASTCachePath(llvm::StringRef name,
+                              llvm::StringRef content) const;
+
+  /// Load the tree in the AST cache file at \p path into the given \p arena
+  /// and point its locations to the buffer \p bufferId. It returns
+  /// `std::nullopt` if there is no valid tree in the file.
+  std::optional<ast::Ast> loadCachedAst(llvm::StringRef path,
+                                        unsigned bufferId, ast::Arena &arena);
+
+  /// Store the given \p ast in the AST cache file at \p path.
+  void storeCachedAst(llvm::StringRef path, const ast::Ast &ast);
+
+  /// Evict the old files from the AST cache.
+  void pruneASTCache();
+
   // Find a namespace file with the given \p name in the load path and \r retuns
   // a unique pointer to the memory buffer containing the content or an error.
   // In the success case it will put the path of the file into the \p
@@ -134,23 +192,54 @@ public:
   SourceMgr()                             = default;
   SourceMgr(const SourceMgr &)            = delete;
   SourceMgr &operator=(const SourceMgr &) = delete;
-  SourceMgr(SourceMgr &&)                 = default;
-  SourceMgr &operator=(SourceMgr &&)      = default;
+  SourceMgr(SourceMgr &&)                 = delete;
+  SourceMgr &operator=(SourceMgr &&)      = delete;
   ~SourceMgr()                            = default;
 
   /// Set the `loadPaths` to the given \p dirs. `loadPaths` is a vector of
   /// directories that Serene will look in order to find a file that constains a
   /// namespace which it is looking for.
-  void setLoadPaths(std::vector<std::string> &dirs) { loadPaths.swap(dirs); }
+  void setLoadPaths(std::vector<std::string> &dirs) {
+    loadPaths.swap(dirs);
+    cache.clearResolutions();
+  }
+
+  /// Set the maximum number of nested lists that we accept in a namespace
+  /// to \p depth (look at `Reader::setMaxDepth`).
+  void setMaxDepth(size_t depth) { maxDepth = depth; }
+
+  /// Report the time of reading each namespace, the bytes read and the
+  /// nodes allocated to \p i from now on. \p i has to outlive this object.
+  void setInstrumentation(Instrumentation *i) { instr = i; }
+
+  /// Persist the tree of every namespace that gets read in the directory
+  /// \p dir from now on, and load the trees from there instead of parsing
+  /// the source files whenever their content hasn't changed. An empty \p dir
+  /// disables the cache.
+  ///
+  /// The cache files are keyed by the name of the namespace and the hash of
+  /// its content, and they get memory mapped and loaded without running the
+  /// `Reader`. Files are written to a temporary file first and then renamed,
+  /// so different processes can share the same directory safely.
+  ///
+  /// The old files get evicted when the directory grows beyond \p maxSize
+  /// bytes (`0` means no limit) or when they haven't been used for a while.
+  void setASTCacheDir(llvm::StringRef dir, uint64_t maxSize = 0);
+
+  /// Return the cache of the source files. Use it to invalidate the cached
+  /// lookups, e.g. when a new namespace file gets created.
+  SourceCache &getSourceCache() { return cache; }
 
   /// Return a reference to a `SrcBuffer` with the given ID \p i.
   const SrcBuffer &getBufferInfo(unsigned i) const {
+    std::lock_guard<std::mutex> guard(lock);
     assert(isValidBufferID(i));
     return buffers[i - 1];
   }
 
   /// Return a reference to a `SrcBuffer` with the given namspace name \p ns.
   const SrcBuffer &getBufferInfo(llvm::StringRef ns) const {
+    std::lock_guard<std::mutex> guard(lock);
     auto bufferId = nsTable.lookup(ns);
 
     if (bufferId == 0) {
@@ -165,11 +254,24 @@ public:
   /// Return a pointer to the internal `llvm::MemoryBuffer` of the `SrcBuffer`
   /// with the given ID \p i.
   const llvm::MemoryBuffer *getMemoryBuffer(unsigned i) const {
+    std::lock_guard<std::mutex> guard(lock);
     assert(isValidBufferID(i));
     return buffers[i - 1].buffer.get();
   }
 
-  unsigned getNumBuffers() const { return buffers.size(); }
+  unsigned getNumBuffers() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return buffers.size();
+  }
+
+  /// Resolve the given location \p loc to a line and column pair (both
+  /// starting from 1). It returns `{0, 0}` for the locations that are not
+  /// managed by this source manager.
+  std::pair<unsigned, unsigned> getLineAndColumn(const Location &loc) const;
+
+  /// Return the string representation of the given location \p loc in
+  /// the form of `file:line:col`.
+  std::string toString(const Location &loc) const;
 
   /// Add a new source buffer to this source manager. This takes ownership of
   /// the memory buffer.
@@ -184,7 +286,58 @@ public:
   ///
   /// \p importLoc is a location in the source code where the give namespace is
   /// imported.
+  ///
+  /// It is safe to call this function from different threads at the same
+  /// time.
   ast::MaybeNS readNamespace(std::string name, const LocationRange &importLoc);
+
+  /// A function that returns the names of the namespaces that the given
+  /// namespace depends on. Since the dependencies of a namespace are only
+  /// known after analyzing its AST, the caller is responsible to provide it.
+  using DependencyFn =
+      std::function<std::vector<std::string>(const ast::Namespace &)>;
+
+  /// Load the namespaces with the given \p names and all of their
+  /// dependencies (as reported by \p deps) concurrently on a thread pool of
+  /// \p threads threads (`0` means as many as the hardware supports).
+  ///
+  /// The dependency graph is resolved in waves. All the namespaces of a wave
+  /// are independent from each other and get parsed in parallel, the
+  /// dependencies that they introduce form the next wave. Each namespace is
+  /// loaded only once. In case of any error, the rest of the namespaces will
+  /// be loaded anyway and all the errors get returned together.
+  ///
+  /// \p importLoc is a location in the source code where the given namespaces
+  /// are imported.
+  llvm::Expected<ast::Namespaces>
+  readNamespaces(llvm::ArrayRef<std::string> names,
+                 const LocationRange &importLoc, DependencyFn deps = nullptr,
+                 unsigned threads = 0);
+
+  /// Update the already loaded namespace \p ns with the new content of its
+  /// source file \p newBuf, in which the byte range of [\p begin, \p end)
+  /// of the previous content is replaced by something else. The edit may
+  /// change the size of the content.
+  ///
+  /// Instead of reading the whole buffer again, only the top level forms
+  /// that overlap with (or touch) the edited range get re-read and spliced
+  /// into the tree of \p ns. The nodes of the rest of the forms remain the
+  /// same and only their locations get updated to point to the new buffer.
+  /// If the edit leaves the re-read forms unbalanced, everything from the
+  /// first affected form to the end of the buffer gets re-read.
+  ///
+  /// The previous buffer stays alive, since the unchanged nodes still refer
+  /// to its content. In case of an error \p ns remains untouched and
+  /// \p newBuf doesn't get registered, so the locations in the error are
+  /// only offsets into \p newBuf without a buffer ID.
+  llvm::Error updateNamespace(ast::Namespace &ns,
+                              std::unique_ptr<llvm::MemoryBuffer> newBuf,
+                              uint32_t begin, uint32_t end);
+
+  /// Just like the other `updateNamespace`, but finds the edited range by
+  /// comparing the previous content of \p ns with \p newBuf.
+  llvm::Error updateNamespace(ast::Namespace &ns,
+                              std::unique_ptr<llvm::MemoryBuffer> newBuf);
 };
 
 }; // namespace serene
@@ -0,0 +1,91 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "symbol_table.h"
+
+#include "utils.h"
+
+#include <llvm/ADT/SmallString.h>
+
+#include <cassert>
+#include <mutex>
+
+namespace serene {
+
+SymbolID SymbolTable::intern(llvm::StringRef name) {
+  {
+    std::shared_lock<std::shared_mutex> readLock(lock);
+    auto i = ids.find(name);
+    if (i != ids.end()) {
+      return i->second;
+    }
+  }
+
+  std::unique_lock<std::shared_mutex> writeLock(lock);
+
+  // Another thread might have interned the name in the mean time
+  auto [i, inserted] = ids.try_emplace(name, names.size() + 1);
+  if (inserted) {
+    names.push_back(i->first());
+  }
+
+  return i->second;
+};
+
+SymbolID SymbolTable::intern(llvm::StringRef ns, llvm::StringRef sym) {
+  llvm::SmallString<MAX_SYMBOL_NAME_SLOTS> fqName;
+  makeFQSymbolName(ns, sym, fqName);
+  return intern(fqName);
+};
+
+std::optional<SymbolID> SymbolTable::lookup(llvm::StringRef name) const {
+  std::shared_lock<std::shared_mutex> readLock(lock);
+  auto i = ids.find(name);
+
+  if (i == ids.end()) {
+    return std::nullopt;
+  }
+
+  return i->second;
+};
+
+std::optional<SymbolID> SymbolTable::lookup(llvm::StringRef ns,
+                                            llvm::StringRef sym) const {
+  llvm::SmallString<MAX_SYMBOL_NAME_SLOTS> fqName;
+  makeFQSymbolName(ns, sym, fqName);
+  return lookup(fqName);
+};
+
+llvm::StringRef SymbolTable::getName(SymbolID id) const {
+  std::shared_lock<std::shared_mutex> readLock(lock);
+  assert(id != InvalidSymbolID && id <= names.size() && "Invalid symbol ID");
+  return names[id - 1];
+};
+
+size_t SymbolTable::size() const {
+  std::shared_lock<std::shared_mutex> readLock(lock);
+  return names.size();
+};
+
+SymbolTable &SymbolTable::global() {
+  static SymbolTable table;
+  return table;
+};
+
+} // namespace serene
@@ -0,0 +1,103 @@
+/* -*- C++ -*-
+ * Serene Programming Language
+ *
+ * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * Commentary:
+ * `SymbolTable` is a global interner that maps each distinct fully qualified
+ * symbol name (`ns/name`, look at `makeFQSymbolName`) or namespace name to a
+ * stable 32-bit ID. IDs never change during the life of the process. So the
+ * rest of the compiler can compare and hash integers instead of strings.
+ *
+ * It's safe to use the symbol table from different threads. Looking up an
+ * already interned name only takes a shared lock.
+ */
+
+#ifndef SERENE_SYMBOL_TABLE_H
+#define SERENE_SYMBOL_TABLE_H
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <vector>
+
+namespace serene {
+
+using SymbolID = uint32_t;
+
+/// No valid symbol will ever get this ID.
+constexpr static SymbolID InvalidSymbolID = 0;
+
+class SymbolTable {
+  mutable std::shared_mutex lock;
+
+  /// The owner of the names. StringMap keeps the keys at stable addresses,
+  /// so we can hand out `StringRef`s to them.
+  llvm::StringMap<SymbolID, llvm::BumpPtrAllocator> ids;
+
+  /// The reverse mapping. The name of the symbol with ID `i` is at `i - 1`.
+  std::vector<llvm::StringRef> names;
+
+public:
+  SymbolTable()                               = default;
+  SymbolTable(const SymbolTable &)            = delete;
+  SymbolTable &operator=(const SymbolTable &) = delete;
+
+  /// Return the ID of the given \p name and intern it if it's the first time
+  /// that we see the name.
+  SymbolID intern(llvm::StringRef name);
+
+  /// Intern the fully qualified name of the symbol \p sym in namespace \p ns.
+  SymbolID intern(llvm::StringRef ns, llvm::StringRef sym);
+
+  /// Return the ID of the given \p name only if it has been already interned.
+  /// Unlike `intern` it never grows the table.
+  std::optional<SymbolID> lookup(llvm::StringRef name) const;
+
+  /// Return the ID of the fully qualified name of the symbol \p sym in
+  /// namespace \p ns only if it has been already interned.
+  std::optional<SymbolID> lookup(llvm::StringRef ns, llvm::StringRef sym) const;
+
+  /// Return the name of the given symbol \p id.
+  llvm::StringRef getName(SymbolID id) const;
+
+  /// Return the number of interned names
+  size_t size() const;
+
+  /// Return the process wide symbol table
+  static SymbolTable &global();
+};
+
+/// A shortcut to intern the given \p name in the global symbol table.
+inline SymbolID internSymbol(llvm::StringRef name) {
+  return SymbolTable::global().intern(name);
+};
+
+/// A shortcut to intern the fully qualified name of \p sym in \p ns in the
+/// global symbol table.
+inline SymbolID internSymbol(llvm::StringRef ns, llvm::StringRef sym) {
+  return SymbolTable::global().intern(ns, sym);
+};
+
+} // namespace serene
+
+#endif
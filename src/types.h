@@ -1,4 +1,4 @@
-/* -*- C -*-
+/* -*- C++ -*-
  * Serene Programming Language
  *
  * Copyright (c) 2019-2023 Sameer Rahmani <lxsameer@gnu.org>
@@ -16,11 +16,39 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/**
+ * Commentary:
+ * The runtime representation of the values. Every value is a single 64-bit
+ * word (`Value`) and the small values are encoded in the word itself, so
+ * they don't need any allocation and the generated code can check their
+ * type and do arithmetic on them without touching the memory:
+ *
+ *   ...............................................................1  fixnum
+ *   ..............................................................000 pointer
+ *   [            symbol id           ]..............................010 symbol
+ *   ..............................................................110 special
+ *
+ * - Fixnums are 63-bit signed integers shifted one bit to the left. Adding
+ *   two fixnums is `a + b - 1` and checking the overflow of the machine
+ *   addition is enough to detect the overflow of the fixnum.
+ * - Heap objects are at least 8 bytes aligned, so their pointers have three
+ *   zero bits at the bottom. `nil` is the null pointer.
+ * - Symbols carry their interned `SymbolID` in the upper 32 bits.
+ * - Special constants like `true` and `false` carry a small number above the
+ *   tag.
+ *
+ * Every heap object starts with an `Object` header that points to its
+ * shared, statically allocated `Type`. Lists, strings, closures, the
+ * persistent collections (look at `runtime/collections.h`) and the numbers
+ * that don't fit in a fixnum live on the heap.
+ */
+
 #ifndef TYPES_H
 #define TYPES_H
 
 #include "serene/config.h"
 
+#include <cassert>
 #include <cstdint>
 
 typedef struct {
@@ -29,17 +57,28 @@ typedef struct {
 
 } Type;
 
+/// The header of all the heap allocated objects
 typedef struct {
-  const Type type;
-  const void *data;
+  const Type *type;
 } Object;
 
-static const Type type          = {.id = TYPE, .name = "type"};
-static const Type nil_type      = {.id = NIL, .name = "nil"};
-static const Type function_type = {.id = FN, .name = "function"};
-static const Type protocol_type = {.id = PROTOCOL, .name = "protocol"};
-static const Type int_type      = {.id = INT, .name = "int"};
-static const Type list_type     = {.id = LIST, .name = "list"};
+typedef uint64_t Value;
+
+// The types are `inline`, so all the translation units share the same objects
+// and the type of an object can be compared by address
+inline const Type type          = {.id = TypeID::TYPE, .name = "type"};
+inline const Type nil_type      = {.id = TypeID::NIL, .name = "nil"};
+inline const Type bool_type     = {.id = TypeID::BOOL, .name = "bool"};
+inline const Type function_type = {.id = TypeID::FN, .name = "function"};
+inline const Type protocol_type = {.id = TypeID::PROTOCOL, .name = "protocol"};
+inline const Type int_type      = {.id = TypeID::INT, .name = "int"};
+inline const Type list_type     = {.id = TypeID::LIST, .name = "list"};
+inline const Type symbol_type   = {.id = TypeID::SYMBOL, .name = "symbol"};
+inline const Type number_type   = {.id = TypeID::NUMBER, .name = "number"};
+inline const Type string_type   = {.id = TypeID::STRING, .name = "string"};
+inline const Type vector_type   = {.id = TypeID::VECTOR, .name = "vector"};
+inline const Type map_type      = {.id = TypeID::MAP, .name = "map"};
+inline const Type float_type    = {.id = TypeID::NUMBER, .name = "float"};
 
 typedef struct {
   const Type type;
@@ -60,27 +99,148 @@ typedef struct {
 } PairType;
 
 typedef struct {
-  const PairType type;
-  void *first;
-  void *second;
+  Object header;
+  Value first;
+  Value second;
 } Pair;
 
 typedef struct {
+  Object header;
   const Pair *head;
   const unsigned int len;
 } List;
 
+/// Symbols are immediate values, this is only the name of a symbol
 typedef struct {
   const char *name;
 } Symbol;
 
 typedef struct {
+  Object header;
   const char *data;
   const unsigned int len;
 } String;
 
+/// The box of the integers that don't fit in a fixnum
 typedef struct {
-  const long data;
+  Object header;
+  const int64_t data;
 } Number;
 
+typedef struct {
+  Object header;
+  const double data;
+} Float;
+
+/// A function and the values that it captures
+typedef struct {
+  Object header;
+  const void *fn;
+  const unsigned int numCaptures;
+  const Value *captures;
+} Closure;
+
+// ============================================================================
+// Value encoding
+// ============================================================================
+constexpr Value VALUE_TAG_MASK    = 0x7;
+constexpr Value VALUE_POINTER_TAG = 0x0;
+constexpr Value VALUE_SYMBOL_TAG  = 0x2;
+constexpr Value VALUE_SPECIAL_TAG = 0x6;
+constexpr unsigned VALUE_TAG_BITS = 3;
+
+constexpr int64_t FIXNUM_MAX = INT64_MAX >> 1;
+constexpr int64_t FIXNUM_MIN = INT64_MIN >> 1;
+
+constexpr Value nil_value   = 0;
+constexpr Value false_value = (0 << VALUE_TAG_BITS) | VALUE_SPECIAL_TAG;
+constexpr Value true_value  = (1 << VALUE_TAG_BITS) | VALUE_SPECIAL_TAG;
+
+inline bool isFixnum(Value v) { return (v & 1) != 0; }
+
+inline bool isPointer(Value v) {
+  return (v & VALUE_TAG_MASK) == VALUE_POINTER_TAG;
+}
+
+inline bool isSymbol(Value v) {
+  return (v & VALUE_TAG_MASK) == VALUE_SYMBOL_TAG;
+}
+
+inline bool isNil(Value v) { return v == nil_value; }
+
+inline bool isBool(Value v) {
+  return v == true_value || v == false_value;
+}
+
+/// Everything but `nil` and `false` is truthy
+inline bool isTruthy(Value v) {
+  return v != nil_value && v != false_value;
+}
+
+/// Whether the given integer \p i fits in a fixnum
+inline bool fitsInFixnum(int64_t i) {
+  return i >= FIXNUM_MIN && i <= FIXNUM_MAX;
+}
+
+inline Value fromFixnum(int64_t i) {
+  return (static_cast<uint64_t>(i) << 1) | 1;
+}
+
+inline int64_t toFixnum(Value v) {
+  // Arithmetic shift keeps the sign
+  return static_cast<int64_t>(v) >> 1;
+}
+
+inline Value fromSymbolID(uint32_t id) {
+  return (static_cast<uint64_t>(id) << 32) | VALUE_SYMBOL_TAG;
+}
+
+inline uint32_t toSymbolID(Value v) { return static_cast<uint32_t>(v >> 32); }
+
+inline Value fromBool(bool b) { return b ? true_value : false_value; }
+
+inline Value fromObject(const Object *o) {
+  return static_cast<Value>(reinterpret_cast<uintptr_t>(o));
+}
+
+inline Object *toObject(Value v) {
+  return reinterpret_cast<Object *>(static_cast<uintptr_t>(v));
+}
+
+/// Return the type ID of any value \p v
+inline TypeID getTypeID(Value v) {
+  if (isFixnum(v)) {
+    return TypeID::INT;
+  }
+
+  if (isSymbol(v)) {
+    return TypeID::SYMBOL;
+  }
+
+  if (isNil(v)) {
+    return TypeID::NIL;
+  }
+
+  if (isPointer(v)) {
+    return toObject(v)->type->id;
+  }
+
+  assert(isBool(v) && "The only other immediate values are the booleans");
+  return TypeID::BOOL;
+}
+
+/// Add two fixnums \p a and \p b and put the result in \p result. It returns
+/// false if the result doesn't fit in a fixnum.
+inline bool addFixnums(Value a, Value b, Value *result) {
+  int64_t sum;
+  // The tag bit of `a` plus the value of `b` with its tag cleared
+  if (__builtin_add_overflow(static_cast<int64_t>(a),
+                             static_cast<int64_t>(b - 1), &sum)) {
+    return false;
+  }
+
+  *result = static_cast<Value>(sum);
+  return true;
+}
+
 #endif
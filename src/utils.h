@@ -19,6 +19,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Twine.h>
 #include <llvm/Support/Error.h>
 
 #include <variant>
@@ -29,6 +31,9 @@
 
 // We use this value with llvm::SmallString<MAX_PATH_SLOTS>
 #define MAX_PATH_SLOTS 256
+// We use this value with llvm::SmallString<MAX_SYMBOL_NAME_SLOTS> to build
+// the fully qualified names of the symbols
+#define MAX_SYMBOL_NAME_SLOTS 64
 // C++17 required. We can't go back to 14 any more :))
 
 namespace serene {
@@ -134,5 +139,14 @@ inline void makeFQSymbolName(const llvm::StringRef &ns,
   result = (ns + "/" + sym).str();
 };
 
+/// The same as the other `makeFQSymbolName` but writes the result into a
+/// small vector to avoid hitting the heap for the common short names.
+inline void makeFQSymbolName(const llvm::StringRef &ns,
+                             const llvm::StringRef &sym,
+                             llvm::SmallVectorImpl<char> &result) {
+  result.clear();
+  (ns + "/" + sym).toVector(result);
+};
+
 } // namespace serene
 #endif